@@ -59,6 +59,250 @@
  *     any intermediate buffer copy overhead.
  */
 
+/*
+ * Optionally the total size of the backing pixmaps is limited by a budget.
+ * When the windows don't fit, the ones which had keyboard focus most
+ * recently are preferred (and then the smaller ones), the rest are left
+ * without backing store. Never focused windows are the first candidates
+ * for eviction, because they are typically desktop backgrounds or panels,
+ * which are rarely dragged around.
+ */
+
+/*
+ * The tuner is incremental: only the windows, which may need a different
+ * backing store mode (the old and the new focus window, newly created or
+ * reparented top-level windows and, with a budget, the ones which got
+ * mapped or resized) are put on the dirty list and checked in
+ * PostValidateTree. So the cost
+ * of the tree validation does not grow with the number of windows. With
+ * a budget, the whole list of top-level windows is only re-evaluated when
+ * something on the dirty list has changed.
+ */
+
+typedef struct {
+    unsigned int focus_stamp; /* FocusClock value when last focused */
+    size_t       bytes;       /* as accounted in the budget */
+    Bool         dirty;
+    WindowPtr    next_dirty;
+} BackingStoreWindowRec, *BackingStoreWindowPtr;
+
+static DevPrivateKeyRec BackingStoreWindowKeyRec;
+
+#define BS_WINDOW(pWin) ((BackingStoreWindowPtr)dixLookupPrivate(          \
+                   &(pWin)->devPrivates, &BackingStoreWindowKeyRec))
+
+typedef struct {
+    WindowPtr    pWin;
+    unsigned int focus_stamp;
+    size_t       bytes;
+} BackingStoreCandidate;
+
+static void MarkWindowDirty(BackingStoreTuner *private, WindowPtr pWin)
+{
+    BackingStoreWindowPtr bsw = BS_WINDOW(pWin);
+    if (bsw->dirty)
+        return;
+    bsw->dirty = TRUE;
+    bsw->next_dirty = private->DirtyWindows;
+    private->DirtyWindows = pWin;
+}
+
+static void UnmarkWindowDirty(BackingStoreTuner *private, WindowPtr pWin)
+{
+    WindowPtr *prev = &private->DirtyWindows;
+    if (!BS_WINDOW(pWin)->dirty)
+        return;
+    while (*prev != pWin)
+        prev = &BS_WINDOW(*prev)->next_dirty;
+    *prev = BS_WINDOW(pWin)->next_dirty;
+    BS_WINDOW(pWin)->dirty = FALSE;
+    BS_WINDOW(pWin)->next_dirty = NULL;
+}
+
+static WindowPtr PopDirtyWindow(BackingStoreTuner *private)
+{
+    WindowPtr pWin = private->DirtyWindows;
+    if (pWin)
+        UnmarkWindowDirty(private, pWin);
+    return pWin;
+}
+
+/* The size of the backing pixmap, which composite allocates for the window */
+static size_t BackingPixmapBytes(WindowPtr pWin)
+{
+    size_t bw = wBorderWidth(pWin);
+    if (!pWin->viewable)
+        return 0;
+    return (pWin->drawable.width + 2 * bw) * (pWin->drawable.height + 2 * bw) *
+           ((pWin->drawable.bitsPerPixel + 7) / 8);
+}
+
+static int CompareCandidates(const void *a, const void *b)
+{
+    const BackingStoreCandidate *ca = a, *cb = b;
+    /* Recently focused windows first */
+    if (ca->focus_stamp != cb->focus_stamp)
+        return ca->focus_stamp > cb->focus_stamp ? -1 : 1;
+    /* Then the smaller ones */
+    if (ca->bytes != cb->bytes)
+        return ca->bytes < cb->bytes ? -1 : 1;
+    return 0;
+}
+
+/*
+ * Change the backing store mode of the window. Returns FALSE if this has
+ * triggered a nested PostValidateTree call, which already did the job.
+ */
+static Bool
+SetWindowBackingStore(BackingStoreTuner *private, WindowPtr pWin, int mode,
+                      unsigned int CurrentCount)
+{
+    ScreenPtr pScreen = pWin->drawable.pScreen;
+    pScreen->backingStoreSupport = Always;
+    pWin->backingStore = mode;
+    (*pScreen->ChangeWindowAttributes) (pWin, CWBackingStore);
+    if (CurrentCount != private->PostValidateTreeCount) {
+        DebugMsg("Nested PostValidateTree in ChangeWindowAttributes\n");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* Is backing store wanted for this child of root, not counting the budget */
+static Bool WantsBackingStore(BackingStoreTuner *private, WindowPtr pWin)
+{
+    return private->ForceBackingStore || pWin != private->FocusWin;
+}
+
+/*
+ * Without a budget, every window decides for itself. Returns FALSE if
+ * a nested PostValidateTree call has happened.
+ */
+static Bool
+UpdateDirtyWindows(BackingStoreTuner *private, ScreenPtr pScreen,
+                   unsigned int CurrentCount)
+{
+    WindowPtr curWin;
+
+    while ((curWin = PopDirtyWindow(private))) {
+        Bool want;
+        if (curWin->parent != pScreen->root)
+            continue;
+        want = WantsBackingStore(private, curWin);
+        if (want && !curWin->backStorage) {
+            DebugMsg("Enable backing store for window 0x%x\n",
+                     (unsigned int)curWin->drawable.id);
+            if (!SetWindowBackingStore(private, curWin, WhenMapped,
+                                       CurrentCount))
+                return FALSE;
+        }
+        else if (!want && curWin->backStorage) {
+            DebugMsg("Disable backing store for the focus window 0x%x\n",
+                     (unsigned int)curWin->drawable.id);
+            if (!SetWindowBackingStore(private, curWin, NotUseful,
+                                       CurrentCount))
+                return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/*
+ * With a budget, a change of any window may affect the others, so all the
+ * children of root are re-evaluated. Only the windows, which end up with
+ * a different mode, are touched. Returns FALSE if a nested PostValidateTree
+ * call has happened. BudgetDirty stays set until the pass is complete, so
+ * that such nested call does the whole pass again instead of this one.
+ */
+static Bool
+UpdateBudgetedWindows(BackingStoreTuner *private, ScreenPtr pScreen,
+                      unsigned int CurrentCount)
+{
+    WindowPtr curWin;
+    BackingStoreCandidate *candidates = NULL;
+    int i, ncandidates = 0;
+    Bool result = TRUE;
+
+    /* The windows on the dirty list are all covered by this pass */
+    while (PopDirtyWindow(private));
+    private->BudgetDirty = TRUE;
+
+    /* Disable backing store for the focus window */
+    curWin = private->FocusWin;
+    if (curWin && !WantsBackingStore(private, curWin) && curWin->backStorage) {
+        DebugMsg("Disable backing store for the focus window 0x%x\n",
+                 (unsigned int)curWin->drawable.id);
+        if (!SetWindowBackingStore(private, curWin, NotUseful, CurrentCount))
+            return FALSE;
+    }
+
+    /* Collect all the other children of root, which want backing store */
+    for (curWin = pScreen->root->firstChild; curWin; curWin = curWin->nextSib) {
+        BS_WINDOW(curWin)->bytes = BackingPixmapBytes(curWin);
+        if (WantsBackingStore(private, curWin))
+            ncandidates++;
+    }
+    if (ncandidates == 0) {
+        private->UsedBytes = 0;
+        private->BudgetDirty = FALSE;
+        return TRUE;
+    }
+    candidates = malloc(ncandidates * sizeof(BackingStoreCandidate));
+    if (!candidates)
+        return TRUE;
+    ncandidates = 0;
+    for (curWin = pScreen->root->firstChild; curWin; curWin = curWin->nextSib) {
+        if (WantsBackingStore(private, curWin)) {
+            candidates[ncandidates].pWin = curWin;
+            candidates[ncandidates].focus_stamp = BS_WINDOW(curWin)->focus_stamp;
+            candidates[ncandidates].bytes = BS_WINDOW(curWin)->bytes;
+            ncandidates++;
+        }
+    }
+
+    /* Fit as many of them into the budget as possible */
+    qsort(candidates, ncandidates, sizeof(BackingStoreCandidate),
+          CompareCandidates);
+
+    private->UsedBytes = 0;
+    for (i = 0; i < ncandidates; i++) {
+        Bool keep = TRUE;
+        curWin = candidates[i].pWin;
+        if (private->UsedBytes + candidates[i].bytes > private->BudgetBytes)
+            keep = FALSE;
+        else
+            private->UsedBytes += candidates[i].bytes;
+
+        if (keep && !curWin->backStorage) {
+            DebugMsg("Enable backing store for window 0x%x\n",
+                     (unsigned int)curWin->drawable.id);
+            if (!SetWindowBackingStore(private, curWin, WhenMapped,
+                                       CurrentCount)) {
+                result = FALSE;
+                break;
+            }
+        }
+        else if (!keep && curWin->backStorage) {
+            DebugMsg("Over budget, disable backing store for window 0x%x\n",
+                     (unsigned int)curWin->drawable.id);
+            private->Evictions++;
+            if (!SetWindowBackingStore(private, curWin, NotUseful,
+                                       CurrentCount)) {
+                result = FALSE;
+                break;
+            }
+        }
+    }
+    if (result) {
+        if (private->UsedBytes > private->PeakBytes)
+            private->PeakBytes = private->UsedBytes;
+        private->BudgetDirty = FALSE;
+    }
+
+    free(candidates);
+    return result;
+}
+
 static void
 xPostValidateTree(WindowPtr pWin, WindowPtr pLayerWin, VTKind kind)
 {
@@ -66,7 +310,7 @@ xPostValidateTree(WindowPtr pWin, WindowPtr pLayerWin, VTKind kind)
                                pLayerWin->drawable.pScreen;
     ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
     BackingStoreTuner *private = BACKING_STORE_TUNER(pScrn);
-    WindowPtr curWin, focusWin = NULL;
+    WindowPtr focusWin = NULL;
     /*
      * Increment and backup the current counter. Because ChangeWindowAttributes
      * may trigger nested PostValidateTree calls, we want to detect this
@@ -83,18 +327,37 @@ xPostValidateTree(WindowPtr pWin, WindowPtr pLayerWin, VTKind kind)
         pScreen->PostValidateTree = xPostValidateTree;
     }
 
+    /* A top-level window got mapped, unmapped or resized */
+    if (private->BudgetBytes && pLayerWin && pLayerWin->parent == pScreen->root &&
+            BackingPixmapBytes(pLayerWin) != BS_WINDOW(pLayerWin)->bytes)
+        MarkWindowDirty(private, pLayerWin);
+
     /* Find the window with keyboard focus */
     if (inputInfo.keyboard && inputInfo.keyboard->focus)
         focusWin = inputInfo.keyboard->focus->win;
 
-    if (!pWin || !focusWin || focusWin == NoneWin || focusWin == PointerRootWin)
-        return;
+    /*
+     * Track the focus changes. Even if there is no usable focus window,
+     * the windows marked dirty by create, reparent or destroy still need
+     * to be processed below.
+     */
+    if (pWin && focusWin && focusWin != NoneWin && focusWin != PointerRootWin) {
+        /* Descend down to the window, which has the root window as a parent */
+        while (focusWin->parent && focusWin->parent != pScreen->root)
+            focusWin = focusWin->parent;
 
-    /* Descend down to the window, which has the root window as a parent */
-    while (focusWin->parent && focusWin->parent != pScreen->root)
-        focusWin = focusWin->parent;
+        if (focusWin->parent == pScreen->root && focusWin != private->FocusWin) {
+            if (private->FocusWin)
+                MarkWindowDirty(private, private->FocusWin);
+            MarkWindowDirty(private, focusWin);
+            private->FocusWin = focusWin;
+            /* Remember when the window had focus, this is its eviction priority */
+            BS_WINDOW(focusWin)->focus_stamp = ++private->FocusClock;
+        }
+    }
 
-    if (focusWin->parent != pScreen->root)
+    /* Nothing has changed, which is the common case */
+    if (!private->DirtyWindows && !private->BudgetDirty)
         return;
 
     /*
@@ -107,40 +370,54 @@ xPostValidateTree(WindowPtr pWin, WindowPtr pLayerWin, VTKind kind)
     }
 
     private->PostValidateTreeNestingLevel++;
+    if (private->BudgetBytes)
+        UpdateBudgetedWindows(private, pScreen, CurrentCount);
+    else
+        UpdateDirtyWindows(private, pScreen, CurrentCount);
+    private->PostValidateTreeNestingLevel--;
+}
 
-    /* Disable backing store for the focus window */
-    if (!private->ForceBackingStore && focusWin->backStorage) {
-        DebugMsg("Disable backing store for the focus window 0x%x\n",
-                 (unsigned int)focusWin->drawable.id);
-        pScreen->backingStoreSupport = Always;
-        focusWin->backingStore = NotUseful;
-        (*pScreen->ChangeWindowAttributes) (focusWin, CWBackingStore);
-        if (CurrentCount != private->PostValidateTreeCount) {
-            DebugMsg("Nested PostValidateTree in ChangeWindowAttributes\n");
-            private->PostValidateTreeNestingLevel--;
-            return;
-        }
-    }
+static Bool
+xCreateWindow(WindowPtr pWin)
+{
+    ScreenPtr pScreen = pWin->drawable.pScreen;
+    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+    BackingStoreTuner *private = BACKING_STORE_TUNER(pScrn);
+    Bool ret;
 
-    /* And enable backing store for all the other children of root */
-    curWin = pScreen->root->firstChild;
-    while (curWin) {
-        if (!curWin->backStorage && (private->ForceBackingStore ||
-                                     curWin != focusWin)) {
-            DebugMsg("Enable backing store for window 0x%x\n",
-                     (unsigned int)curWin->drawable.id);
-            pScreen->backingStoreSupport = Always;
-            curWin->backingStore = WhenMapped;
-            (*pScreen->ChangeWindowAttributes) (curWin, CWBackingStore);
-            if (CurrentCount != private->PostValidateTreeCount) {
-                DebugMsg("Nested PostValidateTree in ChangeWindowAttributes\n");
-                private->PostValidateTreeNestingLevel--;
-                return;
-            }
-        }
-        curWin = curWin->nextSib;
-    }
-    private->PostValidateTreeNestingLevel--;
+    pScreen->CreateWindow = private->CreateWindow;
+    ret = (*pScreen->CreateWindow) (pWin);
+    private->CreateWindow = pScreen->CreateWindow;
+    pScreen->CreateWindow = xCreateWindow;
+
+    if (ret && pWin->parent && pWin->parent == pScreen->root)
+        MarkWindowDirty(private, pWin);
+
+    return ret;
+}
+
+static Bool
+xDestroyWindow(WindowPtr pWin)
+{
+    ScreenPtr pScreen = pWin->drawable.pScreen;
+    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+    BackingStoreTuner *private = BACKING_STORE_TUNER(pScrn);
+    Bool ret;
+
+    UnmarkWindowDirty(private, pWin);
+    if (pWin == private->FocusWin)
+        private->FocusWin = NULL;
+    /* Let the budget be recalculated without this window */
+    if (private->BudgetBytes && pWin->parent == pScreen->root &&
+                                BS_WINDOW(pWin)->bytes)
+        private->BudgetDirty = TRUE;
+
+    pScreen->DestroyWindow = private->DestroyWindow;
+    ret = (*pScreen->DestroyWindow) (pWin);
+    private->DestroyWindow = pScreen->DestroyWindow;
+    pScreen->DestroyWindow = xDestroyWindow;
+
+    return ret;
 }
 
 static void
@@ -157,6 +434,9 @@ xReparentWindow(WindowPtr pWin, WindowPtr pPriorParent)
         pScreen->ReparentWindow = xReparentWindow;
     }
 
+    if (pWin->parent == pScreen->root)
+        MarkWindowDirty(private, pWin);
+
     /* We only want backing store set for direct children of root */
     if (pPriorParent == pScreen->root && pWin->backStorage) {
         DebugMsg("Reparent window 0x%x from root, disabling backing store\n",
@@ -167,11 +447,165 @@ xReparentWindow(WindowPtr pWin, WindowPtr pPriorParent)
     }
 }
 
+/*
+ * The backing pixmaps can be allocated from a pool in the offscreen part of
+ * framebuffer. Then both the source and the destination of the copies done
+ * on expose and when saving the window contents are inside framebuffer, so
+ * they are handled by G2D rather than the CPU. The pool is managed by a
+ * simple first-fit allocator, there are only a few top-level windows.
+ */
+
+#define POOL_ALIGNMENT 64
+
+typedef struct BackingStorePoolBlock {
+    struct BackingStorePoolBlock *next;
+    size_t                        offset;
+    size_t                        size;
+    Bool                          used;
+} BackingStorePoolBlock;
+
+static DevPrivateKeyRec BackingStorePixmapKeyRec;
+
+#define BS_PIXMAP_BLOCK(pPixmap) ((BackingStorePoolBlock *)dixLookupPrivate( \
+                   &(pPixmap)->devPrivates, &BackingStorePixmapKeyRec))
+
+static BackingStorePoolBlock *PoolAlloc(BackingStoreTuner *private,
+                                        size_t size)
+{
+    BackingStorePoolBlock *block, *rest;
+
+    size = (size + POOL_ALIGNMENT - 1) & ~(POOL_ALIGNMENT - 1);
+    for (block = private->PoolBlocks; block; block = block->next) {
+        if (!block->used && block->size >= size)
+            break;
+    }
+    if (!block)
+        return NULL;
+
+    /* Split off the unused part */
+    if (block->size > size) {
+        if (!(rest = calloc(1, sizeof(BackingStorePoolBlock))))
+            return NULL;
+        rest->offset = block->offset + size;
+        rest->size = block->size - size;
+        rest->next = block->next;
+        block->next = rest;
+        block->size = size;
+    }
+    block->used = TRUE;
+    return block;
+}
+
+static void PoolFree(BackingStoreTuner *private, BackingStorePoolBlock *block)
+{
+    BackingStorePoolBlock *prev = NULL, *cur, *next;
+
+    block->used = FALSE;
+
+    /* Merge with the neighbours if they are free too */
+    for (cur = private->PoolBlocks; cur != block; cur = cur->next)
+        prev = cur;
+    if ((next = block->next) && !next->used) {
+        block->size += next->size;
+        block->next = next->next;
+        free(next);
+    }
+    if (prev && !prev->used) {
+        prev->size += block->size;
+        prev->next = block->next;
+        free(block);
+    }
+}
+
+static PixmapPtr
+xCreatePixmap(ScreenPtr pScreen, int width, int height, int depth,
+              unsigned usage_hint)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+    BackingStoreTuner *private = BACKING_STORE_TUNER(pScrn);
+    BackingStorePoolBlock *block = NULL;
+    PixmapPtr pPixmap;
+    int stride = 0;
+
+    /* Only the pixmaps in the screen format can be copied by G2D */
+    if (usage_hint == CREATE_PIXMAP_USAGE_BACKING_PIXMAP &&
+        depth == pScrn->depth && width > 0 && height > 0) {
+        stride = ((width * pScrn->bitsPerPixel + 31) >> 5) * 4;
+        if (!(block = PoolAlloc(private, (size_t)stride * height)))
+            private->PoolFailures++;
+    }
+
+    pScreen->CreatePixmap = private->CreatePixmap;
+    if (block)
+        pPixmap = (*pScreen->CreatePixmap) (pScreen, 0, 0, depth, usage_hint);
+    else
+        pPixmap = (*pScreen->CreatePixmap) (pScreen, width, height, depth,
+                                            usage_hint);
+    private->CreatePixmap = pScreen->CreatePixmap;
+    pScreen->CreatePixmap = xCreatePixmap;
+
+    if (!block)
+        return pPixmap;
+
+    if (!pPixmap || !(*pScreen->ModifyPixmapHeader) (pPixmap, width, height,
+                                   depth, pScrn->bitsPerPixel, stride,
+                                   private->PoolAddr + block->offset)) {
+        if (pPixmap)
+            (*pScreen->DestroyPixmap) (pPixmap);
+        PoolFree(private, block);
+        /* Fall back to the ordinary pixmap */
+        pScreen->CreatePixmap = private->CreatePixmap;
+        pPixmap = (*pScreen->CreatePixmap) (pScreen, width, height, depth,
+                                            usage_hint);
+        private->CreatePixmap = pScreen->CreatePixmap;
+        pScreen->CreatePixmap = xCreatePixmap;
+        return pPixmap;
+    }
+
+    dixSetPrivate(&pPixmap->devPrivates, &BackingStorePixmapKeyRec, block);
+    private->PoolPixmaps++;
+    return pPixmap;
+}
+
+static Bool
+xDestroyPixmap(PixmapPtr pPixmap)
+{
+    ScreenPtr pScreen = pPixmap->drawable.pScreen;
+    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+    BackingStoreTuner *private = BACKING_STORE_TUNER(pScrn);
+    BackingStorePoolBlock *block = NULL;
+    Bool result;
+
+    if (pPixmap->refcnt == 1)
+        block = BS_PIXMAP_BLOCK(pPixmap);
+
+    pScreen->DestroyPixmap = private->DestroyPixmap;
+    result = (*pScreen->DestroyPixmap) (pPixmap);
+    private->DestroyPixmap = pScreen->DestroyPixmap;
+    pScreen->DestroyPixmap = xDestroyPixmap;
+
+    if (block)
+        PoolFree(private, block);
+
+    return result;
+}
+
 /*****************************************************************************/
 
-BackingStoreTuner *BackingStoreTuner_Init(ScreenPtr pScreen, Bool force)
+BackingStoreTuner *BackingStoreTuner_Init(ScreenPtr pScreen, Bool force,
+                                          int budget_mb)
 {
-    BackingStoreTuner *private = calloc(1, sizeof(BackingStoreTuner));
+    BackingStoreTuner *private;
+
+    if (!dixRegisterPrivateKey(&BackingStoreWindowKeyRec, PRIVATE_WINDOW,
+                               sizeof(BackingStoreWindowRec)) ||
+        !dixRegisterPrivateKey(&BackingStorePixmapKeyRec, PRIVATE_PIXMAP, 0)) {
+        xf86DrvMsg(pScreen->myNum, X_INFO,
+            "BackingStoreTuner_Init: dixRegisterPrivateKey failed\n");
+        return NULL;
+    }
+
+    private = calloc(1, sizeof(BackingStoreTuner));
     if (!private) {
         xf86DrvMsg(pScreen->myNum, X_INFO,
             "BackingStoreTuner_Init: calloc failed\n");
@@ -179,6 +613,11 @@ BackingStoreTuner *BackingStoreTuner_Init(ScreenPtr pScreen, Bool force)
     }
 
     private->ForceBackingStore = force;
+    if (budget_mb > 0) {
+        private->BudgetBytes = (size_t)budget_mb * 1024 * 1024;
+        xf86DrvMsg(pScreen->myNum, X_INFO,
+                   "backing store is limited to %d MiB\n", budget_mb);
+    }
 
     if (private->ForceBackingStore)
         xf86DrvMsg(pScreen->myNum, X_INFO,
@@ -195,6 +634,12 @@ BackingStoreTuner *BackingStoreTuner_Init(ScreenPtr pScreen, Bool force)
     private->ReparentWindow = pScreen->ReparentWindow;
     pScreen->ReparentWindow = xReparentWindow;
 
+    /* Wrap the current CreateWindow and DestroyWindow functions */
+    private->CreateWindow = pScreen->CreateWindow;
+    pScreen->CreateWindow = xCreateWindow;
+    private->DestroyWindow = pScreen->DestroyWindow;
+    pScreen->DestroyWindow = xDestroyWindow;
+
     return private;
 }
 
@@ -203,6 +648,57 @@ void BackingStoreTuner_Close(ScreenPtr pScreen)
     ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
     BackingStoreTuner *private = BACKING_STORE_TUNER(pScrn);
 
+    if (private->PoolBlocks) {
+        BackingStorePoolBlock *block = private->PoolBlocks, *next;
+        xf86DrvMsgVerb(pScreen->myNum, X_INFO, 3,
+                       "backing store: %lu pixmaps in framebuffer, %lu didn't fit\n",
+                       private->PoolPixmaps, private->PoolFailures);
+        pScreen->CreatePixmap  = private->CreatePixmap;
+        pScreen->DestroyPixmap = private->DestroyPixmap;
+        for (; block; block = next) {
+            next = block->next;
+            free(block);
+        }
+        private->PoolBlocks = NULL;
+    }
+
+    if (private->BudgetBytes)
+        xf86DrvMsgVerb(pScreen->myNum, X_INFO, 3,
+                       "backing store: peak %lu KiB, %lu evictions\n",
+                       (unsigned long)(private->PeakBytes / 1024),
+                       private->Evictions);
+
     pScreen->PostValidateTree = private->PostValidateTree;
     pScreen->ReparentWindow   = private->ReparentWindow;
+    pScreen->CreateWindow     = private->CreateWindow;
+    pScreen->DestroyWindow    = private->DestroyWindow;
+}
+
+Bool BackingStoreTuner_SetPixmapPool(ScreenPtr pScreen, void *addr,
+                                     size_t size)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+    BackingStoreTuner *private = BACKING_STORE_TUNER(pScrn);
+    BackingStorePoolBlock *block;
+
+    if (private->PoolBlocks || size < POOL_ALIGNMENT)
+        return FALSE;
+    if (!(block = calloc(1, sizeof(BackingStorePoolBlock))))
+        return FALSE;
+
+    block->size = size & ~(POOL_ALIGNMENT - 1);
+    private->PoolBlocks = block;
+    private->PoolAddr = addr;
+    private->PoolSize = size;
+
+    /* Wrap the current CreatePixmap and DestroyPixmap functions */
+    private->CreatePixmap = pScreen->CreatePixmap;
+    pScreen->CreatePixmap = xCreatePixmap;
+    private->DestroyPixmap = pScreen->DestroyPixmap;
+    pScreen->DestroyPixmap = xDestroyPixmap;
+
+    xf86DrvMsg(pScreen->myNum, X_INFO,
+               "using %d KiB of framebuffer memory for backing store pixmaps\n",
+               (int)(size / 1024));
+    return TRUE;
 }
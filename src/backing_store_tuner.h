@@ -33,11 +33,46 @@ typedef struct {
     unsigned int            PostValidateTreeCount;
     unsigned int            PostValidateTreeNestingLevel;
 
+    /* The memory limit for backing pixmaps (0 means unlimited) */
+    size_t                  BudgetBytes;
+    size_t                  UsedBytes;
+    size_t                  PeakBytes;
+    unsigned int            FocusClock;
+    unsigned long           Evictions;
+
+    /* Top-level windows, which may need their backing store changed */
+    WindowPtr               DirtyWindows;
+    /* Some window has gone, so the budget needs to be recalculated */
+    Bool                    BudgetDirty;
+    /* The top-level window, which had keyboard focus last time */
+    WindowPtr               FocusWin;
+
     PostValidateTreeProcPtr PostValidateTree;
     ReparentWindowProcPtr   ReparentWindow;
+    CreateWindowProcPtr     CreateWindow;
+    DestroyWindowProcPtr    DestroyWindow;
+
+    /* Backing pixmaps allocated from the spare framebuffer memory */
+    uint8_t                *PoolAddr;
+    size_t                  PoolSize;
+    struct BackingStorePoolBlock *PoolBlocks;
+    unsigned long           PoolPixmaps;
+    unsigned long           PoolFailures;
+
+    CreatePixmapProcPtr     CreatePixmap;
+    DestroyPixmapProcPtr    DestroyPixmap;
 } BackingStoreTuner;
 
-BackingStoreTuner *BackingStoreTuner_Init(ScreenPtr pScreen, Bool force);
+BackingStoreTuner *BackingStoreTuner_Init(ScreenPtr pScreen, Bool force,
+                                          int budget_mb);
 void BackingStoreTuner_Close(ScreenPtr pScreen);
 
+/*
+ * Use the memory at 'addr' (reserved in the offscreen part of framebuffer)
+ * for the backing pixmaps, so that the copies between them and the screen
+ * can be done by the 2D accelerator.
+ */
+Bool BackingStoreTuner_SetPixmapPool(ScreenPtr pScreen, void *addr,
+                                     size_t size);
+
 #endif
@@ -0,0 +1,197 @@
+/*
+ * Copyright © 2016 fbturbo developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "blt2d_chain.h"
+
+static uint32_t bpp_to_mask(int bpp)
+{
+    switch (bpp) {
+    case 16:
+        return BLT2D_BPP16;
+    case 24:
+        return BLT2D_BPP24;
+    case 32:
+        return BLT2D_BPP32;
+    default:
+        return 0;
+    }
+}
+
+static int in_range(uint32_t *bits, uint8_t *mem, size_t mem_size)
+{
+    return !mem || ((uint8_t *)bits >= mem && (uint8_t *)bits < mem + mem_size);
+}
+
+/* Whether the source and destination areas are overlapping */
+static int is_overlapped(uint32_t *src_bits, uint32_t *dst_bits,
+                         int src_x, int src_y, int dst_x, int dst_y,
+                         int w, int h)
+{
+    return src_bits == dst_bits &&
+           src_x < dst_x + w && dst_x < src_x + w &&
+           src_y < dst_y + h && dst_y < src_y + h;
+}
+
+static int backend_can_do(blt2d_backend_t *backend,
+                          uint32_t        *src_bits,
+                          uint32_t        *dst_bits,
+                          int              src_bpp,
+                          int              dst_bpp,
+                          int              overlapped,
+                          int              w,
+                          int              h)
+{
+    if (!(backend->bpp_mask & bpp_to_mask(src_bpp)) ||
+        !(backend->bpp_mask & bpp_to_mask(dst_bpp)))
+        return 0;
+    if (backend->needs_same_bpp && src_bpp != dst_bpp)
+        return 0;
+    if (overlapped && !backend->can_overlap)
+        return 0;
+    if (!in_range(src_bits, backend->src_mem, backend->src_mem_size) ||
+        !in_range(dst_bits, backend->dst_mem, backend->dst_mem_size))
+        return 0;
+    if (src_bpp == 16 && dst_bpp == 16 && backend->min_pixels_16bpp) {
+        if (w * h < backend->min_pixels_16bpp)
+            return 0;
+    }
+    else if (w * h < backend->min_pixels) {
+        return 0;
+    }
+    if ((backend->max_width && w > backend->max_width) ||
+        (backend->max_height && h > backend->max_height))
+        return 0;
+    return 1;
+}
+
+static int blt2d_chain_blt(void     *self,
+                           uint32_t *src_bits,
+                           uint32_t *dst_bits,
+                           int       src_stride,
+                           int       dst_stride,
+                           int       src_bpp,
+                           int       dst_bpp,
+                           int       src_x,
+                           int       src_y,
+                           int       dst_x,
+                           int       dst_y,
+                           int       w,
+                           int       h)
+{
+    blt2d_chain_t *chain = (blt2d_chain_t *)self;
+    int i, overlapped;
+
+    /* Zero size blit, nothing to do */
+    if (w <= 0 || h <= 0)
+        return 1;
+
+    overlapped = is_overlapped(src_bits, dst_bits, src_x, src_y,
+                               dst_x, dst_y, w, h);
+
+    for (i = 0; i < chain->num_backends; i++) {
+        blt2d_backend_t *backend = &chain->backends[i];
+        if (!backend_can_do(backend, src_bits, dst_bits, src_bpp, dst_bpp,
+                            overlapped, w, h))
+            continue;
+        backend->tried++;
+        if (backend->blt2d->overlapped_blt(backend->blt2d->self,
+                                           src_bits, dst_bits,
+                                           src_stride, dst_stride,
+                                           src_bpp, dst_bpp,
+                                           src_x, src_y, dst_x, dst_y,
+                                           w, h)) {
+            backend->done++;
+            return 1;
+        }
+    }
+
+    chain->unhandled++;
+    return 0;
+}
+
+blt2d_chain_t *blt2d_chain_init(void)
+{
+    blt2d_chain_t *chain = calloc(sizeof(blt2d_chain_t), 1);
+    if (!chain)
+        return NULL;
+
+    chain->blt2d.self = chain;
+    chain->blt2d.overlapped_blt = blt2d_chain_blt;
+    return chain;
+}
+
+void blt2d_chain_close(blt2d_chain_t *chain)
+{
+    free(chain);
+}
+
+int blt2d_chain_add(blt2d_chain_t *chain, const blt2d_backend_t *backend)
+{
+    if (chain->num_backends >= BLT2D_CHAIN_MAX_BACKENDS || !backend->blt2d)
+        return -1;
+    chain->backends[chain->num_backends++] = *backend;
+    return 0;
+}
+
+void blt2d_chain_set_order(blt2d_chain_t *chain, const char *order)
+{
+    blt2d_backend_t sorted[BLT2D_CHAIN_MAX_BACKENDS];
+    int used[BLT2D_CHAIN_MAX_BACKENDS] = { 0 };
+    int i, n = 0;
+
+    if (!order)
+        return;
+
+    while (*order) {
+        size_t len = strcspn(order, ", ");
+        for (i = 0; i < chain->num_backends; i++) {
+            if (!used[i] && strlen(chain->backends[i].name) == len &&
+                strncasecmp(chain->backends[i].name, order, len) == 0) {
+                sorted[n++] = chain->backends[i];
+                used[i] = 1;
+            }
+        }
+        order += len;
+        order += strspn(order, ", ");
+    }
+    for (i = 0; i < chain->num_backends; i++) {
+        if (!used[i])
+            sorted[n++] = chain->backends[i];
+    }
+    memcpy(chain->backends, sorted, n * sizeof(blt2d_backend_t));
+}
+
+blt2d_backend_t *blt2d_chain_get(blt2d_chain_t *chain, int index)
+{
+    if (index < 0 || index >= chain->num_backends)
+        return NULL;
+    return &chain->backends[index];
+}
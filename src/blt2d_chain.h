@@ -0,0 +1,98 @@
+/*
+ * Copyright © 2016 fbturbo developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef BLT2D_CHAIN_H
+#define BLT2D_CHAIN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "interfaces.h"
+
+/*
+ * An ordered list of blt2d_i implementations (G2D, fbdev copyarea, RGA,
+ * CPU). Every blit goes to the first backend, which declares that it can
+ * handle it and then actually does it. Only if all of them fail, the
+ * caller falls back to pixman/fbBlt. The chain itself implements blt2d_i,
+ * so it can be passed to SunxiG2D_Init just like a single backend.
+ */
+
+#define BLT2D_CHAIN_MAX_BACKENDS 4
+
+/* Bits for 'bpp_mask' */
+#define BLT2D_BPP16 (1 << 0)
+#define BLT2D_BPP24 (1 << 1)
+#define BLT2D_BPP32 (1 << 2)
+
+typedef struct {
+    const char *name;
+    blt2d_i    *blt2d;
+
+    /* Capabilities, the blits which don't match are not even tried */
+    uint32_t    bpp_mask;
+    int         needs_same_bpp;
+    int         can_overlap;    /* the same buffer with overlapping areas */
+    /* The buffers need to start inside these ranges (NULL for any memory) */
+    uint8_t    *src_mem;
+    size_t      src_mem_size;
+    uint8_t    *dst_mem;
+    size_t      dst_mem_size;
+    /* Not worth it for smaller blits, 0 if no limit */
+    int         min_pixels;
+    int         min_pixels_16bpp; /* for 16bpp -> 16bpp, 0 to use min_pixels */
+    int         max_width;
+    int         max_height;
+
+    /* Statistics */
+    unsigned long tried;
+    unsigned long done;
+} blt2d_backend_t;
+
+typedef struct {
+    /* The routing implementation of blt2d_i interface */
+    blt2d_i         blt2d;
+
+    int             num_backends;
+    blt2d_backend_t backends[BLT2D_CHAIN_MAX_BACKENDS];
+
+    /* The blits, which no backend could handle */
+    unsigned long   unhandled;
+} blt2d_chain_t;
+
+blt2d_chain_t *blt2d_chain_init(void);
+void blt2d_chain_close(blt2d_chain_t *chain);
+
+/* Append a backend to the end of the chain. Returns 0 on success */
+int blt2d_chain_add(blt2d_chain_t *chain, const blt2d_backend_t *backend);
+
+/*
+ * Reorder the backends according to a comma separated list of their names
+ * (for example "cpu,g2d"). The backends not mentioned there keep their
+ * relative order and go after the listed ones.
+ */
+void blt2d_chain_set_order(blt2d_chain_t *chain, const char *order);
+
+/* The backend at the given position in the chain, NULL if none */
+blt2d_backend_t *blt2d_chain_get(blt2d_chain_t *chain, int index);
+
+#endif
@@ -0,0 +1,173 @@
+/*
+ * Copyright © 2016 fbturbo developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "blt_trace.h"
+
+static uint64_t get_time_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+blt_trace_t *blt_trace_open(const char *filename, int width, int height,
+                            int bpp)
+{
+    blt_trace_header_t header;
+    blt_trace_t *trace = calloc(1, sizeof(blt_trace_t));
+    if (!trace)
+        return NULL;
+
+    trace->file = fopen(filename, "wb");
+    if (!trace->file) {
+        free(trace);
+        return NULL;
+    }
+    /* the records are small, avoid a syscall for each of them */
+    setvbuf(trace->file, NULL, _IOFBF, 256 * 1024);
+
+    memset(&header, 0, sizeof(header));
+    header.magic   = BLT_TRACE_MAGIC;
+    header.version = BLT_TRACE_VERSION;
+    header.bpp     = bpp;
+    header.width   = width;
+    header.height  = height;
+    if (fwrite(&header, sizeof(header), 1, trace->file) != 1) {
+        fclose(trace->file);
+        free(trace);
+        return NULL;
+    }
+
+    trace->last_us = get_time_us();
+    return trace;
+}
+
+void blt_trace_close(blt_trace_t *trace)
+{
+    if (!trace)
+        return;
+    fclose(trace->file);
+    free(trace->boxes);
+    free(trace);
+}
+
+void blt_trace_begin(blt_trace_t *trace, int op, int src_kind, int dst_kind,
+                     int src_bpp, int dst_bpp, int dx, int dy,
+                     int src_width, int src_height)
+{
+    blt_trace_record_t *record = &trace->record;
+
+    record->op         = op;
+    record->src_kind   = src_kind;
+    record->dst_kind   = dst_kind;
+    record->src_bpp    = src_bpp;
+    record->dst_bpp    = dst_bpp;
+    record->reserved   = 0;
+    record->nbox       = 0;
+    record->dx         = dx;
+    record->dy         = dy;
+    record->src_width  = src_width;
+    record->src_height = src_height;
+}
+
+void blt_trace_add_box(blt_trace_t *trace, int x1, int y1, int x2, int y2)
+{
+    blt_trace_record_t *record = &trace->record;
+    blt_trace_box_t *box;
+
+    /* split very long box lists into several records */
+    if (record->nbox == UINT16_MAX) {
+        blt_trace_end(trace);
+        record->nbox = 0;
+    }
+
+    if (record->nbox == trace->max_boxes) {
+        int max_boxes = trace->max_boxes ? trace->max_boxes * 2 : 64;
+        blt_trace_box_t *boxes = realloc(trace->boxes,
+                                         max_boxes * sizeof(blt_trace_box_t));
+        if (!boxes)
+            return;
+        trace->boxes = boxes;
+        trace->max_boxes = max_boxes;
+    }
+
+    box = &trace->boxes[record->nbox++];
+    box->x1 = x1;
+    box->y1 = y1;
+    box->x2 = x2;
+    box->y2 = y2;
+}
+
+void blt_trace_end(blt_trace_t *trace)
+{
+    blt_trace_record_t *record = &trace->record;
+    uint64_t now;
+
+    if (record->nbox == 0)
+        return;
+
+    now = get_time_us();
+    record->delta_us = now - trace->last_us > UINT32_MAX ?
+                       UINT32_MAX : now - trace->last_us;
+    trace->last_us = now;
+
+    fwrite(record, sizeof(*record), 1, trace->file);
+    fwrite(trace->boxes, sizeof(blt_trace_box_t), record->nbox, trace->file);
+    trace->records++;
+}
+
+/*****************************************************************************/
+
+int blt_trace_read_header(FILE *file, blt_trace_header_t *header)
+{
+    if (fread(header, sizeof(*header), 1, file) != 1 ||
+        header->magic != BLT_TRACE_MAGIC ||
+        header->version != BLT_TRACE_VERSION)
+        return -1;
+    return 0;
+}
+
+int blt_trace_read_record(FILE *file, blt_trace_record_t *record,
+                          blt_trace_box_t **boxes, int *max_boxes)
+{
+    if (fread(record, sizeof(*record), 1, file) != 1)
+        return feof(file) ? 0 : -1;
+
+    if (record->nbox > *max_boxes) {
+        blt_trace_box_t *tmp = realloc(*boxes,
+                                       record->nbox * sizeof(blt_trace_box_t));
+        if (!tmp)
+            return -1;
+        *boxes = tmp;
+        *max_boxes = record->nbox;
+    }
+
+    if (fread(*boxes, sizeof(blt_trace_box_t), record->nbox, file) !=
+                                                                record->nbox)
+        return -1;
+    return 1;
+}
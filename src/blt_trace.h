@@ -0,0 +1,121 @@
+/*
+ * Copyright © 2016 fbturbo developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef BLT_TRACE_H
+#define BLT_TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * A compact binary trace of the blits done by the X server (CopyArea,
+ * CopyWindow and PutImage), which can be replayed later against any blt2d_i
+ * backend by test/blt_trace_replay. The file starts with blt_trace_header_t,
+ * followed by blt_trace_record_t entries, each of them directly followed
+ * by its 'nbox' boxes. Everything is stored in the host byte order.
+ */
+
+#define BLT_TRACE_MAGIC   0x54544246 /* "FBTT" */
+#define BLT_TRACE_VERSION 1
+
+/* Operations */
+#define BLT_TRACE_COPY_AREA   1
+#define BLT_TRACE_COPY_WINDOW 2
+#define BLT_TRACE_PUT_IMAGE   3
+#define BLT_TRACE_COMPOSITE   4 /* PictOpSrc without any conversion */
+
+/* Drawable kinds */
+#define BLT_TRACE_WINDOW 1
+#define BLT_TRACE_PIXMAP 2
+#define BLT_TRACE_IMAGE  3 /* client supplied memory (PutImage) */
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t bpp;               /* of the screen */
+    uint16_t width;             /* of the screen */
+    uint16_t height;
+} blt_trace_header_t;
+
+typedef struct {
+    uint8_t  op;
+    uint8_t  src_kind;
+    uint8_t  dst_kind;
+    uint8_t  src_bpp;
+    uint8_t  dst_bpp;
+    uint8_t  reserved;
+    uint16_t nbox;
+    /* source position = destination box position + (dx, dy) */
+    int16_t  dx;
+    int16_t  dy;
+    /* the size of the source drawable, or of the image for PutImage */
+    uint16_t src_width;
+    uint16_t src_height;
+    /* microseconds since the previous record */
+    uint32_t delta_us;
+} blt_trace_record_t;
+
+/* Destination boxes in the coordinates of the underlying pixmap */
+typedef struct {
+    int16_t x1, y1, x2, y2;
+} blt_trace_box_t;
+
+typedef struct {
+    FILE               *file;
+    uint64_t            last_us;
+    blt_trace_record_t  record;  /* the one being collected */
+    blt_trace_box_t    *boxes;
+    int                 max_boxes;
+    unsigned long       records;
+} blt_trace_t;
+
+blt_trace_t *blt_trace_open(const char *filename, int width, int height,
+                            int bpp);
+void blt_trace_close(blt_trace_t *trace);
+
+/*
+ * Recording is done in three steps: blt_trace_begin starts a new record
+ * (the 'nbox' and 'delta_us' fields are filled automatically), then each
+ * of its boxes is added and blt_trace_end writes everything to the file.
+ */
+void blt_trace_begin(blt_trace_t *trace, int op, int src_kind, int dst_kind,
+                     int src_bpp, int dst_bpp, int dx, int dy,
+                     int src_width, int src_height);
+void blt_trace_add_box(blt_trace_t *trace, int x1, int y1, int x2, int y2);
+void blt_trace_end(blt_trace_t *trace);
+
+/*
+ * Read the header at the start of the trace. Returns 0 on success and -1
+ * if the file is not a blit trace.
+ */
+int blt_trace_read_header(FILE *file, blt_trace_header_t *header);
+
+/*
+ * Read the next record. The boxes are returned in a buffer, which is
+ * (re)allocated as needed and has to be freed by the caller. Returns 1
+ * on success, 0 at the end of the trace and -1 on error.
+ */
+int blt_trace_read_record(FILE *file, blt_trace_record_t *record,
+                          blt_trace_box_t **boxes, int *max_boxes);
+
+#endif
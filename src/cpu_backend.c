@@ -130,6 +130,36 @@ twopass_memmove_arm(void *dst, const void *src, size_t size)
                     writeback_scratch_to_mem_arm);
 }
 
+/*
+ * Copying from normal cached memory to uncached or write-combined memory
+ * (such as UMP buffers) only needs to care about doing wide writes.
+ */
+static void
+memcpy_to_uncached_neon(void *dst, const void *src, size_t size)
+{
+    while (size >= SCRATCHSIZE) {
+        writeback_scratch_to_mem_neon(SCRATCHSIZE, dst, src);
+        dst = (uint8_t *)dst + SCRATCHSIZE;
+        src = (const uint8_t *)src + SCRATCHSIZE;
+        size -= SCRATCHSIZE;
+    }
+    if (size > 0)
+        writeback_scratch_to_mem_neon(size, dst, src);
+}
+
+static void
+memcpy_to_uncached_arm(void *dst, const void *src, size_t size)
+{
+    while (size >= SCRATCHSIZE) {
+        memcpy_armv5te(dst, src, SCRATCHSIZE);
+        dst = (uint8_t *)dst + SCRATCHSIZE;
+        src = (const uint8_t *)src + SCRATCHSIZE;
+        size -= SCRATCHSIZE;
+    }
+    if (size > 0)
+        memcpy_armv5te(dst, src, size);
+}
+
 static void
 twopass_blt_8bpp(int        width,
                  int        height,
@@ -270,6 +300,12 @@ overlapped_blt_arm(void     *self,
 
 #endif
 
+static void
+memcpy_to_uncached_generic(void *dst, const void *src, size_t size)
+{
+    memcpy(dst, src, size);
+}
+
 /* An empty, always failing implementation */
 static int
 overlapped_blt_noop(void     *self,
@@ -301,6 +337,8 @@ cpu_backend_t *cpu_backend_init(uint8_t *uncached_buffer,
 
     ctx->blt2d.self = ctx;
     ctx->blt2d.overlapped_blt = overlapped_blt_noop;
+    ctx->blt2d_variant = "noop";
+    ctx->memcpy_to_uncached = memcpy_to_uncached_generic;
 
     ctx->cpuinfo = cpuinfo_init();
 
@@ -310,21 +348,49 @@ cpu_backend_t *cpu_backend_init(uint8_t *uncached_buffer,
         ctx->cpuinfo->arm_part == 0xC08)
     {
         /* NEON works better on Cortex-A8 */
-        ctx->blt2d.overlapped_blt = overlapped_blt_neon;
+        cpu_backend_select_variant(ctx, "neon");
     }
     else if (ctx->cpuinfo->has_arm_wmmx) {
         /* ARM LDM/STM works better than VFP/WMMX on Marvell PJ4 */
-        ctx->blt2d.overlapped_blt = overlapped_blt_arm;
+        cpu_backend_select_variant(ctx, "arm");
     }
     else if (ctx->cpuinfo->has_arm_vfp && ctx->cpuinfo->has_arm_edsp) {
         /* VFP works better on Cortex-A9, Cortex-A15 and maybe everything else */
-        ctx->blt2d.overlapped_blt = overlapped_blt_vfp;
+        cpu_backend_select_variant(ctx, "vfp");
     }
+
+    /* Writes to uncached memory benefit from wide stores everywhere */
+    if (ctx->cpuinfo->has_arm_neon)
+        ctx->memcpy_to_uncached = memcpy_to_uncached_neon;
+    else if (ctx->cpuinfo->has_arm_edsp)
+        ctx->memcpy_to_uncached = memcpy_to_uncached_arm;
 #endif
 
     return ctx;
 }
 
+int cpu_backend_select_variant(cpu_backend_t *ctx, const char *name)
+{
+#ifdef __arm__
+    if (strcmp(name, "neon") == 0 && ctx->cpuinfo->has_arm_neon) {
+        ctx->blt2d.overlapped_blt = overlapped_blt_neon;
+        ctx->blt2d_variant = "neon";
+        return 0;
+    }
+    if (strcmp(name, "vfp") == 0 && ctx->cpuinfo->has_arm_vfp) {
+        ctx->blt2d.overlapped_blt = overlapped_blt_vfp;
+        ctx->blt2d_variant = "vfp";
+        return 0;
+    }
+    if (strcmp(name, "arm") == 0 && ctx->cpuinfo->has_arm_edsp) {
+        ctx->blt2d.overlapped_blt = overlapped_blt_arm;
+        ctx->blt2d_variant = "arm";
+        return 0;
+    }
+#endif
+    return -1;
+}
+
 void cpu_backend_close(cpu_backend_t *ctx)
 {
     if (ctx->cpuinfo)
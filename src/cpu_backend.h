@@ -42,9 +42,20 @@ typedef struct {
     uint8_t   *uncached_area_end;
     /* An accelerated implementation of blt2d_i interface */
     blt2d_i    blt2d;
+    /* The name of the implementation used by blt2d ("neon", "vfp", ...) */
+    const char *blt2d_variant;
+    /* memcpy from normal memory to uncached memory (such as UMP buffers) */
+    void     (*memcpy_to_uncached)(void *dst, const void *src, size_t size);
 } cpu_backend_t;
 
 cpu_backend_t *cpu_backend_init(uint8_t *uncached_buffer, size_t uncached_buffer_size);
 void cpu_backend_close(cpu_backend_t *cpu_backend);
 
+/*
+ * Override the automatically selected blt2d implementation ("neon", "vfp"
+ * or "arm"), mainly for benchmarking. Returns 0 on success and -1 if it is
+ * not supported by the CPU.
+ */
+int cpu_backend_select_variant(cpu_backend_t *cpu_backend, const char *name);
+
 #endif
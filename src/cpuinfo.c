@@ -21,9 +21,18 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
+
+#ifdef HAVE_GETAUXVAL
+#include <sys/auxv.h>
+#endif
 
 #include "cpuinfo.h"
 
@@ -31,6 +40,142 @@
 
 #define MAXBUFSIZE 16384
 
+#ifndef AT_HWCAP
+#define AT_HWCAP  16
+#endif
+#ifndef AT_HWCAP2
+#define AT_HWCAP2 26
+#endif
+
+/* The bits from arch/arm and arch/arm64 asm/hwcap.h */
+#define CPUINFO_ARM_HWCAP_VFP      (1 << 6)
+#define CPUINFO_ARM_HWCAP_EDSP     (1 << 7)
+#define CPUINFO_ARM_HWCAP_IWMMXT   (1 << 9)
+#define CPUINFO_ARM_HWCAP_NEON     (1 << 12)
+#define CPUINFO_ARM64_HWCAP_FP     (1 << 0)
+#define CPUINFO_ARM64_HWCAP_ASIMD  (1 << 1)
+
+static unsigned long get_auxval(unsigned long type)
+{
+#ifdef HAVE_GETAUXVAL
+    return getauxval(type);
+#else
+    unsigned long entry[2], result = 0;
+    FILE *fd = fopen("/proc/self/auxv", "r");
+    if (!fd)
+        return 0;
+    while (fread(entry, sizeof(entry), 1, fd) == 1 && entry[0] != 0) {
+        if (entry[0] == type) {
+            result = entry[1];
+            break;
+        }
+    }
+    fclose(fd);
+    return result;
+#endif
+}
+
+/* Get the CPU features from the ELF auxiliary vector */
+static int read_hwcap(cpuinfo_t *cpuinfo)
+{
+    cpuinfo->hwcap  = get_auxval(AT_HWCAP);
+    cpuinfo->hwcap2 = get_auxval(AT_HWCAP2);
+#if defined(__arm__)
+    if (!cpuinfo->hwcap)
+        return 0;
+    cpuinfo->has_arm_edsp = !!(cpuinfo->hwcap & CPUINFO_ARM_HWCAP_EDSP);
+    cpuinfo->has_arm_vfp  = !!(cpuinfo->hwcap & CPUINFO_ARM_HWCAP_VFP);
+    cpuinfo->has_arm_neon = !!(cpuinfo->hwcap & CPUINFO_ARM_HWCAP_NEON);
+    cpuinfo->has_arm_wmmx = !!(cpuinfo->hwcap & CPUINFO_ARM_HWCAP_IWMMXT);
+    return 1;
+#elif defined(__aarch64__)
+    if (!cpuinfo->hwcap)
+        return 0;
+    cpuinfo->has_arm_edsp = 1;
+    cpuinfo->has_arm_vfp  = !!(cpuinfo->hwcap & CPUINFO_ARM64_HWCAP_FP);
+    cpuinfo->has_arm_neon = !!(cpuinfo->hwcap & CPUINFO_ARM64_HWCAP_ASIMD);
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+static int read_int_from_file(const char *path, const char *format, void *value)
+{
+    FILE *fd = fopen(path, "r");
+    int result;
+    if (!fd)
+        return 0;
+    result = fscanf(fd, format, value) == 1;
+    fclose(fd);
+    return result;
+}
+
+/*
+ * Get the per-core information from sysfs. MIDR is only exported there
+ * by arm64 kernels, otherwise it comes from /proc/cpuinfo.
+ */
+static void read_sysfs_topology(cpuinfo_t *cpuinfo)
+{
+    char path[128];
+    int i;
+
+    for (i = 0; i < cpuinfo->num_cores; i++) {
+        cpuinfo_core_t *core = &cpuinfo->cores[i];
+        unsigned long long midr;
+
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu%d/regs/identification/midr_el1", i);
+        if (read_int_from_file(path, "%llx", &midr)) {
+            core->arm_implementer = (midr >> 24) & 0xFF;
+            core->arm_variant     = (midr >> 20) & 0xF;
+            core->arm_part        = (midr >> 4) & 0xFFF;
+            core->arm_revision    = midr & 0xF;
+        }
+
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu%d/topology/cluster_id", i);
+        if (!read_int_from_file(path, "%d", &core->cluster)) {
+            snprintf(path, sizeof(path),
+                     "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", i);
+            if (!read_int_from_file(path, "%d", &core->cluster))
+                core->cluster = -1;
+        }
+
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu%d/cpufreq/cpuinfo_max_freq", i);
+        if (!read_int_from_file(path, "%d", &core->max_freq_khz))
+            core->max_freq_khz = 0;
+    }
+}
+
+/* Get the L1 data cache and L2 cache line sizes of the given core */
+static void read_sysfs_cache_info(cpuinfo_t *cpuinfo, int cpu)
+{
+    char path[128], type[16];
+    int index, level, line_size;
+
+    for (index = 0; index < 8; index++) {
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, index);
+        if (!read_int_from_file(path, "%d", &level))
+            break;
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu%d/cache/index%d/type", cpu, index);
+        if (!read_int_from_file(path, "%15s", type))
+            continue;
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu%d/cache/index%d/coherency_line_size",
+                 cpu, index);
+        if (!read_int_from_file(path, "%d", &line_size))
+            continue;
+        if (level == 1 && strcmp(type, "Data") == 0)
+            cpuinfo->l1d_line_size = line_size;
+        else if (level == 2)
+            cpuinfo->l2_line_size = line_size;
+    }
+}
+
 static const char *cpuinfo_match_prefix(const char *s, const char *prefix)
 {
     const char *result;
@@ -70,11 +215,18 @@ static int find_feature(const char *buffer, const char *feature)
     return 0;
 }
 
-static int parse_proc_cpuinfo(cpuinfo_t *cpuinfo)
+/*
+ * Parse /proc/cpuinfo. Newer kernels list MIDR fields for each processor,
+ * older ones only once for all of them. The features are only taken from
+ * here if they are not available via HWCAP.
+ */
+static int parse_proc_cpuinfo(cpuinfo_t *cpuinfo, int parse_features)
 {
     char *buffer = (char *)malloc(MAXBUFSIZE);
     FILE *fd;
     const char *val;
+    cpuinfo_core_t *core = NULL;
+    int i, n;
 
     if (!buffer)
         return 0;
@@ -91,7 +243,15 @@ static int parse_proc_cpuinfo(cpuinfo_t *cpuinfo)
             free(buffer);
             return 0;
         }
-        if ((val = cpuinfo_match_prefix(buffer, "Features"))) {
+        if ((val = cpuinfo_match_prefix(buffer, "processor"))) {
+            if (sscanf(val, "%d", &n) == 1 && n >= 0 && n < cpuinfo->num_cores)
+                core = &cpuinfo->cores[n];
+            else
+                core = NULL;
+        }
+        else if ((val = cpuinfo_match_prefix(buffer, "Features"))) {
+            if (!parse_features)
+                continue;
             cpuinfo->has_arm_edsp = find_feature(val, "edsp");
             cpuinfo->has_arm_vfp  = find_feature(val, "vfp");
             cpuinfo->has_arm_neon = find_feature(val, "neon");
@@ -103,6 +263,8 @@ static int parse_proc_cpuinfo(cpuinfo_t *cpuinfo)
                 free(buffer);
                 return 0;
             }
+            if (core)
+                core->arm_implementer = cpuinfo->arm_implementer;
         }
         else if ((val = cpuinfo_match_prefix(buffer, "CPU architecture"))) {
             if (sscanf(val, "%i", &cpuinfo->arm_architecture) != 1) {
@@ -117,6 +279,8 @@ static int parse_proc_cpuinfo(cpuinfo_t *cpuinfo)
                 free(buffer);
                 return 0;
             }
+            if (core)
+                core->arm_variant = cpuinfo->arm_variant;
         }
         else if ((val = cpuinfo_match_prefix(buffer, "CPU part"))) {
             if (sscanf(val, "%i", &cpuinfo->arm_part) != 1) {
@@ -124,6 +288,8 @@ static int parse_proc_cpuinfo(cpuinfo_t *cpuinfo)
                 free(buffer);
                 return 0;
             }
+            if (core)
+                core->arm_part = cpuinfo->arm_part;
         }
         else if ((val = cpuinfo_match_prefix(buffer, "CPU revision"))) {
             if (sscanf(val, "%x", &cpuinfo->arm_revision) != 1) {
@@ -131,34 +297,109 @@ static int parse_proc_cpuinfo(cpuinfo_t *cpuinfo)
                 free(buffer);
                 return 0;
             }
+            if (core)
+                core->arm_revision = cpuinfo->arm_revision;
         }
     }
     fclose(fd);
     free(buffer);
+
+    /* The MIDR fields were only listed once, so they apply to all cores */
+    for (i = 0; i < cpuinfo->num_cores; i++) {
+        if (!cpuinfo->cores[i].arm_part) {
+            cpuinfo->cores[i].arm_implementer = cpuinfo->arm_implementer;
+            cpuinfo->cores[i].arm_variant     = cpuinfo->arm_variant;
+            cpuinfo->cores[i].arm_part        = cpuinfo->arm_part;
+            cpuinfo->cores[i].arm_revision    = cpuinfo->arm_revision;
+        }
+    }
     return 1;
 }
 
 #else
 
-static int parse_proc_cpuinfo(cpuinfo_t *cpuinfo)
+static int read_hwcap(cpuinfo_t *cpuinfo)
+{
+    return 0;
+}
+
+static void read_sysfs_topology(cpuinfo_t *cpuinfo)
+{
+}
+
+static void read_sysfs_cache_info(cpuinfo_t *cpuinfo, int cpu)
+{
+}
+
+static int parse_proc_cpuinfo(cpuinfo_t *cpuinfo, int parse_features)
 {
     return 0;
 }
 
 #endif
 
+/*
+ * Pick the fastest core (the big one on big.LITTLE systems) as the one
+ * describing the whole CPU, and check if all the cores are the same.
+ */
+static int select_main_core(cpuinfo_t *cpuinfo)
+{
+    int i, main_core = 0;
+
+    for (i = 1; i < cpuinfo->num_cores; i++) {
+        cpuinfo_core_t *core = &cpuinfo->cores[i];
+        if (core->max_freq_khz > cpuinfo->cores[main_core].max_freq_khz)
+            main_core = i;
+        if (core->arm_part != cpuinfo->cores[0].arm_part ||
+            core->arm_implementer != cpuinfo->cores[0].arm_implementer ||
+            core->max_freq_khz != cpuinfo->cores[0].max_freq_khz)
+            cpuinfo->is_heterogeneous = 1;
+    }
+
+    if (cpuinfo->num_cores > 0 && cpuinfo->cores[main_core].arm_part) {
+        cpuinfo->arm_implementer = cpuinfo->cores[main_core].arm_implementer;
+        cpuinfo->arm_variant     = cpuinfo->cores[main_core].arm_variant;
+        cpuinfo->arm_part        = cpuinfo->cores[main_core].arm_part;
+        cpuinfo->arm_revision    = cpuinfo->cores[main_core].arm_revision;
+    }
+    return main_core;
+}
+
 cpuinfo_t *cpuinfo_init()
 {
     cpuinfo_t *cpuinfo = calloc(sizeof(cpuinfo_t), 1);
+    int i, have_hwcap, have_proc_cpuinfo, main_core;
+    long num_cores;
     if (!cpuinfo)
         return NULL;
 
-    if (!parse_proc_cpuinfo(cpuinfo)) {
+    num_cores = sysconf(_SC_NPROCESSORS_CONF);
+    if (num_cores < 1)
+        num_cores = 1;
+    cpuinfo->cores = calloc(sizeof(cpuinfo_core_t), num_cores);
+    if (cpuinfo->cores)
+        cpuinfo->num_cores = num_cores;
+    for (i = 0; i < cpuinfo->num_cores; i++)
+        cpuinfo->cores[i].cluster = -1;
+
+    have_hwcap = read_hwcap(cpuinfo);
+    read_sysfs_topology(cpuinfo);
+    have_proc_cpuinfo = parse_proc_cpuinfo(cpuinfo, !have_hwcap);
+    main_core = select_main_core(cpuinfo);
+    read_sysfs_cache_info(cpuinfo, main_core);
+
+    if (!have_proc_cpuinfo && !cpuinfo->arm_part) {
         cpuinfo->processor_name = strdup("Unknown");
         return cpuinfo;
     }
 
-    if (cpuinfo->arm_implementer == 0x41 && cpuinfo->arm_part == 0xC0F) {
+    if (cpuinfo->arm_implementer == 0x41 && cpuinfo->arm_part == 0xD08) {
+        cpuinfo->processor_name = strdup("ARM Cortex-A72");
+    } else if (cpuinfo->arm_implementer == 0x41 && cpuinfo->arm_part == 0xD03) {
+        cpuinfo->processor_name = strdup("ARM Cortex-A53");
+    } else if (cpuinfo->arm_implementer == 0x41 && cpuinfo->arm_part == 0xC0E) {
+        cpuinfo->processor_name = strdup("ARM Cortex-A17");
+    } else if (cpuinfo->arm_implementer == 0x41 && cpuinfo->arm_part == 0xC0F) {
         cpuinfo->processor_name = strdup("ARM Cortex-A15");
     } else if (cpuinfo->arm_implementer == 0x41 && cpuinfo->arm_part == 0xC09) {
         if (cpuinfo->has_arm_neon)
@@ -187,6 +428,7 @@ cpuinfo_t *cpuinfo_init()
 
 void cpuinfo_close(cpuinfo_t *cpuinfo)
 {
+    free(cpuinfo->cores);
     free(cpuinfo->processor_name);
     free(cpuinfo);
 }
@@ -24,9 +24,25 @@
 #ifndef CPUINFO_H
 #define CPUINFO_H
 
+/* The information about a single CPU core */
+typedef struct {
+    /* The values originating from MIDR register (0 if unknown) */
+    int arm_implementer;
+    int arm_variant;
+    int arm_part;
+    int arm_revision;
+    /* The cluster (physical package) id, -1 if unknown */
+    int cluster;
+    /* The maximum frequency in kHz, 0 if unknown */
+    int max_freq_khz;
+} cpuinfo_core_t;
+
 /* The information about CPU features */
 typedef struct {
-    /* The values originating from MIDR register */
+    /*
+     * The values originating from MIDR register. On big.LITTLE systems
+     * these describe the fastest core.
+     */
     int arm_implementer;
     int arm_architecture;
     int arm_variant;
@@ -37,6 +53,16 @@ typedef struct {
     int has_arm_vfp;
     int has_arm_neon;
     int has_arm_wmmx;
+    /* The raw AT_HWCAP/AT_HWCAP2 bits from the ELF auxiliary vector */
+    unsigned long hwcap;
+    unsigned long hwcap2;
+    /* Per-core information, and whether the cores are different */
+    int num_cores;
+    cpuinfo_core_t *cores;
+    int is_heterogeneous;
+    /* Cache line sizes in bytes (0 if unknown) */
+    int l1d_line_size;
+    int l2_line_size;
     /* The user-friendly CPU description string (usable for logs, etc.) */
     char *processor_name;
 } cpuinfo_t;
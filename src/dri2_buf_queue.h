@@ -0,0 +1,95 @@
+/*
+ * Copyright © 2016 fbturbo developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DRI2_BUF_QUEUE_H
+#define DRI2_BUF_QUEUE_H
+
+/*
+ * The queue for the incoming DRI2 back buffers of a window. DRI2 buffer
+ * requests and buffer swaps sometimes may come out of order, so the
+ * buffers wait here for their swaps. It's a ring with free running head
+ * and tail counters. Every buffer carries the number of the buffer request
+ * which created it, so that the swaps can tell if some requests have been
+ * lost on the way (for example when the queue was full).
+ */
+
+#define DRI2_BUF_QUEUE_SIZE 16
+
+typedef struct {
+    void         *buf[DRI2_BUF_QUEUE_SIZE];
+    unsigned int  seq[DRI2_BUF_QUEUE_SIZE];
+    unsigned int  head;
+    unsigned int  tail;
+    /* the request number expected from the next fetched buffer (0 if any) */
+    unsigned int  next_seq;
+} dri2_buf_queue_t;
+
+/* Returns 0 on success and -1 if the queue is full (the buffer is dropped) */
+static inline int dri2_buf_queue_add(dri2_buf_queue_t *q, void *buf,
+                                     unsigned int seq)
+{
+    if (q->head - q->tail >= DRI2_BUF_QUEUE_SIZE)
+        return -1;
+
+    q->buf[q->head % DRI2_BUF_QUEUE_SIZE] = buf;
+    q->seq[q->head % DRI2_BUF_QUEUE_SIZE] = seq;
+    q->head++;
+    return 0;
+}
+
+/*
+ * Take the oldest buffer or return NULL if the queue is empty. '*seq' is
+ * set to the number of its request. '*in_order' is 0 if this is not the
+ * request following the previously fetched buffer.
+ */
+static inline void *dri2_buf_queue_fetch(dri2_buf_queue_t *q,
+                                         unsigned int *seq, int *in_order)
+{
+    unsigned int i;
+    void *buf;
+
+    if (q->tail == q->head)
+        return NULL;
+
+    i = q->tail % DRI2_BUF_QUEUE_SIZE;
+    buf = q->buf[i];
+    *seq = q->seq[i];
+    *in_order = (q->next_seq == 0 || q->next_seq == *seq);
+    q->buf[i] = NULL;
+    q->tail++;
+    q->next_seq = *seq + 1;
+    return buf;
+}
+
+/*
+ * The window got a buffer, which does not go through the queue, so the
+ * sequence starts again with whatever gets queued next. Only done when
+ * the queue is empty, the queued buffers are still expected in order.
+ */
+static inline void dri2_buf_queue_restart_seq(dri2_buf_queue_t *q)
+{
+    if (q->tail == q->head)
+        q->next_seq = 0;
+}
+
+#endif
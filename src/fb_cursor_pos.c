@@ -0,0 +1,160 @@
+/*
+ * Copyright © 2016 fbturbo developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "xf86.h"
+
+#include "fb_cursor_pos.h"
+
+/* Keeps the SIGIO handler or the input thread away from the shared state */
+#if GET_ABI_MAJOR(ABI_VIDEODRV_VERSION) >= 23
+#define cursor_input_lock()     input_lock()
+#define cursor_input_unlock()   input_unlock()
+#else
+#define cursor_input_lock()     OsBlockSIGIO()
+#define cursor_input_unlock()   OsReleaseSIGIO()
+#endif
+
+static uint64_t get_time_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Safe to call from the SIGIO handler, so no logging here */
+static void apply_position(fb_cursor_pos_t *ctx)
+{
+    ctx->pending = 0;
+    ctx->last_ust = get_time_us();
+    ctx->ioctls++;
+    if (ctx->proc(ctx->data, ctx->x, ctx->y) < 0)
+        ctx->errors++;
+}
+
+static void flush_handler(void *data, uint64_t msc, uint64_t ust)
+{
+    fb_cursor_pos_t *ctx = (fb_cursor_pos_t *)data;
+
+    cursor_input_lock();
+    ctx->flush_queued = 0;
+    if (ctx->pending)
+        apply_position(ctx);
+    cursor_input_unlock();
+}
+
+/* Queues the flush of the moves deferred by fb_cursor_pos_set */
+#if GET_ABI_MAJOR(ABI_VIDEODRV_VERSION) >= 23
+static void block_handler(void *data, void *timeout)
+#else
+static void block_handler(void *data, OSTimePtr timeout, void *read_mask)
+#endif
+{
+    fb_cursor_pos_t *ctx = (fb_cursor_pos_t *)data;
+    uint64_t msc, ust;
+
+    cursor_input_lock();
+    if (ctx->pending && !ctx->flush_queued) {
+        fb_vblank_get_msc(ctx->vblank, &msc, &ust);
+        fb_vblank_queue_static_event(ctx->vblank, &ctx->flush_event,
+                                     msc + 1, flush_handler, ctx);
+        ctx->flush_queued = 1;
+    }
+    cursor_input_unlock();
+}
+
+#if GET_ABI_MAJOR(ABI_VIDEODRV_VERSION) >= 23
+static void wakeup_handler(void *data, int result)
+#else
+static void wakeup_handler(void *data, int result, void *read_mask)
+#endif
+{
+}
+
+fb_cursor_pos_t *fb_cursor_pos_init(fb_vblank_t        *vblank,
+                                    fb_cursor_pos_proc  proc,
+                                    void               *data)
+{
+    fb_cursor_pos_t *ctx = calloc(sizeof(fb_cursor_pos_t), 1);
+    if (!ctx)
+        return NULL;
+
+    ctx->proc = proc;
+    ctx->data = data;
+    /* Without the vblank thread, just fall back to the immediate updates */
+    ctx->vblank = vblank;
+    if (ctx->vblank) {
+        ctx->period_us = fb_vblank_get_period_us(ctx->vblank);
+        RegisterBlockAndWakeupHandlers(block_handler, wakeup_handler, ctx);
+    }
+
+    return ctx;
+}
+
+/*
+ * The shared vblank thread has to be closed first, this runs the queued
+ * flush, if any.
+ */
+void fb_cursor_pos_close(fb_cursor_pos_t *ctx)
+{
+    if (ctx->vblank)
+        RemoveBlockAndWakeupHandlers(block_handler, wakeup_handler, ctx);
+    /* The moves, which have not reached the block handler yet */
+    fb_cursor_pos_flush(ctx);
+    if (ctx->errors)
+        ErrorF("fb_cursor_pos: failed to set the cursor position %lu times\n",
+               ctx->errors);
+    free(ctx);
+}
+
+void fb_cursor_pos_set(fb_cursor_pos_t *ctx, int x, int y)
+{
+    ctx->x = x;
+    ctx->y = y;
+    ctx->moves++;
+
+    /*
+     * The first move within a frame is applied right away, so that slow
+     * pointer motion gets no extra latency. The rest is deferred until
+     * the next vblank.
+     */
+    if (!ctx->vblank || (!ctx->flush_queued &&
+                         get_time_us() - ctx->last_ust >= ctx->period_us))
+        apply_position(ctx);
+    else
+        ctx->pending = 1;
+}
+
+void fb_cursor_pos_flush(fb_cursor_pos_t *ctx)
+{
+    cursor_input_lock();
+    if (ctx->pending)
+        apply_position(ctx);
+    cursor_input_unlock();
+}
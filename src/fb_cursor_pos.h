@@ -0,0 +1,78 @@
+/*
+ * Copyright © 2016 fbturbo developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FB_CURSOR_POS_H
+#define FB_CURSOR_POS_H
+
+#include <stdint.h>
+
+#include "fb_vblank.h"
+
+/*
+ * Coalescing of the hardware cursor position updates. The X server calls
+ * SetCursorPosition for every pointer motion event, which may be a lot
+ * more often than the screen refresh. Only the latest position is kept
+ * and applied at most once per vblank, so the cursor lags behind by no
+ * more than one frame.
+ *
+ * SetCursorPosition runs in the SIGIO handler before xserver 1.19 and in
+ * the input thread since then, so fb_cursor_pos_set never takes a mutex
+ * or allocates memory. It only applies the first move in a frame at once
+ * and leaves the rest to the X server thread, which queues the flush at
+ * the next vblank from its block handler. Everything the two sides share
+ * is only touched under input_lock() (OsBlockSIGIO() on older servers).
+ */
+
+/* Does the actual ioctl, returns a negative value on failure */
+typedef int (*fb_cursor_pos_proc)(void *data, int x, int y);
+
+typedef struct {
+    fb_vblank_t        *vblank;     /* NULL if every move is applied at once */
+    uint64_t            period_us;  /* of the vblanks */
+    fb_cursor_pos_proc  proc;
+    void               *data;
+
+    int                 x, y;       /* the latest requested position */
+    int                 pending;    /* not applied yet */
+    int                 flush_queued;
+    fb_vblank_event_t   flush_event;
+    uint64_t            last_ust;   /* when the position was last applied */
+
+    unsigned long       moves;      /* statistics */
+    unsigned long       ioctls;
+    unsigned long       errors;
+} fb_cursor_pos_t;
+
+/* The vblank thread of the screen is shared, it may also be NULL */
+fb_cursor_pos_t *fb_cursor_pos_init(fb_vblank_t        *vblank,
+                                    fb_cursor_pos_proc  proc,
+                                    void               *data);
+void fb_cursor_pos_close(fb_cursor_pos_t *ctx);
+
+/* Record the new position, it gets applied at the next vblank at the latest */
+void fb_cursor_pos_set(fb_cursor_pos_t *ctx, int x, int y);
+
+/* Apply the pending position right now (before showing the cursor, etc.) */
+void fb_cursor_pos_flush(fb_cursor_pos_t *ctx);
+
+#endif
@@ -0,0 +1,354 @@
+/*
+ * Copyright © 2016 fbturbo developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <linux/fb.h>
+#include <sys/ioctl.h>
+
+#include "xf86.h"
+
+#include "fb_vblank.h"
+
+#ifndef FBIO_WAITFORVSYNC
+#define FBIO_WAITFORVSYNC _IOW('F', 0x20, uint32_t)
+#endif
+
+/* Used when the refresh rate can't be derived from the video mode */
+#define FB_VBLANK_DEFAULT_PERIOD_US 16667
+
+static uint64_t get_time_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t get_period_us(int fd_fb)
+{
+    struct fb_var_screeninfo var;
+    uint64_t htotal, vtotal;
+
+    if (ioctl(fd_fb, FBIOGET_VSCREENINFO, &var) < 0 || var.pixclock == 0)
+        return FB_VBLANK_DEFAULT_PERIOD_US;
+
+    htotal = var.xres + var.left_margin + var.right_margin + var.hsync_len;
+    vtotal = var.yres + var.upper_margin + var.lower_margin + var.vsync_len;
+    /* pixclock is in picoseconds */
+    if (htotal * vtotal * var.pixclock < 1000000 * 1000)
+        return FB_VBLANK_DEFAULT_PERIOD_US;
+    return htotal * vtotal * var.pixclock / 1000000;
+}
+
+/*
+ * Wait for the next vblank. Some fbdev drivers don't implement
+ * FBIO_WAITFORVSYNC or return from it immediately, in this case just
+ * sleep until the expected time of the next vblank. Returns 0 if the
+ * ioctl failed or did not really wait.
+ */
+static int wait_for_vblank(fb_vblank_t *ctx, int use_ioctl,
+                           uint64_t last_ust, uint64_t period_us)
+{
+    if (use_ioctl) {
+        uint64_t start = get_time_us();
+        return ioctl(ctx->fd_fb, FBIO_WAITFORVSYNC, 0) == 0 &&
+               get_time_us() - start >= 1000;
+    }
+    else {
+        uint64_t now = get_time_us();
+        uint64_t next = last_ust + period_us;
+        struct timespec ts;
+        if (next <= now)
+            next = now + period_us - (now - last_ust) % period_us;
+        ts.tv_sec  = next / 1000000;
+        ts.tv_nsec = (next % 1000000) * 1000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+        return 1;
+    }
+}
+
+static void *vblank_thread(void *arg)
+{
+    fb_vblank_t *ctx = (fb_vblank_t *)arg;
+    int quick_returns = 0;
+
+    pthread_mutex_lock(&ctx->lock);
+    while (!ctx->quit) {
+        fb_vblank_event_t *ev;
+        uint64_t now, frames, last_ust = ctx->ust, period_us = ctx->period_us;
+        int use_ioctl = ctx->has_waitforvsync, waited;
+
+        /* Don't poll the hardware when nobody is interested */
+        if (!ctx->events) {
+            pthread_cond_wait(&ctx->cond, &ctx->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&ctx->lock);
+
+        waited = wait_for_vblank(ctx, use_ioctl, last_ust, period_us);
+        now = get_time_us();
+
+        pthread_mutex_lock(&ctx->lock);
+        if (use_ioctl) {
+            if (waited)
+                quick_returns = 0;
+            else if (++quick_returns >= 2)
+                ctx->has_waitforvsync = 0;
+        }
+
+        /* Also account for the vblanks which passed while we were idle */
+        frames = (now - ctx->ust + ctx->period_us / 2) / ctx->period_us;
+        if (frames == 1 && waited && use_ioctl)
+            ctx->period_us = (ctx->period_us * 7 + (now - ctx->ust)) / 8;
+        /* Returning early from the ioctl is not a vblank */
+        if (frames < 1 && waited)
+            frames = 1;
+        if (frames > 0) {
+            ctx->msc += frames;
+            ctx->ust = now;
+        }
+
+        for (ev = ctx->events; ev; ev = ev->next) {
+            if (ev->target_msc <= ctx->msc) {
+                char c = 0;
+                if (write(ctx->notify_fd[1], &c, 1) < 0) {
+                    /* the pipe is full, the X server is already notified */
+                }
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&ctx->lock);
+    return NULL;
+}
+
+/* Runs in the X server thread */
+static void fb_vblank_dispatch(fb_vblank_t *ctx)
+{
+    fb_vblank_event_t *ev, **prev, *done = NULL, **done_tail = &done;
+    uint64_t msc, ust;
+    char buf[64];
+
+    while (read(ctx->notify_fd[0], buf, sizeof(buf)) > 0);
+
+    pthread_mutex_lock(&ctx->lock);
+    msc = ctx->msc;
+    ust = ctx->ust;
+    prev = &ctx->events;
+    while ((ev = *prev)) {
+        if (ev->target_msc <= msc) {
+            *prev = ev->next;
+            ev->next = NULL;
+            *done_tail = ev;
+            done_tail = &ev->next;
+        }
+        else {
+            prev = &ev->next;
+        }
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    /* The handlers are free to queue new events, even the static ones */
+    while ((ev = done)) {
+        int is_static = ev->is_static;
+        done = ev->next;
+        ev->proc(ev->data, msc, ust);
+        if (!is_static)
+            free(ev);
+    }
+}
+
+#if GET_ABI_MAJOR(ABI_VIDEODRV_VERSION) >= 23
+static void fb_vblank_notify(int fd, int ready, void *data)
+{
+    fb_vblank_dispatch((fb_vblank_t *)data);
+}
+#else
+static void fb_vblank_block_handler(void *data, OSTimePtr timeout,
+                                    void *read_mask)
+{
+}
+
+static void fb_vblank_wakeup_handler(void *data, int result, void *read_mask)
+{
+    fb_vblank_t *ctx = (fb_vblank_t *)data;
+    if (result > 0 && FD_ISSET(ctx->notify_fd[0], (fd_set *)read_mask))
+        fb_vblank_dispatch(ctx);
+}
+#endif
+
+fb_vblank_t *fb_vblank_init(int fd_fb)
+{
+    fb_vblank_t *ctx = calloc(sizeof(fb_vblank_t), 1);
+    if (!ctx)
+        return NULL;
+
+    ctx->fd_fb = fd_fb;
+    ctx->has_waitforvsync = 1;
+    ctx->period_us = get_period_us(fd_fb);
+    ctx->ust = get_time_us();
+
+    if (pipe(ctx->notify_fd) < 0) {
+        free(ctx);
+        return NULL;
+    }
+    fcntl(ctx->notify_fd[0], F_SETFL, O_NONBLOCK);
+    fcntl(ctx->notify_fd[1], F_SETFL, O_NONBLOCK);
+    fcntl(ctx->notify_fd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(ctx->notify_fd[1], F_SETFD, FD_CLOEXEC);
+
+    pthread_mutex_init(&ctx->lock, NULL);
+    pthread_cond_init(&ctx->cond, NULL);
+
+    if (pthread_create(&ctx->thread, NULL, vblank_thread, ctx) != 0) {
+        pthread_cond_destroy(&ctx->cond);
+        pthread_mutex_destroy(&ctx->lock);
+        close(ctx->notify_fd[0]);
+        close(ctx->notify_fd[1]);
+        free(ctx);
+        return NULL;
+    }
+
+#if GET_ABI_MAJOR(ABI_VIDEODRV_VERSION) >= 23
+    SetNotifyFd(ctx->notify_fd[0], fb_vblank_notify, X_NOTIFY_READ, ctx);
+#else
+    AddGeneralSocket(ctx->notify_fd[0]);
+    RegisterBlockAndWakeupHandlers(fb_vblank_block_handler,
+                                   fb_vblank_wakeup_handler, ctx);
+#endif
+
+    return ctx;
+}
+
+void fb_vblank_close(fb_vblank_t *ctx)
+{
+    fb_vblank_event_t *ev;
+    uint64_t msc, ust;
+
+#if GET_ABI_MAJOR(ABI_VIDEODRV_VERSION) >= 23
+    RemoveNotifyFd(ctx->notify_fd[0]);
+#else
+    RemoveBlockAndWakeupHandlers(fb_vblank_block_handler,
+                                 fb_vblank_wakeup_handler, ctx);
+    RemoveGeneralSocket(ctx->notify_fd[0]);
+#endif
+
+    pthread_mutex_lock(&ctx->lock);
+    ctx->quit = 1;
+    pthread_cond_signal(&ctx->cond);
+    pthread_mutex_unlock(&ctx->lock);
+    pthread_join(ctx->thread, NULL);
+
+    /* Complete whatever is still pending, so that nothing gets leaked */
+    fb_vblank_get_msc(ctx, &msc, &ust);
+    while ((ev = ctx->events)) {
+        int is_static = ev->is_static;
+        ctx->events = ev->next;
+        ev->proc(ev->data, msc, ust);
+        if (!is_static)
+            free(ev);
+    }
+
+    pthread_cond_destroy(&ctx->cond);
+    pthread_mutex_destroy(&ctx->lock);
+    close(ctx->notify_fd[0]);
+    close(ctx->notify_fd[1]);
+    free(ctx);
+}
+
+void fb_vblank_get_msc(fb_vblank_t *ctx, uint64_t *msc, uint64_t *ust)
+{
+    uint64_t now = get_time_us();
+
+    pthread_mutex_lock(&ctx->lock);
+    *msc = ctx->msc;
+    *ust = ctx->ust;
+    /*
+     * Estimate how many vblanks have passed since the thread has seen the
+     * last one. It may be sleeping or may have just been woken up by a new
+     * event after a long idle period, either way the counter must not lag.
+     */
+    if (now - ctx->ust >= ctx->period_us) {
+        uint64_t frames = (now - ctx->ust) / ctx->period_us;
+        *msc += frames;
+        *ust += frames * ctx->period_us;
+    }
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+uint64_t fb_vblank_get_period_us(fb_vblank_t *ctx)
+{
+    uint64_t period_us;
+    pthread_mutex_lock(&ctx->lock);
+    period_us = ctx->period_us;
+    pthread_mutex_unlock(&ctx->lock);
+    return period_us;
+}
+
+static void queue_event(fb_vblank_t *ctx, fb_vblank_event_t *ev)
+{
+    fb_vblank_event_t **tail;
+
+    ev->next = NULL;
+    pthread_mutex_lock(&ctx->lock);
+    for (tail = &ctx->events; *tail; tail = &(*tail)->next);
+    *tail = ev;
+    pthread_cond_signal(&ctx->cond);
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+int fb_vblank_queue_event(fb_vblank_t    *ctx,
+                          uint64_t        target_msc,
+                          fb_vblank_proc  proc,
+                          void           *data)
+{
+    fb_vblank_event_t *ev = calloc(sizeof(fb_vblank_event_t), 1);
+    if (!ev)
+        return -1;
+
+    ev->target_msc = target_msc;
+    ev->proc = proc;
+    ev->data = data;
+    queue_event(ctx, ev);
+    return 0;
+}
+
+void fb_vblank_queue_static_event(fb_vblank_t       *ctx,
+                                  fb_vblank_event_t *ev,
+                                  uint64_t           target_msc,
+                                  fb_vblank_proc     proc,
+                                  void              *data)
+{
+    ev->target_msc = target_msc;
+    ev->proc = proc;
+    ev->data = data;
+    ev->is_static = 1;
+    queue_event(ctx, ev);
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright © 2016 fbturbo developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FB_VBLANK_H
+#define FB_VBLANK_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+ * Called from the X server thread once the vblank counter has reached
+ * the requested value. 'ust' is the CLOCK_MONOTONIC time of that vblank
+ * in microseconds.
+ */
+typedef void (*fb_vblank_proc)(void *data, uint64_t msc, uint64_t ust);
+
+typedef struct fb_vblank_event {
+    struct fb_vblank_event *next;
+    uint64_t                target_msc;
+    fb_vblank_proc          proc;
+    void                   *data;
+    int                     is_static; /* owned by the caller, never freed */
+} fb_vblank_event_t;
+
+typedef struct {
+    int                 fd_fb;
+    int                 notify_fd[2]; /* the thread -> X server pipe */
+
+    pthread_t           thread;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+    int                 quit;
+
+    /* everything below is protected by 'lock' */
+    uint64_t            msc;       /* the number of the last vblank */
+    uint64_t            ust;       /* and its timestamp in microseconds */
+    uint64_t            period_us; /* measured time between vblanks */
+    fb_vblank_event_t  *events;    /* waiting for their target_msc */
+    int                 has_waitforvsync;
+} fb_vblank_t;
+
+/*
+ * There is one vblank thread per screen, shared by all its users. Closing
+ * it runs all the still queued events, so it has to be done before their
+ * owners go away.
+ */
+fb_vblank_t *fb_vblank_init(int fd_fb);
+void fb_vblank_close(fb_vblank_t *ctx);
+
+/* The measured time between vblanks in microseconds */
+uint64_t fb_vblank_get_period_us(fb_vblank_t *ctx);
+
+/* Get the current vblank counter (extrapolated if the thread is behind) */
+void fb_vblank_get_msc(fb_vblank_t *ctx, uint64_t *msc, uint64_t *ust);
+
+/*
+ * Run 'proc' in the X server thread at the first vblank with the counter
+ * >= target_msc. The vblank thread only polls the hardware while there
+ * are events queued. Returns 0 on success.
+ */
+int fb_vblank_queue_event(fb_vblank_t    *ctx,
+                          uint64_t        target_msc,
+                          fb_vblank_proc  proc,
+                          void           *data);
+
+/*
+ * The same, but for an event preallocated by the caller. It must not be
+ * queued again before its handler has run.
+ */
+void fb_vblank_queue_static_event(fb_vblank_t       *ctx,
+                                  fb_vblank_event_t *ev,
+                                  uint64_t           target_msc,
+                                  fb_vblank_proc     proc,
+                                  void              *data);
+
+#endif
@@ -0,0 +1,433 @@
+/*
+ * Copyright © 2016 fbturbo developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <pixman.h>
+
+#include "xf86.h"
+#include "fourcc.h"
+
+#include "xvideo.h"
+#include "fb_xvideo.h"
+
+/*
+ * Use G2D only if this much offscreen framebuffer memory is available
+ * for staging the image (enough for one 1080p frame), otherwise the
+ * image is kept in normal memory and converted by the CPU.
+ */
+#define G2D_MIN_OFFSCREEN_SIZE (1920 * 1088 * 3 / 2)
+
+/*****************************************************************************/
+
+static inline uint32_t clamp_u8(int v)
+{
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+/*
+ * Convert a rectangle of YUV 4:2:0 image to x8r8g8b8 (ITU-R BT.601, limited
+ * range). Chroma samples are 'uv_step' bytes apart, so that both planar
+ * (uv_step = 1) and interleaved NV12 (uv_step = 2) layouts are supported.
+ */
+static void yuv420_to_x8r8g8b8(uint32_t      *dst,
+                               int            dst_stride,
+                               const uint8_t *y_plane,
+                               const uint8_t *u_plane,
+                               const uint8_t *v_plane,
+                               int            y_stride,
+                               int            uv_stride,
+                               int            uv_step,
+                               int            x,
+                               int            y,
+                               int            w,
+                               int            h)
+{
+    int i, j;
+
+    for (j = 0; j < h; j++) {
+        const uint8_t *yp = y_plane + (y + j) * y_stride + x;
+        const uint8_t *up = u_plane + ((y + j) >> 1) * uv_stride;
+        const uint8_t *vp = v_plane + ((y + j) >> 1) * uv_stride;
+        uint32_t *d = dst + j * dst_stride;
+        int rv = 0, guv = 0, bu = 0;
+
+        for (i = 0; i < w; i++) {
+            int c;
+            /* one chroma sample covers two horizontally adjacent pixels */
+            if (i == 0 || ((x + i) & 1) == 0) {
+                int cx = ((x + i) >> 1) * uv_step;
+                int u = up[cx] - 128;
+                int v = vp[cx] - 128;
+                rv  = 409 * v;
+                guv = -100 * u - 208 * v;
+                bu  = 516 * u;
+            }
+            c = 298 * (yp[i] - 16) + 128;
+            d[i] = 0xFF000000 |
+                   (clamp_u8((c + rv) >> 8) << 16) |
+                   (clamp_u8((c + guv) >> 8) << 8) |
+                   clamp_u8((c + bu) >> 8);
+        }
+    }
+}
+
+static pixman_format_code_t bpp_to_pixman_format(int bpp)
+{
+    switch (bpp) {
+    case 16:
+        return PIXMAN_r5g6b5;
+    case 24:
+        return PIXMAN_r8g8b8;
+    case 32:
+        return PIXMAN_x8r8g8b8;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Convert the source rectangle to x8r8g8b8 and let pixman do the bilinear
+ * scaling (and the conversion to the destination format), which has NEON
+ * optimized fast paths for this on ARM.
+ */
+static int render_frame_cpu(fb_xvideo                 *self,
+                            uint32_t                  *dst_bits,
+                            int                        dst_stride,
+                            int                        dst_bpp,
+                            int                        dst_x_offs,
+                            int                        dst_y_offs,
+                            const struct pixman_box16 *boxes,
+                            int                        nboxes)
+{
+    pixman_format_code_t dst_format = bpp_to_pixman_format(dst_bpp);
+    pixman_image_t *src_img, *dst_img;
+    pixman_region16_t region;
+    pixman_transform_t transform;
+    const pixman_box16_t *extents;
+    const uint8_t *u_plane, *v_plane;
+    uint8_t *fb = self->buf - self->buf_offs;
+    int uv_stride, uv_step;
+    size_t size;
+
+    if (!dst_format)
+        return -1;
+
+    size = (size_t)self->src_w * self->src_h * 4;
+    if (size > self->scratch_size) {
+        uint32_t *scratch = realloc(self->scratch, size);
+        if (!scratch)
+            return -1;
+        self->scratch = scratch;
+        self->scratch_size = size;
+    }
+
+    if (self->disp) {
+        /* NV12, prepared by fb_xvideo_copy_buffer */
+        u_plane = fb + min(self->u_offs, self->v_offs);
+        v_plane = u_plane + 1;
+        uv_stride = self->src_stride;
+        uv_step = 2;
+    } else {
+        u_plane = fb + self->u_offs;
+        v_plane = fb + self->v_offs;
+        uv_stride = self->src_stride / 2;
+        uv_step = 1;
+    }
+
+    yuv420_to_x8r8g8b8(self->scratch, self->src_w, fb + self->y_offs,
+                       u_plane, v_plane, self->src_stride, uv_stride, uv_step,
+                       self->src_x, self->src_y, self->src_w, self->src_h);
+
+    pixman_region_init_rects(&region, (const pixman_box16_t *)boxes, nboxes);
+    pixman_region_translate(&region, dst_x_offs, dst_y_offs);
+    extents = pixman_region_extents(&region);
+    if (extents->x2 <= 0 || extents->y2 <= 0) {
+        pixman_region_fini(&region);
+        return 0;
+    }
+
+    src_img = pixman_image_create_bits(PIXMAN_x8r8g8b8, self->src_w,
+                                       self->src_h, self->scratch,
+                                       self->src_w * 4);
+    dst_img = pixman_image_create_bits(dst_format, extents->x2, extents->y2,
+                                       dst_bits, dst_stride * 4);
+    if (!src_img || !dst_img) {
+        if (src_img)
+            pixman_image_unref(src_img);
+        if (dst_img)
+            pixman_image_unref(dst_img);
+        pixman_region_fini(&region);
+        return -1;
+    }
+
+    pixman_image_set_clip_region(dst_img, &region);
+
+    if (self->src_w != self->drw_w || self->src_h != self->drw_h) {
+        pixman_transform_init_scale(&transform,
+            pixman_double_to_fixed((double)self->src_w / self->drw_w),
+            pixman_double_to_fixed((double)self->src_h / self->drw_h));
+        pixman_image_set_transform(src_img, &transform);
+        pixman_image_set_filter(src_img, PIXMAN_FILTER_BILINEAR, NULL, 0);
+        pixman_image_set_repeat(src_img, PIXMAN_REPEAT_PAD);
+    }
+
+    pixman_image_composite(PIXMAN_OP_SRC, src_img, NULL, dst_img, 0, 0, 0, 0,
+                           self->drw_x + dst_x_offs, self->drw_y + dst_y_offs,
+                           self->drw_w, self->drw_h);
+
+    pixman_image_unref(src_img);
+    pixman_image_unref(dst_img);
+    pixman_region_fini(&region);
+    return 0;
+}
+
+/*
+ * Stretch blit every visible part of the output window with G2D. Only
+ * works if the destination is the visible framebuffer itself.
+ */
+static int render_frame_g2d(fb_xvideo                 *self,
+                            const struct pixman_box16 *boxes,
+                            int                        nboxes)
+{
+    uint32_t uv_offs = min(self->u_offs, self->v_offs);
+    int i;
+
+    for (i = 0; i < nboxes; i++) {
+        int x1 = max(boxes[i].x1, self->drw_x);
+        int y1 = max(boxes[i].y1, self->drw_y);
+        int x2 = min(boxes[i].x2, self->drw_x + self->drw_w);
+        int y2 = min(boxes[i].y2, self->drw_y + self->drw_h);
+        int sx1, sy1, sx2, sy2;
+
+        if (x1 >= x2 || y1 >= y2)
+            continue;
+
+        /* the part of the source image, which is scaled into this box */
+        sx1 = self->src_x + (x1 - self->drw_x) * self->src_w / self->drw_w;
+        sy1 = self->src_y + (y1 - self->drw_y) * self->src_h / self->drw_h;
+        sx2 = self->src_x + (x2 - self->drw_x) * self->src_w / self->drw_w;
+        sy2 = self->src_y + (y2 - self->drw_y) * self->src_h / self->drw_h;
+        if (sx2 <= sx1)
+            sx2 = sx1 + 1;
+        if (sy2 <= sy1)
+            sy2 = sy1 + 1;
+
+        if (sunxi_g2d_stretch_nv12(self->disp, self->y_offs, uv_offs,
+                                   self->src_stride, self->src_y + self->src_h,
+                                   sx1, sy1, sx2 - sx1, sy2 - sy1,
+                                   x1, y1, x2 - x1, y2 - y1) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int fb_xvideo_render_frame(void                      *data,
+                                  uint32_t                  *dst_bits,
+                                  int                        dst_stride,
+                                  int                        dst_bpp,
+                                  int                        dst_x_offs,
+                                  int                        dst_y_offs,
+                                  const struct pixman_box16 *boxes,
+                                  int                        nboxes)
+{
+    fb_xvideo *self = (fb_xvideo *)data;
+
+    if (self->src_w <= 0 || self->src_h <= 0 ||
+        self->drw_w <= 0 || self->drw_h <= 0 || nboxes <= 0)
+        return 0;
+
+    if (self->disp && (uint8_t *)dst_bits == self->disp->framebuffer_addr &&
+        dst_x_offs == 0 && dst_y_offs == 0 &&
+        dst_bpp == self->disp->bits_per_pixel &&
+        render_frame_g2d(self, boxes, nboxes) == 0)
+        return 0;
+
+    return render_frame_cpu(self, dst_bits, dst_stride, dst_bpp,
+                            dst_x_offs, dst_y_offs, boxes, nboxes);
+}
+
+/*****************************************************************************/
+
+#ifdef __arm__
+extern void interleaved_copy_u8(void *dst, void *src1, void *src2, size_t len);
+#endif
+
+/* G2D wants the chroma planes interleaved (NV12) */
+static void fb_xvideo_copy_buffer(void *data, void *dst, const void *src,
+                                  size_t n, int image_format)
+{
+    const uint8_t *u = (const uint8_t *)src +
+                       n * (image_format == FOURCC_YV12 ? 5 : 4) / 6;
+    const uint8_t *v = (const uint8_t *)src +
+                       n * (image_format == FOURCC_YV12 ? 4 : 5) / 6;
+    uint8_t *uv = (uint8_t *)dst + n * 2 / 3;
+
+    memcpy(dst, src, n * 2 / 3);
+#ifdef __arm__
+    interleaved_copy_u8(uv, (void *)u, (void *)v, n / 3);
+#else
+    {
+        size_t i;
+        for (i = 0; i < n / 6; i++) {
+            uv[i * 2] = u[i];
+            uv[i * 2 + 1] = v[i];
+        }
+    }
+#endif
+}
+
+static int fb_xvideo_set_input_buf(void     *data,
+                                   uint32_t  y_offs,
+                                   uint32_t  u_offs,
+                                   uint32_t  v_offs)
+{
+    fb_xvideo *self = (fb_xvideo *)data;
+    self->y_offs = y_offs;
+    self->u_offs = u_offs;
+    self->v_offs = v_offs;
+    return 0;
+}
+
+static int fb_xvideo_set_input_par(void *data, int w, int h, int stride,
+                                   int x, int y)
+{
+    fb_xvideo *self = (fb_xvideo *)data;
+    self->src_w = w;
+    self->src_h = h;
+    self->src_stride = stride;
+    self->src_x = x;
+    self->src_y = y;
+    return 0;
+}
+
+static int fb_xvideo_set_output_window(void *data, int x, int y, int w, int h)
+{
+    fb_xvideo *self = (fb_xvideo *)data;
+    self->drw_x = x;
+    self->drw_y = y;
+    self->drw_w = w;
+    self->drw_h = h;
+    return 0;
+}
+
+/* There is no overlay window and no colorkey */
+static int fb_xvideo_nop(void *data)
+{
+    return 0;
+}
+
+static int fb_xvideo_set_colorkey(void *data, uint32_t color)
+{
+    return 0;
+}
+
+static int fb_xvideo_get_screen_width(void *data)
+{
+    fb_xvideo *self = (fb_xvideo *)data;
+    return xf86ScreenToScrn(self->pScreen)->virtualX;
+}
+
+static int fb_xvideo_get_screen_height(void *data)
+{
+    fb_xvideo *self = (fb_xvideo *)data;
+    return xf86ScreenToScrn(self->pScreen)->virtualY;
+}
+
+static char *fb_xvideo_get_fb_mem(void *data)
+{
+    fb_xvideo *self = (fb_xvideo *)data;
+    return (char *)(self->buf - self->buf_offs);
+}
+
+static ssize_t fb_xvideo_get_visible_fb_size(void *data)
+{
+    fb_xvideo *self = (fb_xvideo *)data;
+    return self->buf_offs;
+}
+
+static ssize_t fb_xvideo_get_total_fb_size(void *data)
+{
+    fb_xvideo *self = (fb_xvideo *)data;
+    return self->buf_offs + self->buf_size;
+}
+
+static void fb_xvideo_close(void *data)
+{
+    fb_xvideo *self = (fb_xvideo *)data;
+    if (self->buf_is_malloced)
+        free(self->buf);
+    free(self->scratch);
+    free(self);
+}
+
+fb_xvideo *fb_xvideo_init(ScreenPtr pScreen, sunxi_disp_t *disp)
+{
+    fb_xvideo *self = calloc(1, sizeof(fb_xvideo));
+    if (!self)
+        return NULL;
+
+    if (disp && disp->fd_g2d >= 0 &&
+        (disp->bits_per_pixel == 16 || disp->bits_per_pixel == 32) &&
+        disp->offscreen_end - disp->gfx_layer_size >= G2D_MIN_OFFSCREEN_SIZE) {
+        /* stage the image in the offscreen part of framebuffer */
+        self->disp = disp;
+        self->buf = disp->framebuffer_addr + disp->gfx_layer_size;
+        self->buf_offs = disp->gfx_layer_size;
+        self->buf_size = disp->offscreen_end - disp->gfx_layer_size;
+        self->intf.copy_buffer = fb_xvideo_copy_buffer;
+    }
+    else {
+        self->buf_size = XV_IMAGE_MAX_WIDTH * XV_IMAGE_MAX_HEIGHT * 3 / 2;
+        if (!(self->buf = malloc(self->buf_size))) {
+            free(self);
+            return NULL;
+        }
+        self->buf_is_malloced = TRUE;
+    }
+
+    self->pScreen = pScreen;
+
+    self->intf.self = self;
+    self->intf.flags = 0;
+    self->intf.set_yuv420_input_buffer = fb_xvideo_set_input_buf;
+    self->intf.set_input_par = fb_xvideo_set_input_par;
+    self->intf.set_output_window = fb_xvideo_set_output_window;
+    self->intf.show_window = fb_xvideo_nop;
+    self->intf.hide_window = fb_xvideo_nop;
+    self->intf.set_colorkey = fb_xvideo_set_colorkey;
+    self->intf.disable_colorkey = fb_xvideo_nop;
+    self->intf.render_frame = fb_xvideo_render_frame;
+    self->intf.get_screen_width = fb_xvideo_get_screen_width;
+    self->intf.get_screen_height = fb_xvideo_get_screen_height;
+    self->intf.get_fb_mem = fb_xvideo_get_fb_mem;
+    self->intf.get_visible_fb_size = fb_xvideo_get_visible_fb_size;
+    self->intf.get_total_fb_size = fb_xvideo_get_total_fb_size;
+    self->intf.close = fb_xvideo_close;
+
+    return self;
+}
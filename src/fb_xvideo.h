@@ -0,0 +1,70 @@
+/*
+ * Copyright © 2016 fbturbo developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FB_XVIDEO_H
+#define FB_XVIDEO_H
+
+#include "interfaces.h"
+#include "sunxi_disp.h"
+
+/*
+ * XVideo backend for the systems without a usable hardware overlay. The
+ * YV12/I420 image is converted to RGB and scaled straight into the window
+ * pixels, using G2D stretch blits when the destination is the framebuffer
+ * and the sunxi G2D device is available, or the CPU otherwise.
+ */
+typedef struct {
+    int           src_stride;
+    int           src_w;
+    int           src_h;
+    int           src_x;
+    int           src_y;
+
+    int           drw_x;
+    int           drw_y;
+    int           drw_w;
+    int           drw_h;
+
+    uint32_t      y_offs;
+    uint32_t      u_offs;
+    uint32_t      v_offs;
+
+    /* Where the image data is staged (framebuffer or malloc'ed buffer) */
+    uint8_t      *buf;
+    ssize_t       buf_offs;
+    ssize_t       buf_size;
+    Bool          buf_is_malloced;
+
+    /* Temporary x8r8g8b8 buffer for the CPU conversion */
+    uint32_t     *scratch;
+    size_t        scratch_size;
+
+    ScreenPtr     pScreen;
+    sunxi_disp_t *disp;    /* non-NULL if G2D is used */
+
+    xvideo_i      intf;
+} fb_xvideo;
+
+fb_xvideo *fb_xvideo_init(ScreenPtr pScreen, sunxi_disp_t *disp);
+
+#endif
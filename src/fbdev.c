@@ -48,15 +48,19 @@
 
 #include "cpu_backend.h"
 #include "fb_copyarea.h"
+#include "blt2d_chain.h"
 
 #include "sunxi_disp.h"
 #include "sunxi_disp_hwcursor.h"
+#include "fb_vblank.h"
 #include "sunxi_x_g2d.h"
 #include "backing_store_tuner.h"
 #include "xvideo.h"
+#include "sunxi_xvideo.h"
 #include "rk_fb.h"
 #include "rk_rga.h"
 #include "rk_xvideo.h"
+#include "fb_xvideo.h"
 #include "rk_hwcursor.h"
 
 #ifdef HAVE_LIBUMP
@@ -177,6 +181,12 @@ typedef enum {
 	OPTION_USE_BS,
 	OPTION_FORCE_BS,
 	OPTION_XV_OVERLAY,
+	OPTION_DRI2_BUFFER_POOL,
+	OPTION_DRI2_OVERLAY_UPSCALE,
+	OPTION_BS_BUDGET,
+	OPTION_BS_FB_POOL,
+	OPTION_ACCEL_ORDER,
+	OPTION_BLT_TRACE,
 } FBDevOpts;
 
 static const OptionInfoRec FBDevOptions[] = {
@@ -193,6 +203,12 @@ static const OptionInfoRec FBDevOptions[] = {
 	{ OPTION_USE_BS,	"UseBackingStore",OPTV_BOOLEAN,	{0},	FALSE },
 	{ OPTION_FORCE_BS,	"ForceBackingStore",OPTV_BOOLEAN,{0},	FALSE },
 	{ OPTION_XV_OVERLAY,	"XVHWOverlay",	OPTV_BOOLEAN,	{0},	FALSE },
+	{ OPTION_DRI2_BUFFER_POOL,"DRI2BufferPool",OPTV_INTEGER,{0},	FALSE },
+	{ OPTION_DRI2_OVERLAY_UPSCALE,"DRI2OverlayUpscale",OPTV_BOOLEAN,{0},FALSE },
+	{ OPTION_BS_BUDGET,	"BackingStoreBudget",OPTV_INTEGER,{0},	FALSE },
+	{ OPTION_BS_FB_POOL,	"BackingStoreFBPool",OPTV_INTEGER,{0},	FALSE },
+	{ OPTION_ACCEL_ORDER,	"AccelOrder",	OPTV_STRING,	{0},	FALSE },
+	{ OPTION_BLT_TRACE,	"BltTraceFile",	OPTV_STRING,	{0},	FALSE },
 	{ -1,			NULL,		OPTV_NONE,	{0},	FALSE }
 };
 
@@ -526,6 +542,10 @@ FBDevPreInit(ScrnInfoPtr pScrn, int flags)
 	cpuinfo = cpuinfo_init();
 	xf86DrvMsg(pScrn->scrnIndex, X_INFO, "processor: %s\n",
 	           cpuinfo->processor_name);
+	if (cpuinfo->is_heterogeneous)
+		xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+		           "%d cores of different types, tuning for the fastest\n",
+		           cpuinfo->num_cores);
 	/* don't use shadow by default if we have VFP/NEON or HW acceleration */
 	fPtr->shadowFB = !cpuinfo->has_arm_vfp &&
 	                 !xf86GetOptValString(fPtr->Options, OPTION_ACCELMETHOD);
@@ -715,6 +735,8 @@ FBDevScreenInit(SCREEN_INIT_ARGS_DECL)
 	int type;
 	char *accelmethod;
 	cpu_backend_t *cpu_backend;
+	blt2d_chain_t *chain;
+	Bool g2d_enabled = FALSE;
 	Bool useBackingStore = FALSE, forceBackingStore = FALSE;
 
 	TRACE_ENTER("FBDevScreenInit");
@@ -901,8 +923,12 @@ FBDevScreenInit(SCREEN_INIT_ARGS_DECL)
 	                                         forceBackingStore);
 
 	if (useBackingStore || forceBackingStore) {
+		int budget_mb = 0;
+		xf86GetOptValInteger(fPtr->Options, OPTION_BS_BUDGET,
+		                     &budget_mb);
 		fPtr->backing_store_tuner_private =
-			BackingStoreTuner_Init(pScreen, forceBackingStore);
+			BackingStoreTuner_Init(pScreen, forceBackingStore,
+			                       budget_mb);
 	}
 
 	/* initialize the 'CPU' backend */
@@ -940,13 +966,34 @@ FBDevScreenInit(SCREEN_INIT_ARGS_DECL)
 		}
 	}
 
+	/*
+	 * Collect all the usable 2D blit backends into a chain, every blit
+	 * is routed to the first one which can handle it.
+	 */
+	chain = blt2d_chain_init();
+	fPtr->blt2d_chain_private = chain;
+
 	if (!(accelmethod = xf86GetOptValString(fPtr->Options, OPTION_ACCELMETHOD)) ||
 						strcasecmp(accelmethod, "g2d") == 0) {
 		sunxi_disp_t *disp = fPtr->sunxi_disp_private;
-		if (disp && disp->fd_g2d >= 0 &&
-		    (fPtr->SunxiG2D_private = SunxiG2D_Init(pScreen, &disp->blt2d))) {
-			disp->fallback_blt2d = &cpu_backend->blt2d;
-			xf86DrvMsg(pScrn->scrnIndex, X_INFO, "enabled G2D acceleration\n");
+		blt2d_backend_t backend = {
+			.name = "g2d",
+			.bpp_mask = BLT2D_BPP16 | BLT2D_BPP32,
+			.can_overlap = TRUE,
+			.min_pixels = G2D_BLT_SIZE_THRESHOLD,
+			.min_pixels_16bpp = G2D_BLT_SIZE_THRESHOLD_16BPP,
+		};
+		if (disp && disp->fd_g2d >= 0 && chain) {
+			backend.blt2d = &disp->blt2d;
+			backend.src_mem = backend.dst_mem = disp->framebuffer_addr;
+			backend.src_mem_size = backend.dst_mem_size =
+			                                disp->framebuffer_size;
+			/* the chain takes care of falling back to the CPU */
+			disp->fallback_blt2d = NULL;
+			if (blt2d_chain_add(chain, &backend) == 0) {
+				g2d_enabled = TRUE;
+				xf86DrvMsg(pScrn->scrnIndex, X_INFO, "enabled G2D acceleration\n");
+			}
 		}
 		else {
 			xf86DrvMsg(pScreen->myNum, X_INFO,
@@ -960,12 +1007,43 @@ FBDevScreenInit(SCREEN_INIT_ARGS_DECL)
 			"G2D acceleration is disabled via AccelMethod option\n");
 	}
 
-	if (!fPtr->SunxiG2D_private && fPtr->fb_copyarea_private) {
+	/* let G2D do the backing store copies, if they are in framebuffer */
+	if (fPtr->backing_store_tuner_private && g2d_enabled) {
+		sunxi_disp_t *disp = fPtr->sunxi_disp_private;
+		int pool_mb = 0;
+		uint32_t offs, size;
+		xf86GetOptValInteger(fPtr->Options, OPTION_BS_FB_POOL, &pool_mb);
+		if (pool_mb > 0) {
+			/* the same rounding as in sunxi_disp_reserve_offscreen */
+			size = (((uint32_t)pool_mb << 20) + 4095) & ~4095;
+			offs = sunxi_disp_reserve_offscreen(disp, size);
+			if (offs)
+				BackingStoreTuner_SetPixmapPool(pScreen,
+				        disp->framebuffer_addr + offs, size);
+			else
+				xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+				           "not enough offscreen framebuffer memory "
+				           "for BackingStoreFBPool\n");
+		}
+	}
+
+	if (chain && fPtr->fb_copyarea_private) {
 		if (!(accelmethod = xf86GetOptValString(fPtr->Options, OPTION_ACCELMETHOD)) ||
 						strcasecmp(accelmethod, "copyarea") == 0) {
 			fb_copyarea_t *fb = fPtr->fb_copyarea_private;
-			if ((fPtr->SunxiG2D_private = SunxiG2D_Init(pScreen, &fb->blt2d))) {
-				fb->fallback_blt2d = &cpu_backend->blt2d;
+			blt2d_backend_t backend = {
+				.name = "copyarea",
+				.blt2d = &fb->blt2d,
+				.bpp_mask = BLT2D_BPP16 | BLT2D_BPP24 | BLT2D_BPP32,
+				.needs_same_bpp = TRUE,
+				.can_overlap = TRUE,
+				.src_mem = fb->framebuffer_addr,
+				.src_mem_size = fb->framebuffer_size,
+				.dst_mem = fb->framebuffer_addr,
+				.dst_mem_size = fb->framebuffer_size,
+			};
+			fb->fallback_blt2d = NULL;
+			if (blt2d_chain_add(chain, &backend) == 0) {
 				xf86DrvMsg(pScrn->scrnIndex, X_INFO,
 				           "enabled fbdev copyarea acceleration\n");
 			}
@@ -980,12 +1058,22 @@ FBDevScreenInit(SCREEN_INIT_ARGS_DECL)
 		}
 	}
 	
-	if (!fPtr->SunxiG2D_private && fPtr->rk_rga_private) {
+	if (chain && fPtr->rk_rga_private) {
 		if (!(accelmethod = xf86GetOptValString(fPtr->Options, OPTION_ACCELMETHOD)) ||
 						strcasecmp(accelmethod, "rk_rga") == 0) {
 			rk_rga *rga = fPtr->rk_rga_private;
-			if ((fPtr->SunxiG2D_private = SunxiG2D_Init(pScreen, &rga->blt2d))) {
-				//fb->fallback_blt2d = &cpu_backend->blt2d;
+			blt2d_backend_t backend = {
+				.name = "rga",
+				.blt2d = &rga->blt2d,
+				.bpp_mask = BLT2D_BPP16 | BLT2D_BPP24 | BLT2D_BPP32,
+				.needs_same_bpp = TRUE,
+				.can_overlap = TRUE,
+				.src_mem = (uint8_t *)rga->rkfb->fb_mem,
+				.src_mem_size = rga->rkfb->fb_mem_len,
+				.dst_mem = (uint8_t *)rga->rkfb->fb_mem,
+				.dst_mem_size = rga->rkfb->fb_mem_len,
+			};
+			if (blt2d_chain_add(chain, &backend) == 0) {
 				xf86DrvMsg(pScrn->scrnIndex, X_INFO,
 				           "enabled Rockchip RGA acceleration\n");
 			}
@@ -1000,9 +1088,53 @@ FBDevScreenInit(SCREEN_INIT_ARGS_DECL)
 		}
 	}
 
-	if (!fPtr->SunxiG2D_private && cpu_backend->cpuinfo->has_arm_vfp) {
-		if ((fPtr->SunxiG2D_private = SunxiG2D_Init(pScreen, &cpu_backend->blt2d))) {
+	if (chain) {
+		/* the CPU can only speed up the reads from framebuffer */
+		blt2d_backend_t backend = {
+			.name = "cpu",
+			.blt2d = &cpu_backend->blt2d,
+			.bpp_mask = BLT2D_BPP16 | BLT2D_BPP24 | BLT2D_BPP32,
+			.needs_same_bpp = TRUE,
+			.can_overlap = TRUE,
+			.src_mem = cpu_backend->uncached_area_begin,
+			.src_mem_size = cpu_backend->uncached_area_end -
+			                cpu_backend->uncached_area_begin,
+		};
+		Bool hw_accel = chain->num_backends > 0;
+
+		/* alone it is only worth it with VFP/NEON */
+		if ((hw_accel || cpu_backend->cpuinfo->has_arm_vfp) &&
+		    blt2d_chain_add(chain, &backend) == 0 && !hw_accel)
 			xf86DrvMsg(pScrn->scrnIndex, X_INFO, "enabled VFP/NEON optimizations\n");
+
+		blt2d_chain_set_order(chain, xf86GetOptValString(fPtr->Options,
+		                                                 OPTION_ACCEL_ORDER));
+		if (chain->num_backends > 0)
+			fPtr->SunxiG2D_private = SunxiG2D_Init(pScreen, &chain->blt2d);
+		if (chain->num_backends > 1) {
+			int i;
+			for (i = 0; i < chain->num_backends; i++)
+				xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+				           "2D blit backend %d: %s\n", i,
+				           blt2d_chain_get(chain, i)->name);
+		}
+	}
+
+	if (fPtr->SunxiG2D_private) {
+		SunxiG2D *g2d = fPtr->SunxiG2D_private;
+		char *trace_file = xf86GetOptValString(fPtr->Options,
+		                                       OPTION_BLT_TRACE);
+		if (trace_file) {
+			g2d->trace = blt_trace_open(trace_file, pScrn->virtualX,
+			                            pScrn->virtualY,
+			                            pScrn->bitsPerPixel);
+			if (g2d->trace)
+				xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+				           "recording the blits to %s\n", trace_file);
+			else
+				xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+				           "failed to create the blit trace file %s\n",
+				           trace_file);
 		}
 	}
 
@@ -1078,14 +1210,23 @@ FBDevScreenInit(SCREEN_INIT_ARGS_DECL)
 
 #if XV
 	fPtr->XVideo_private = NULL;
-	if (!xf86ReturnOptValBool(fPtr->Options, OPTION_XV_OVERLAY, FALSE)) {
-		/*if (fPtr->sunxi_disp_private) {
-			fPtr->SunxiVideo_private = SunxiVideo_Init(pScreen);
-			if (fPtr->SunxiVideo_private)
-			xf86DrvMsg(pScrn->scrnIndex, X_INFO,
-				       "using sunxi disp layers for X video extension\n");
-		} */
-		if (fPtr->RkFb_private) {
+	if (xf86ReturnOptValBool(fPtr->Options, OPTION_XV_OVERLAY, TRUE)) {
+		if (fPtr->sunxi_disp_private) {
+			sunxi_xvideo *sxv = sunxi_xvideo_init(fPtr->sunxi_disp_private);
+			if (sxv) {
+				fPtr->XVideo_private = XVideo_Init(pScreen, &sxv->intf);
+				if (fPtr->XVideo_private) {
+					xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+					           "using sunxi disp layers for X video extension\n");
+				}
+				else {
+					xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+					           "failed to enable sunxi disp layers for X video extension\n");
+					sxv->intf.close(sxv);
+				}
+			}
+		}
+		if (!fPtr->XVideo_private && fPtr->RkFb_private) {
 			rk_xvideo * rkxv = rk_xvideo_init(fPtr->RkFb_private);
 			if (rkxv) {
 				fPtr->XVideo_private = XVideo_Init(pScreen, &rkxv->intf);
@@ -1094,7 +1235,19 @@ FBDevScreenInit(SCREEN_INIT_ARGS_DECL)
 			}
 		}
 	}
-	else {
+	if (!fPtr->XVideo_private) {
+		fb_xvideo *fbxv = fb_xvideo_init(pScreen, fPtr->sunxi_disp_private);
+		if (fbxv) {
+			fPtr->XVideo_private = XVideo_Init(pScreen, &fbxv->intf);
+			if (fPtr->XVideo_private)
+				xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+				           "using %s for X video extension\n",
+				           fbxv->disp ? "G2D scaling" : "CPU scaling");
+			else
+				fbxv->intf.close(fbxv);
+		}
+	}
+	if (!fPtr->XVideo_private) {
 	    XF86VideoAdaptorPtr *ptr;
 
 	    int n = xf86XVListGenericAdaptors(pScrn,&ptr);
@@ -1104,6 +1257,9 @@ FBDevScreenInit(SCREEN_INIT_ARGS_DECL)
 	}
 #endif
 
+	/* One vblank thread for the hardware cursor and DRI2 swaps */
+	fPtr->fb_vblank_private = fb_vblank_init(fbdevHWGetFD(pScrn));
+
 	if (fPtr->rotate == FBDEV_ROTATE_NONE &&
 	    !xf86ReturnOptValBool(fPtr->Options, OPTION_SW_CURSOR, FALSE) &&
 	     xf86ReturnOptValBool(fPtr->Options, OPTION_HW_CURSOR, TRUE)) {
@@ -1127,10 +1283,15 @@ FBDevScreenInit(SCREEN_INIT_ARGS_DECL)
 
 #ifdef HAVE_LIBUMP
 	if (xf86ReturnOptValBool(fPtr->Options, OPTION_DRI2, TRUE)) {
+	    int pool_size_mb = -1;
+	    xf86GetOptValInteger(fPtr->Options, OPTION_DRI2_BUFFER_POOL,
+	                         &pool_size_mb);
 
 	    fPtr->SunxiMaliDRI2_private = SunxiMaliDRI2_Init(pScreen,
 		xf86ReturnOptValBool(fPtr->Options, OPTION_DRI2_OVERLAY, TRUE),
-		xf86ReturnOptValBool(fPtr->Options, OPTION_SWAPBUFFERS_WAIT, TRUE));
+		xf86ReturnOptValBool(fPtr->Options, OPTION_SWAPBUFFERS_WAIT, TRUE),
+		xf86ReturnOptValBool(fPtr->Options, OPTION_DRI2_OVERLAY_UPSCALE, FALSE),
+		pool_size_mb);
 
 	    if (fPtr->SunxiMaliDRI2_private) {
 		xf86DrvMsg(pScrn->scrnIndex, X_INFO,
@@ -1167,6 +1328,12 @@ FBDevCloseScreen(CLOSE_SCREEN_ARGS_DECL)
 	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
 	FBDevPtr fPtr = FBDEVPTR(pScrn);
 
+	/* Runs the queued events, so it goes before their owners */
+	if (fPtr->fb_vblank_private) {
+	    fb_vblank_close(fPtr->fb_vblank_private);
+	    fPtr->fb_vblank_private = NULL;
+	}
+
 #ifdef HAVE_LIBUMP
 	if (fPtr->SunxiMaliDRI2_private) {
 	    SunxiMaliDRI2_Close(pScreen);
@@ -1181,6 +1348,12 @@ FBDevCloseScreen(CLOSE_SCREEN_ARGS_DECL)
 	    fPtr->SunxiDispHardwareCursor_private = NULL;
 	}
 
+	if (fPtr->RkDispHardwareCursor_private) {
+	    RkDispHardwareCursor_Close(fPtr->RkDispHardwareCursor_private);
+	    free(fPtr->RkDispHardwareCursor_private);
+	    fPtr->RkDispHardwareCursor_private = NULL;
+	}
+
 #if XV
 	if (fPtr->XVideo_private) {
 	    XVideo_Close(pScreen);
@@ -1202,6 +1375,19 @@ FBDevCloseScreen(CLOSE_SCREEN_ARGS_DECL)
 	    free(fPtr->SunxiG2D_private);
 	    fPtr->SunxiG2D_private = NULL;
 	}
+	if (fPtr->blt2d_chain_private) {
+	    blt2d_chain_t *chain = fPtr->blt2d_chain_private;
+	    int i;
+	    for (i = 0; i < chain->num_backends; i++)
+		xf86DrvMsgVerb(pScrn->scrnIndex, X_INFO, 3,
+		               "2D blit backend %s: %lu tried, %lu done\n",
+		               chain->backends[i].name, chain->backends[i].tried,
+		               chain->backends[i].done);
+	    xf86DrvMsgVerb(pScrn->scrnIndex, X_INFO, 3,
+	                   "2D blits left to pixman/fbBlt: %lu\n", chain->unhandled);
+	    blt2d_chain_close(chain);
+	    fPtr->blt2d_chain_private = NULL;
+	}
 	if (fPtr->fb_copyarea_private) {
 	    fb_copyarea_close(fPtr->fb_copyarea_private);
 	    fPtr->fb_copyarea_private = NULL;
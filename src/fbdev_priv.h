@@ -58,7 +58,9 @@ typedef struct {
 	void				*backing_store_tuner_private;
 	void				*sunxi_disp_private;
 	void				*fb_copyarea_private;
+	void				*blt2d_chain_private;
 	void				*rk_rga_private;
+	void				*fb_vblank_private;
 	void				*SunxiDispHardwareCursor_private;
 	void				*RkDispHardwareCursor_private;
 	void				*SunxiMaliDRI2_private;
@@ -69,12 +71,18 @@ typedef struct {
 
 #define FBDEVPTR(p) ((FBDevPtr)((p)->driverPrivate))
 
+#define CPU_BACKEND(p) ((cpu_backend_t *) \
+                       (FBDEVPTR(p)->cpu_backend_private))
+
 #define BACKING_STORE_TUNER(p) ((BackingStoreTuner *) \
                        (FBDEVPTR(p)->backing_store_tuner_private))
 
 #define SUNXI_DISP(p) ((sunxi_disp_t *) \
                        (FBDEVPTR(p)->sunxi_disp_private))
 
+#define FB_VBLANK(p) ((fb_vblank_t *) \
+                       (FBDEVPTR(p)->fb_vblank_private))
+
 #define SUNXI_G2D(p) ((SunxiG2D *) \
                        (FBDEVPTR(p)->SunxiG2D_private))
 
@@ -51,6 +51,8 @@ typedef struct {
 /* An interface for XVideo */
 #define XV_DOUBLEBUFFERING (1 << 0)
 
+struct pixman_box16; /* the same as BoxRec */
+
 typedef struct {
     void *self; /* This pointer gets passed back to the functions */
     uint32_t flags;
@@ -67,11 +69,35 @@ typedef struct {
     
     int (*set_colorkey)(void *self, uint32_t color);
     int (*disable_colorkey)(void *self);
+
+    /* optional, for the overlays shared with something else: called before
+       a new image is written to the framebuffer memory, non-zero means that
+       the overlay is busy. The claim is dropped by hide_window */
+    int (*claim)(void *self);
+
+    /* optional, if set, the backend may only record the changes done by
+       set_yuv420_input_buffer, set_input_par, set_output_window and
+       show_window, and apply all of them at once when this is called */
+    int (*commit)(void *self);
     
     /* optional, if NULL, memcpy is used to copy straight from the output
        buffer of the application */
     void (*copy_buffer)(void *self, void *dest, const void *src, size_t n, int image_format);
-    
+
+    /* optional, for the backends without a hardware overlay: if set, the
+       image is converted and scaled straight into the destination pixels
+       instead of being shown in a colorkeyed overlay window. The boxes are
+       in screen coordinates, the pixel for (x, y) is at (x + dst_x_offs,
+       y + dst_y_offs) in the destination. Stride is in uint32_t units. */
+    int (*render_frame)(void                      *self,
+                        uint32_t                  *dst_bits,
+                        int                        dst_stride,
+                        int                        dst_bpp,
+                        int                        dst_x_offs,
+                        int                        dst_y_offs,
+                        const struct pixman_box16 *boxes,
+                        int                        nboxes);
+
     int (*get_screen_width)(void *self);
     int (*get_screen_height)(void *self);
     char *(*get_fb_mem)(void *self);
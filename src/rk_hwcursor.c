@@ -49,6 +49,9 @@ static void RkShowCursor(ScrnInfoPtr pScrn)
     RkDispHardwareCursor * cursor = (RkDispHardwareCursor *)fPtr->RkDispHardwareCursor_private;
     int fb_fd = cursor->rkfb->fb_fd;
     
+    if (cursor->pos)
+        fb_cursor_pos_flush(cursor->pos);
+
     int enabled = 1;
     if (ioctl(fb_fd, FBIOPUT_SET_CURSOR_EN, (char *)&enabled)) {
     	ErrorF("RkShowCursor: ioctl failed\n");
@@ -67,10 +70,9 @@ static void RkHideCursor(ScrnInfoPtr pScrn)
     }
 }
 
-static void RkSetCursorPosition(ScrnInfoPtr pScrn, int x, int y)
+static int RkApplyCursorPosition(void *data, int x, int y)
 {
-    FBDevPtr fPtr = FBDEVPTR(pScrn);
-    RkDispHardwareCursor * cursor = (RkDispHardwareCursor *)fPtr->RkDispHardwareCursor_private;
+    RkDispHardwareCursor * cursor = (RkDispHardwareCursor *)data;
     int fb_fd = cursor->rkfb->fb_fd;
     
     struct fbcurpos pos;
@@ -78,7 +80,18 @@ static void RkSetCursorPosition(ScrnInfoPtr pScrn, int x, int y)
     if (y < 0) y = 0;
     pos.y = (uint16_t)(y & 0xFFFF);
     
-    if (ioctl(fb_fd, FBIOPUT_SET_CURSOR_POS, (char *)&pos)) {
+    return ioctl(fb_fd, FBIOPUT_SET_CURSOR_POS, (char *)&pos);
+}
+
+static void RkSetCursorPosition(ScrnInfoPtr pScrn, int x, int y)
+{
+    FBDevPtr fPtr = FBDEVPTR(pScrn);
+    RkDispHardwareCursor * cursor = (RkDispHardwareCursor *)fPtr->RkDispHardwareCursor_private;
+    
+    if (cursor->pos) {
+        fb_cursor_pos_set(cursor->pos, x, y);
+    }
+    else if (RkApplyCursorPosition(cursor, x, y)) {
     	ErrorF("RkSetCursorPosition: ioctl failed\n");
     }
 }
@@ -167,6 +180,20 @@ RkDispHardwareCursor *RkDispHardwareCursor_Init(rk_fb *rkfb)
 
 	private->rkfb = rkfb;
     private->hwcursor = InfoPtr;
+    private->pos = fb_cursor_pos_init(FB_VBLANK(xf86ScreenToScrn(rkfb->pScreen)),
+                                      RkApplyCursorPosition, private);
     return private;
 }
 
+void RkDispHardwareCursor_Close(RkDispHardwareCursor *cursor)
+{
+    if (cursor->pos) {
+        xf86DrvMsgVerb(cursor->rkfb->pScreen->myNum, X_INFO, 3,
+                       "RK hardware cursor: %lu moves, %lu position ioctls\n",
+                       cursor->pos->moves, cursor->pos->ioctls);
+        fb_cursor_pos_close(cursor->pos);
+        cursor->pos = NULL;
+    }
+    xf86DestroyCursorInfoRec(cursor->hwcursor);
+}
+
@@ -24,11 +24,15 @@
 #ifndef RK_HWCURSOR_H
 #define RK_HWCURSOR_H
 
+#include "fb_cursor_pos.h"
+
 typedef struct {
     rk_fb *rkfb;
     xf86CursorInfoPtr hwcursor;
+    fb_cursor_pos_t *pos; /* coalesces the cursor moves */
 } RkDispHardwareCursor;
 
 RkDispHardwareCursor *RkDispHardwareCursor_Init(rk_fb *rkfb);
+void RkDispHardwareCursor_Close(RkDispHardwareCursor *cursor);
 
 #endif
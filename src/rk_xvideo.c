@@ -44,45 +44,12 @@
 int rk_set_output_win(void *self, int drw_x, int drw_y, int drw_w, int drw_h) {
 	rk_xvideo *par = (rk_xvideo *)self;
 
-	struct fb_var_screeninfo fb1_conf;
-	int ovl = 0;
-	uint32_t addr[2];
-	
-	ioctl(par->rkfb->ovl_fd, FBIOGET_VSCREENINFO, &fb1_conf);
-	fb1_conf.xoffset = par->src_x; // image (buffer) x offset
-	fb1_conf.yoffset = par->src_y; // image (buffer) y offset
-	fb1_conf.xres = par->src_w; // actual (buffer) x width
-	fb1_conf.xres_virtual = par->src_stride;  // vir (stride)
-	fb1_conf.yres = par->src_h; // actual (buffer) height
-	fb1_conf.yres_virtual = par->src_h + par->src_y; // vir (stride) ?
-	
-	// DSP resolution, xsize << 8, ysize << 20, nonzero value overrides xres, yres
-	fb1_conf.grayscale = (drw_h << 20) | (drw_w << 8);
-	fb1_conf.activate = FB_ACTIVATE_FORCE;
-	// DSP offset, format in the lower 8 bits, xpos << 8, ypos << 20
-	fb1_conf.nonstd = HAL_PIXEL_FORMAT_YCrCb_NV12 | (drw_x << 8) | (drw_y << 20);
-	if (ioctl(par->rkfb->ovl_fd, FBIOPUT_VSCREENINFO, &fb1_conf)) {
-		xf86DrvMsg(par->rkfb->pScreen->myNum, X_INFO, "Failed to send PUT_VSCREENINFO\n");
-	}
-	
-	ovl = 1;
-	if (ioctl(par->rkfb->ovl_fd, RK_FBIOSET_OVERLAY_STATE, &ovl)) {
-		xf86DrvMsg(par->rkfb->pScreen->myNum, X_INFO, "Failed to set RK_FBIOSET_OVERLAY_STATE\n");
-		return -1;
-	}
-	
-	ovl = 0;
-	if (ioctl(par->rkfb->ovl_fd, RK_FBIOSET_CONFIG_DONE, &ovl)) {
-		xf86DrvMsg(par->rkfb->pScreen->myNum, X_INFO, "Failed to send SET_CONFIG_DONE\n");
-		return -1;
-	}
-	
-	ovl = 1;
-	if (ioctl(par->rkfb->ovl_fd, RK_FBIOSET_ENABLE, &ovl)) {
-		xf86DrvMsg(par->rkfb->pScreen->myNum, X_INFO, "FBIOSET_ENABLE\n");
-		return -1;
-	}
-	
+	par->drw_x = drw_x;
+	par->drw_y = drw_y;
+	par->drw_w = drw_w;
+	par->drw_h = drw_h;
+	par->dirty |= RK_XV_DIRTY_VAR;
+
 	return 0;
 }
 
@@ -94,6 +61,7 @@ int rk_set_input_par(void *self, int src_w, int src_h, int stride, int src_x, in
 	par->src_w = src_w;
 	par->src_h = src_h;
 	par->src_stride = stride;
+	par->dirty |= RK_XV_DIRTY_VAR;
 	
 	return 0;
 }
@@ -102,20 +70,86 @@ int rk_set_input_buf(void      *self,
                      uint32_t  y_off,
                      uint32_t  u_off,
                      uint32_t  v_off) {
-	uint32_t addr[2];
-                      
 	rk_xvideo *par = (rk_xvideo *)self;
 	
-	addr[0] = par->rkfb->fb_phy_addr + y_off;
-	addr[1] = par->rkfb->fb_phy_addr + min(v_off, u_off);
-	if (ioctl(par->rkfb->ovl_fd, RK_FBIOSET_YUV_ADDR, addr)) {
-		xf86DrvMsg(par->rkfb->pScreen->myNum, X_INFO, "Failed to set win1 addr\n");
-		return -1;
-	}
+	par->addr[0] = par->rkfb->fb_phy_addr + y_off;
+	par->addr[1] = par->rkfb->fb_phy_addr + min(v_off, u_off);
+	par->dirty |= RK_XV_DIRTY_ADDR;
 	
 	return 0;
 }
 
+/*
+ * Send the pending changes to the LCDC, followed by a single CONFIG_DONE,
+ * so that a new frame in the steady state costs just an address update
+ */
+int rk_commit(void *self) {
+	rk_xvideo *par = (rk_xvideo *)self;
+	struct fb_var_screeninfo *var = &par->var;
+	int ovl, ret = 0;
+
+	if (!par->dirty) {
+		return 0;
+	}
+
+	if (par->dirty & RK_XV_DIRTY_ADDR) {
+		if (ioctl(par->rkfb->ovl_fd, RK_FBIOSET_YUV_ADDR, par->addr)) {
+			xf86DrvMsg(par->rkfb->pScreen->myNum, X_INFO, "Failed to set win1 addr\n");
+			ret = -1;
+		}
+	}
+
+	if (par->dirty & RK_XV_DIRTY_VAR) {
+		if (!par->var_valid) {
+			if (ioctl(par->rkfb->ovl_fd, FBIOGET_VSCREENINFO, var) == 0) {
+				par->var_valid = TRUE;
+			}
+		}
+
+		var->xoffset = par->src_x; // image (buffer) x offset
+		var->yoffset = par->src_y; // image (buffer) y offset
+		var->xres = par->src_w; // actual (buffer) x width
+		var->xres_virtual = par->src_stride;  // vir (stride)
+		var->yres = par->src_h; // actual (buffer) height
+		var->yres_virtual = par->src_h + par->src_y; // vir (stride) ?
+
+		// DSP resolution, xsize << 8, ysize << 20, nonzero value overrides xres, yres
+		var->grayscale = (par->drw_h << 20) | (par->drw_w << 8);
+		var->activate = FB_ACTIVATE_FORCE;
+		// DSP offset, format in the lower 8 bits, xpos << 8, ypos << 20
+		var->nonstd = HAL_PIXEL_FORMAT_YCrCb_NV12 | (par->drw_x << 8) | (par->drw_y << 20);
+		if (ioctl(par->rkfb->ovl_fd, FBIOPUT_VSCREENINFO, var)) {
+			xf86DrvMsg(par->rkfb->pScreen->myNum, X_INFO, "Failed to send PUT_VSCREENINFO\n");
+			ret = -1;
+		}
+	}
+
+	if (par->dirty & RK_XV_DIRTY_ENABLE) {
+		ovl = 1;
+		if (ioctl(par->rkfb->ovl_fd, RK_FBIOSET_OVERLAY_STATE, &ovl)) {
+			xf86DrvMsg(par->rkfb->pScreen->myNum, X_INFO, "Failed to set RK_FBIOSET_OVERLAY_STATE\n");
+			ret = -1;
+		}
+	}
+
+	ovl = 0;
+	if (ioctl(par->rkfb->ovl_fd, RK_FBIOSET_CONFIG_DONE, &ovl)) {
+		xf86DrvMsg(par->rkfb->pScreen->myNum, X_INFO, "Failed to send SET_CONFIG_DONE\n");
+		ret = -1;
+	}
+
+	if (par->dirty & RK_XV_DIRTY_ENABLE) {
+		ovl = 1;
+		if (ioctl(par->rkfb->ovl_fd, RK_FBIOSET_ENABLE, &ovl)) {
+			xf86DrvMsg(par->rkfb->pScreen->myNum, X_INFO, "FBIOSET_ENABLE\n");
+			ret = -1;
+		}
+	}
+
+	par->dirty = 0;
+	return ret;
+}
+
 int rk_hide_window(void *self) {
 	rk_xvideo *par = (rk_xvideo *)self;
 
@@ -128,6 +162,8 @@ int rk_hide_window(void *self) {
 		xf86DrvMsg(par->rkfb->pScreen->myNum, X_INFO, "FBIOSET_ENABLE\n");
 	}
 	par->enabled = FALSE;
+	par->dirty &= ~RK_XV_DIRTY_ENABLE;
+	return 0;
 }
 
 int rk_show_window(void *self) {
@@ -137,11 +173,9 @@ int rk_show_window(void *self) {
 		return 0;
 	}
 
-	int enabled = 1;
-	if (ioctl(par->rkfb->ovl_fd, RK_FBIOSET_ENABLE, &enabled)) {
-		xf86DrvMsg(par->rkfb->pScreen->myNum, X_INFO, "FBIOSET_ENABLE\n");
-	}
+	par->dirty |= RK_XV_DIRTY_ENABLE;
 	par->enabled = TRUE;
+	return 0;
 }
 
 int rk_set_colorkey(void *self, uint32_t colorkey) {
@@ -229,6 +263,7 @@ rk_xvideo *rk_xvideo_init(rk_fb *rkfb) {
 	self->intf.hide_window = rk_hide_window;
 	self->intf.set_colorkey = rk_set_colorkey;
 	self->intf.disable_colorkey = rk_disable_colorkey;
+	self->intf.commit = rk_commit;
 	self->intf.copy_buffer = rk_copy_buf;
 	self->intf.get_fb_mem = rk_get_fb_mem;
 	self->intf.get_visible_fb_size = rk_get_visible_fb_size;
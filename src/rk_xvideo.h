@@ -30,12 +30,30 @@
 #include "interfaces.h"
 #include "rk_fb.h"
 
+/* The parts of the overlay configuration waiting for commit */
+#define RK_XV_DIRTY_ADDR	(1 << 0)
+#define RK_XV_DIRTY_VAR		(1 << 1)
+#define RK_XV_DIRTY_ENABLE	(1 << 2)
+
 typedef struct {
 	int src_stride;
 	int src_w;
 	int src_h;
 	int src_x;
 	int src_y;
+
+	int drw_x;
+	int drw_y;
+	int drw_w;
+	int drw_h;
+
+	uint32_t addr[2];
+
+	/* fetched once, then only the changed fields are updated */
+	struct fb_var_screeninfo var;
+	Bool var_valid;
+
+	uint32_t dirty;
 	
 	Bool enabled;
 	
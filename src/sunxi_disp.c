@@ -42,7 +42,7 @@ sunxi_disp_t *sunxi_disp_init(const char *device, void *xserver_fbmem)
     struct fb_var_screeninfo fb_var;
     struct fb_fix_screeninfo fb_fix;
 
-    int tmp, version;
+    int tmp, version, i;
     int gfx_layer_size;
     int ovl_layer_size;
 
@@ -106,6 +106,7 @@ sunxi_disp_t *sunxi_disp_init(const char *device, void *xserver_fbmem)
     ctx->framebuffer_height = ctx->framebuffer_size /
                               (ctx->xres * ctx->bits_per_pixel / 8);
     ctx->gfx_layer_size = ctx->xres * ctx->yres * fb_var.bits_per_pixel / 8;
+    ctx->offscreen_end = ctx->framebuffer_size;
 
     if (ctx->framebuffer_size < ctx->gfx_layer_size) {
         close(ctx->fd_fb);
@@ -146,6 +147,9 @@ sunxi_disp_t *sunxi_disp_init(const char *device, void *xserver_fbmem)
         return NULL;
     }
 
+    for (i = 0; i < SUNXI_DISP_MAX_SPARE_LAYERS; i++)
+        ctx->spare_layer_id[i] = -1;
+
     if (sunxi_layer_reserve(ctx) < 0)
     {
         close(ctx->fd_fb);
@@ -164,11 +168,14 @@ sunxi_disp_t *sunxi_disp_init(const char *device, void *xserver_fbmem)
 
 int sunxi_disp_close(sunxi_disp_t *ctx)
 {
+    int i;
     if (ctx->fd_disp >= 0) {
         if (ctx->fd_g2d >= 0) {
             close(ctx->fd_g2d);
         }
-        /* release layer */
+        /* release layers */
+        for (i = 0; i < SUNXI_DISP_MAX_SPARE_LAYERS; i++)
+            sunxi_spare_layer_free(ctx, ctx->spare_layer_id[i]);
         sunxi_layer_release(ctx);
         /* disable cursor */
         if (ctx->cursor_enabled)
@@ -184,6 +191,17 @@ int sunxi_disp_close(sunxi_disp_t *ctx)
     return 0;
 }
 
+uint32_t sunxi_disp_reserve_offscreen(sunxi_disp_t *ctx, uint32_t size)
+{
+    /* Keep the start of the area aligned to a page */
+    size = (size + 4095) & ~4095;
+    if (ctx->offscreen_end < size ||
+        ctx->offscreen_end - size < ((ctx->gfx_layer_size + 4095) & ~4095))
+        return 0;
+    ctx->offscreen_end -= size;
+    return ctx->offscreen_end;
+}
+
 /*****************************************************************************
  * Support for hardware cursor, which has 64x64 size, 2 bits per pixel,      *
  * four 32-bit ARGB entries in the palette.                                  *
@@ -288,26 +306,24 @@ static int sunxi_layer_change_work_mode(sunxi_disp_t *ctx, int new_mode)
     return ioctl(ctx->fd_disp, DISP_CMD_LAYER_SET_PARA, tmp);
 }
 
-int sunxi_layer_reserve(sunxi_disp_t *ctx)
+/* Request a new layer from the kernel and give it a reasonable configuration */
+static int sunxi_layer_request(sunxi_disp_t *ctx)
 {
     __disp_layer_info_t layer_info;
     uint32_t tmp[4];
-
-    /* try to allocate a layer */
+    int layer_id;
 
     tmp[0] = ctx->fb_id;
     tmp[1] = DISP_LAYER_WORK_MODE_NORMAL;
-    ctx->layer_id = ioctl(ctx->fd_disp, DISP_CMD_LAYER_REQUEST, &tmp);
-    if (ctx->layer_id < 0)
+    layer_id = ioctl(ctx->fd_disp, DISP_CMD_LAYER_REQUEST, &tmp);
+    if (layer_id < 0)
         return -1;
 
-    /* Initially set the layer configuration to something reasonable */
-
     tmp[0] = ctx->fb_id;
-    tmp[1] = ctx->layer_id;
+    tmp[1] = layer_id;
     tmp[2] = (uintptr_t)&layer_info;
     if (ioctl(ctx->fd_disp, DISP_CMD_LAYER_GET_PARA, tmp) < 0)
-        return -1;
+        goto fail;
 
     /* the screen and overlay layers need to be in different pipes */
     layer_info.pipe      = 1;
@@ -322,9 +338,25 @@ int sunxi_layer_reserve(sunxi_disp_t *ctx)
     layer_info.fb.mode = DISP_MOD_INTERLEAVED;
 
     tmp[0] = ctx->fb_id;
-    tmp[1] = ctx->layer_id;
+    tmp[1] = layer_id;
     tmp[2] = (uintptr_t)&layer_info;
     if (ioctl(ctx->fd_disp, DISP_CMD_LAYER_SET_PARA, tmp) < 0)
+        goto fail;
+
+    return layer_id;
+
+fail:
+    tmp[0] = ctx->fb_id;
+    tmp[1] = layer_id;
+    ioctl(ctx->fd_disp, DISP_CMD_LAYER_RELEASE, &tmp);
+    return -1;
+}
+
+int sunxi_layer_reserve(sunxi_disp_t *ctx)
+{
+    /* try to allocate a layer */
+    ctx->layer_id = sunxi_layer_request(ctx);
+    if (ctx->layer_id < 0)
         return -1;
 
     /* Now probe the scaler mode to see if there is a free scaler available */
@@ -357,43 +389,63 @@ int sunxi_layer_release(sunxi_disp_t *ctx)
     return 0;
 }
 
-int sunxi_layer_set_rgb_input_buffer(sunxi_disp_t *ctx,
-                                     int           bpp,
-                                     uint32_t      offset_in_framebuffer,
-                                     int           width,
-                                     int           height,
-                                     int           stride)
+/* Fill the buffer description for a 16bpp or 32bpp RGB layer */
+static int sunxi_layer_setup_rgb_fb(__disp_fb_t *fb,
+                                    int          bpp,
+                                    uintptr_t    paddr,
+                                    int          height,
+                                    int          stride)
+{
+    fb->addr[0] = paddr;
+    fb->size.height = height;
+    if (bpp == 32) {
+        fb->format = DISP_FORMAT_ARGB8888;
+        fb->seq = DISP_SEQ_ARGB;
+        fb->mode = DISP_MOD_INTERLEAVED;
+        fb->size.width = stride;
+    } else if (bpp == 16) {
+        fb->format = DISP_FORMAT_RGB565;
+        fb->seq = DISP_SEQ_P10;
+        fb->mode = DISP_MOD_INTERLEAVED;
+        fb->size.width = stride * 2;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int sunxi_layer_set_rgb_input_buffer_mode(sunxi_disp_t *ctx,
+                                                int           bpp,
+                                                uint32_t      offset_in_framebuffer,
+                                                int           width,
+                                                int           height,
+                                                int           stride,
+                                                int           scaled)
 {
     __disp_fb_t fb;
     __disp_rect_t rect = { 0, 0, width, height };
     uint32_t tmp[4];
     memset(&fb, 0, sizeof(fb));
 
-    if (ctx->layer_id < 0)
+    if (ctx->layer_id < 0 || (scaled && !ctx->layer_has_scaler))
         return -1;
 
-    if (ctx->layer_scaler_is_enabled) {
+    if (ctx->layer_scaler_is_enabled && !scaled) {
         if (sunxi_layer_change_work_mode(ctx, DISP_LAYER_WORK_MODE_NORMAL) == 0)
             ctx->layer_scaler_is_enabled = 0;
         else
             return -1;
     }
+    else if (!ctx->layer_scaler_is_enabled && scaled) {
+        if (sunxi_layer_change_work_mode(ctx, DISP_LAYER_WORK_MODE_SCALER) == 0)
+            ctx->layer_scaler_is_enabled = 1;
+        else
+            return -1;
+    }
 
-    fb.addr[0] = ctx->framebuffer_paddr + offset_in_framebuffer;
-    fb.size.height = height;
-    if (bpp == 32) {
-        fb.format = DISP_FORMAT_ARGB8888;
-        fb.seq = DISP_SEQ_ARGB;
-        fb.mode = DISP_MOD_INTERLEAVED;
-        fb.size.width = stride;
-    } else if (bpp == 16) {
-        fb.format = DISP_FORMAT_RGB565;
-        fb.seq = DISP_SEQ_P10;
-        fb.mode = DISP_MOD_INTERLEAVED;
-        fb.size.width = stride * 2;
-    } else {
+    if (sunxi_layer_setup_rgb_fb(&fb, bpp, ctx->framebuffer_paddr +
+                                 offset_in_framebuffer, height, stride) < 0)
         return -1;
-    }
 
     tmp[0] = ctx->fb_id;
     tmp[1] = ctx->layer_id;
@@ -406,6 +458,7 @@ int sunxi_layer_set_rgb_input_buffer(sunxi_disp_t *ctx,
     ctx->layer_buf_w = rect.width;
     ctx->layer_buf_h = rect.height;
     ctx->layer_format = fb.format;
+    ctx->layer_rgb_is_scaled = scaled;
 
     tmp[0] = ctx->fb_id;
     tmp[1] = ctx->layer_id;
@@ -413,6 +466,28 @@ int sunxi_layer_set_rgb_input_buffer(sunxi_disp_t *ctx,
     return ioctl(ctx->fd_disp, DISP_CMD_LAYER_SET_SRC_WINDOW, &tmp);
 }
 
+int sunxi_layer_set_rgb_input_buffer(sunxi_disp_t *ctx,
+                                     int           bpp,
+                                     uint32_t      offset_in_framebuffer,
+                                     int           width,
+                                     int           height,
+                                     int           stride)
+{
+    return sunxi_layer_set_rgb_input_buffer_mode(ctx, bpp, offset_in_framebuffer,
+                                                 width, height, stride, 0);
+}
+
+int sunxi_layer_set_scaled_rgb_input_buffer(sunxi_disp_t *ctx,
+                                            int           bpp,
+                                            uint32_t      offset_in_framebuffer,
+                                            int           width,
+                                            int           height,
+                                            int           stride)
+{
+    return sunxi_layer_set_rgb_input_buffer_mode(ctx, bpp, offset_in_framebuffer,
+                                                 width, height, stride, 1);
+}
+
 int sunxi_layer_set_yuv420_input_buffer(sunxi_disp_t *ctx,
                                         uint32_t      y_offset_in_framebuffer,
                                         uint32_t      u_offset_in_framebuffer,
@@ -426,11 +501,24 @@ int sunxi_layer_set_yuv420_input_buffer(sunxi_disp_t *ctx,
     __disp_fb_t fb;
     __disp_rect_t rect = { x_pixel_offset, y_pixel_offset, width, height };
     uint32_t tmp[4];
+    int same_src_window;
     memset(&fb, 0, sizeof(fb));
 
     if (ctx->layer_id < 0)
         return -1;
 
+    /*
+     * Typically only the buffer address changes from one video frame to
+     * another, in which case the source window does not need an update.
+     * This also keeps the source window adjustments, which may have been
+     * done by sunxi_layer_set_output_window.
+     */
+    same_src_window = ctx->layer_scaler_is_enabled &&
+                      ctx->layer_format == DISP_FORMAT_YUV420 &&
+                      ctx->layer_buf_x == rect.x && ctx->layer_buf_y == rect.y &&
+                      ctx->layer_buf_w == rect.width &&
+                      ctx->layer_buf_h == rect.height;
+
     if (!ctx->layer_scaler_is_enabled) {
         if (sunxi_layer_change_work_mode(ctx, DISP_LAYER_WORK_MODE_SCALER) == 0)
             ctx->layer_scaler_is_enabled = 1;
@@ -458,6 +546,10 @@ int sunxi_layer_set_yuv420_input_buffer(sunxi_disp_t *ctx,
     ctx->layer_buf_w = rect.width;
     ctx->layer_buf_h = rect.height;
     ctx->layer_format = fb.format;
+    ctx->layer_rgb_is_scaled = 0;
+
+    if (same_src_window)
+        return 0;
 
     tmp[0] = ctx->fb_id;
     tmp[1] = ctx->layer_id;
@@ -538,8 +630,9 @@ int sunxi_layer_show(sunxi_disp_t *ctx)
     if (ctx->layer_id < 0)
         return -1;
 
-    /* YUV formats need to use a scaler */
-    if (ctx->layer_format == DISP_FORMAT_YUV420 && !ctx->layer_scaler_is_enabled) {
+    /* YUV formats and scaled RGB need to use a scaler */
+    if ((ctx->layer_format == DISP_FORMAT_YUV420 || ctx->layer_rgb_is_scaled) &&
+                                              !ctx->layer_scaler_is_enabled) {
         if (sunxi_layer_change_work_mode(ctx, DISP_LAYER_WORK_MODE_SCALER) == 0)
             ctx->layer_scaler_is_enabled = 1;
     }
@@ -568,6 +661,23 @@ int sunxi_layer_hide(sunxi_disp_t *ctx)
     return ioctl(ctx->fd_disp, DISP_CMD_LAYER_CLOSE, &tmp);
 }
 
+int sunxi_layer_claim(sunxi_disp_t *ctx, void *owner)
+{
+    if (ctx->layer_id < 0)
+        return -1;
+    if (ctx->layer_owner && ctx->layer_owner != owner)
+        return -1;
+
+    ctx->layer_owner = owner;
+    return 0;
+}
+
+void sunxi_layer_unclaim(sunxi_disp_t *ctx, void *owner)
+{
+    if (ctx->layer_owner == owner)
+        ctx->layer_owner = NULL;
+}
+
 int sunxi_layer_set_colorkey(sunxi_disp_t *ctx, uint32_t color)
 {
     uint32_t tmp[4];
@@ -645,6 +755,126 @@ int sunxi_layer_disable_colorkey(sunxi_disp_t *ctx)
     return 0;
 }
 
+/*****************************************************************************
+ * Spare RGB layers, scanning out from arbitrary physical addresses          *
+ *****************************************************************************/
+
+static int sunxi_spare_layer_index(sunxi_disp_t *ctx, int layer_id)
+{
+    int i;
+    if (layer_id < 0)
+        return -1;
+    for (i = 0; i < SUNXI_DISP_MAX_SPARE_LAYERS; i++) {
+        if (ctx->spare_layer_id[i] == layer_id)
+            return i;
+    }
+    return -1;
+}
+
+int sunxi_spare_layer_alloc(sunxi_disp_t *ctx)
+{
+    int i;
+
+    for (i = 0; i < SUNXI_DISP_MAX_SPARE_LAYERS; i++) {
+        if (ctx->spare_layer_id[i] < 0)
+            break;
+    }
+    if (i == SUNXI_DISP_MAX_SPARE_LAYERS)
+        return -1;
+
+    /* Fails if the display engine has no free layers left */
+    ctx->spare_layer_id[i] = sunxi_layer_request(ctx);
+    return ctx->spare_layer_id[i];
+}
+
+int sunxi_spare_layer_free(sunxi_disp_t *ctx, int layer_id)
+{
+    uint32_t tmp[4];
+    int i = sunxi_spare_layer_index(ctx, layer_id);
+
+    if (i < 0)
+        return -1;
+
+    tmp[0] = ctx->fb_id;
+    tmp[1] = layer_id;
+    ioctl(ctx->fd_disp, DISP_CMD_LAYER_CLOSE, &tmp);
+    ioctl(ctx->fd_disp, DISP_CMD_LAYER_RELEASE, &tmp);
+
+    ctx->spare_layer_id[i] = -1;
+    return 0;
+}
+
+int sunxi_spare_layer_set_rgb_input_buffer(sunxi_disp_t *ctx,
+                                           int           layer_id,
+                                           int           bpp,
+                                           uintptr_t     paddr,
+                                           int           width,
+                                           int           height,
+                                           int           stride)
+{
+    __disp_fb_t fb;
+    __disp_rect_t rect = { 0, 0, width, height };
+    uint32_t tmp[4];
+    memset(&fb, 0, sizeof(fb));
+
+    if (sunxi_spare_layer_index(ctx, layer_id) < 0 || !paddr)
+        return -1;
+
+    if (sunxi_layer_setup_rgb_fb(&fb, bpp, paddr, height, stride) < 0)
+        return -1;
+
+    tmp[0] = ctx->fb_id;
+    tmp[1] = layer_id;
+    tmp[2] = (uintptr_t)&fb;
+    if (ioctl(ctx->fd_disp, DISP_CMD_LAYER_SET_FB, &tmp) < 0)
+        return -1;
+
+    tmp[0] = ctx->fb_id;
+    tmp[1] = layer_id;
+    tmp[2] = (uintptr_t)&rect;
+    return ioctl(ctx->fd_disp, DISP_CMD_LAYER_SET_SRC_WINDOW, &tmp);
+}
+
+int sunxi_spare_layer_set_output_window(sunxi_disp_t *ctx, int layer_id,
+                                        int x, int y, int w, int h)
+{
+    __disp_rect_t win_rect = { x, y, w, h };
+    uint32_t tmp[4];
+
+    /* RGB layers are not affected by the negative Y coordinates bug */
+    if (sunxi_spare_layer_index(ctx, layer_id) < 0 || w <= 0 || h <= 0)
+        return -1;
+
+    tmp[0] = ctx->fb_id;
+    tmp[1] = layer_id;
+    tmp[2] = (uintptr_t)&win_rect;
+    return ioctl(ctx->fd_disp, DISP_CMD_LAYER_SET_SCN_WINDOW, &tmp);
+}
+
+int sunxi_spare_layer_show(sunxi_disp_t *ctx, int layer_id)
+{
+    uint32_t tmp[4];
+
+    if (sunxi_spare_layer_index(ctx, layer_id) < 0)
+        return -1;
+
+    tmp[0] = ctx->fb_id;
+    tmp[1] = layer_id;
+    return ioctl(ctx->fd_disp, DISP_CMD_LAYER_OPEN, &tmp);
+}
+
+int sunxi_spare_layer_hide(sunxi_disp_t *ctx, int layer_id)
+{
+    uint32_t tmp[4];
+
+    if (sunxi_spare_layer_index(ctx, layer_id) < 0)
+        return -1;
+
+    tmp[0] = ctx->fb_id;
+    tmp[1] = layer_id;
+    return ioctl(ctx->fd_disp, DISP_CMD_LAYER_CLOSE, &tmp);
+}
+
 /*****************************************************************************/
 
 int sunxi_wait_for_vsync(sunxi_disp_t *ctx)
@@ -654,6 +884,22 @@ int sunxi_wait_for_vsync(sunxi_disp_t *ctx)
 
 /*****************************************************************************/
 
+int sunxi_disp_start_cmd_cache(sunxi_disp_t *ctx)
+{
+    uint32_t tmp[4];
+    tmp[0] = ctx->fb_id;
+    return ioctl(ctx->fd_disp, DISP_CMD_START_CMD_CACHE, &tmp);
+}
+
+int sunxi_disp_execute_cmd_cache(sunxi_disp_t *ctx)
+{
+    uint32_t tmp[4];
+    tmp[0] = ctx->fb_id;
+    return ioctl(ctx->fd_disp, DISP_CMD_EXECUTE_CMD_AND_STOP_CACHE, &tmp);
+}
+
+/*****************************************************************************/
+
 int sunxi_g2d_fill_a8r8g8b8(sunxi_disp_t *disp,
                             int           x,
                             int           y,
@@ -724,6 +970,63 @@ int sunxi_g2d_blit_a8r8g8b8(sunxi_disp_t *disp,
     return ioctl(disp->fd_g2d, G2D_CMD_BITBLT, &tmp);
 }
 
+int sunxi_g2d_stretch_nv12(sunxi_disp_t *disp,
+                           uint32_t      y_offset_in_framebuffer,
+                           uint32_t      uv_offset_in_framebuffer,
+                           int           src_stride,
+                           int           src_height,
+                           int           src_x,
+                           int           src_y,
+                           int           src_w,
+                           int           src_h,
+                           int           dst_x,
+                           int           dst_y,
+                           int           dst_w,
+                           int           dst_h)
+{
+    g2d_stretchblt tmp;
+
+    if (disp->fd_g2d < 0)
+        return -1;
+
+    if (disp->bits_per_pixel != 16 && disp->bits_per_pixel != 32)
+        return -1;
+
+    if (src_w <= 0 || src_h <= 0 || dst_w <= 0 || dst_h <= 0)
+        return 0;
+
+    tmp.flag                = G2D_BLT_NONE;
+    tmp.src_image.addr[0]   = disp->framebuffer_paddr + y_offset_in_framebuffer;
+    tmp.src_image.addr[1]   = disp->framebuffer_paddr + uv_offset_in_framebuffer;
+    tmp.src_image.addr[2]   = 0;
+    tmp.src_image.w         = src_stride;
+    tmp.src_image.h         = src_height;
+    tmp.src_image.format    = G2D_FMT_PYUV420UVC;
+    tmp.src_image.pixel_seq = G2D_SEQ_NORMAL;
+    tmp.src_rect.x          = src_x;
+    tmp.src_rect.y          = src_y;
+    tmp.src_rect.w          = src_w;
+    tmp.src_rect.h          = src_h;
+    tmp.dst_image.addr[0]   = disp->framebuffer_paddr;
+    tmp.dst_image.w         = disp->xres;
+    tmp.dst_image.h         = disp->framebuffer_height;
+    if (disp->bits_per_pixel == 16) {
+        tmp.dst_image.format    = G2D_FMT_RGB565;
+        tmp.dst_image.pixel_seq = G2D_SEQ_P10;
+    } else {
+        tmp.dst_image.format    = G2D_FMT_XRGB8888;
+        tmp.dst_image.pixel_seq = G2D_SEQ_NORMAL;
+    }
+    tmp.dst_rect.x          = dst_x;
+    tmp.dst_rect.y          = dst_y;
+    tmp.dst_rect.w          = dst_w;
+    tmp.dst_rect.h          = dst_h;
+    tmp.color               = 0;
+    tmp.alpha               = 0;
+
+    return ioctl(disp->fd_g2d, G2D_CMD_STRETCHBLT, &tmp);
+}
+
 /*
  * The following function implements a 16bpp blit using 32bpp mode by
  * splitting the area into an aligned middle part (which is blit using
@@ -868,7 +1171,6 @@ int sunxi_g2d_blt(void               *self,
 {
     sunxi_disp_t *disp = (sunxi_disp_t *)self;
     int blt_size_threshold;
-    g2d_blt tmp;
 
     /* Zero size blit, nothing to do */
     if (w <= 0 || h <= 0)
@@ -920,9 +1222,40 @@ int sunxi_g2d_blt(void               *self,
     if ((src_bpp != 16 && src_bpp != 32) || (dst_bpp != 16 && dst_bpp != 32))
         return FALLBACK_BLT();
 
+    return sunxi_g2d_blt_phys(disp,
+                  disp->framebuffer_paddr + ((uint8_t *)src_bits - disp->framebuffer_addr),
+                  disp->framebuffer_paddr + ((uint8_t *)dst_bits - disp->framebuffer_addr),
+                  src_stride, dst_stride, src_bpp, dst_bpp,
+                  src_x, src_y, dst_x, dst_y, w, h);
+}
+
+int sunxi_g2d_blt_phys(sunxi_disp_t       *disp,
+                       uintptr_t           src_paddr,
+                       uintptr_t           dst_paddr,
+                       int                 src_stride,
+                       int                 dst_stride,
+                       int                 src_bpp,
+                       int                 dst_bpp,
+                       int                 src_x,
+                       int                 src_y,
+                       int                 dst_x,
+                       int                 dst_y,
+                       int                 w,
+                       int                 h)
+{
+    g2d_blt tmp;
+
+    if (w <= 0 || h <= 0)
+        return 1;
+
+    if (disp->fd_g2d < 0)
+        return 0;
+
+    if ((src_bpp != 16 && src_bpp != 32) || (dst_bpp != 16 && dst_bpp != 32))
+        return 0;
+
     tmp.flag                    = G2D_BLT_NONE;
-    tmp.src_image.addr[0]       = disp->framebuffer_paddr +
-                                  ((uint8_t *)src_bits - disp->framebuffer_addr);
+    tmp.src_image.addr[0]       = src_paddr;
     tmp.src_rect.x              = src_x;
     tmp.src_rect.y              = src_y;
     tmp.src_rect.w              = w;
@@ -939,8 +1272,7 @@ int sunxi_g2d_blt(void               *self,
         tmp.src_image.pixel_seq = G2D_SEQ_P10;
     }
 
-    tmp.dst_image.addr[0]       = disp->framebuffer_paddr +
-                                  ((uint8_t *)dst_bits - disp->framebuffer_addr);
+    tmp.dst_image.addr[0]       = dst_paddr;
     tmp.dst_x                   = dst_x;
     tmp.dst_y                   = dst_y;
     tmp.color                   = 0;
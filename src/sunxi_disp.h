@@ -28,6 +28,9 @@
 
 #include "interfaces.h"
 
+/* The display engine has four layers, one of them is the screen itself */
+#define SUNXI_DISP_MAX_SPARE_LAYERS 3
+
 /*
  * Support for Allwinner A10 display controller features such as layers
  * and hardware cursor
@@ -44,6 +47,7 @@ typedef struct {
     uint32_t            framebuffer_size;  /* total size of the framebuffer */
     int                 framebuffer_height;/* virtual vertical resolution */
     uint32_t            gfx_layer_size;    /* the size of the primary layer */
+    uint32_t            offscreen_end;     /* the rest is reserved by the driver */
 
     uint8_t            *xserver_fbmem; /* framebuffer mapping done by xserver */
 
@@ -60,6 +64,11 @@ typedef struct {
     int                 layer_win_x, layer_win_y;
     int                 layer_scaler_is_enabled;
     int                 layer_format;
+    int                 layer_rgb_is_scaled;
+    void               *layer_owner;       /* XV or DRI2, see sunxi_layer_claim */
+
+    /* Spare RGB layers handed out by sunxi_spare_layer_alloc (-1 if free) */
+    int                 spare_layer_id[SUNXI_DISP_MAX_SPARE_LAYERS];
 
     /* G2D accelerated implementation of blt2d_i interface */
     blt2d_i             blt2d;
@@ -70,6 +79,15 @@ typedef struct {
 sunxi_disp_t *sunxi_disp_init(const char *fb_device, void *xserver_fbmem);
 int sunxi_disp_close(sunxi_disp_t *ctx);
 
+/*
+ * Take 'size' bytes from the end of the offscreen part of framebuffer for
+ * the driver's own use, so that XV and DRI2 don't touch them anymore (they
+ * only use the memory between gfx_layer_size and offscreen_end). Needs to
+ * be done before they are initialized. Returns the offset of the reserved
+ * area in framebuffer or 0 on failure.
+ */
+uint32_t sunxi_disp_reserve_offscreen(sunxi_disp_t *ctx, uint32_t size);
+
 /*
  * Support for hardware cursor, which has 64x64 size, 2 bits per pixel,
  * four 32-bit ARGB entries in the palette.
@@ -98,6 +116,17 @@ int sunxi_layer_set_rgb_input_buffer(sunxi_disp_t  *ctx,
                                      int            height,
                                      int            stride);
 
+/*
+ * The same, but the layer is kept in the scaler mode, so the buffer gets
+ * scaled to the size of the output window. Needs layer_has_scaler.
+ */
+int sunxi_layer_set_scaled_rgb_input_buffer(sunxi_disp_t  *ctx,
+                                            int            bpp,
+                                            uint32_t       offset_in_framebuffer,
+                                            int            width,
+                                            int            height,
+                                            int            stride);
+
 int sunxi_layer_set_yuv420_input_buffer(sunxi_disp_t *ctx,
                                         uint32_t      y_offset_in_framebuffer,
                                         uint32_t      u_offset_in_framebuffer,
@@ -116,11 +145,52 @@ int sunxi_layer_disable_colorkey(sunxi_disp_t *ctx);
 int sunxi_layer_show(sunxi_disp_t *ctx);
 int sunxi_layer_hide(sunxi_disp_t *ctx);
 
+/*
+ * Both XV and the DRI2 overlay window want this layer and the offscreen
+ * framebuffer memory behind it. Whoever is going to show something there
+ * needs to claim it first, which fails (returns -1) if the layer is
+ * already claimed by a different owner.
+ */
+int sunxi_layer_claim(sunxi_disp_t *ctx, void *owner);
+void sunxi_layer_unclaim(sunxi_disp_t *ctx, void *owner);
+
+/*
+ * Spare layers for showing more RGB buffers, which are not necessarily in
+ * the framebuffer (so they are specified by the physical address). These
+ * don't support scaling and colorkey. Layers are requested from the kernel
+ * on demand, so sunxi_spare_layer_alloc returns -1 when the display engine
+ * has no free layers left, in addition to the SUNXI_DISP_MAX_SPARE_LAYERS
+ * limit.
+ */
+
+int sunxi_spare_layer_alloc(sunxi_disp_t *ctx);
+int sunxi_spare_layer_free(sunxi_disp_t *ctx, int layer_id);
+
+int sunxi_spare_layer_set_rgb_input_buffer(sunxi_disp_t *ctx,
+                                           int           layer_id,
+                                           int           bpp,
+                                           uintptr_t     paddr,
+                                           int           width,
+                                           int           height,
+                                           int           stride);
+int sunxi_spare_layer_set_output_window(sunxi_disp_t *ctx, int layer_id,
+                                        int x, int y, int w, int h);
+
+int sunxi_spare_layer_show(sunxi_disp_t *ctx, int layer_id);
+int sunxi_spare_layer_hide(sunxi_disp_t *ctx, int layer_id);
+
 /*
  * Wait for vsync
  */
 int sunxi_wait_for_vsync(sunxi_disp_t *ctx);
 
+/*
+ * The disp commands issued between these two calls are cached by
+ * the kernel and get applied to the hardware together
+ */
+int sunxi_disp_start_cmd_cache(sunxi_disp_t *ctx);
+int sunxi_disp_execute_cmd_cache(sunxi_disp_t *ctx);
+
 /*
  * Simple G2D fill and blit operations
  */
@@ -140,6 +210,25 @@ int sunxi_g2d_blit_a8r8g8b8(sunxi_disp_t *disp,
                             int           w,
                             int           h);
 
+/*
+ * Scale and convert a YUV 4:2:0 image with interleaved chroma (NV12),
+ * stored in the offscreen part of framebuffer, into the visible part
+ * of framebuffer (16bpp or 32bpp).
+ */
+int sunxi_g2d_stretch_nv12(sunxi_disp_t *disp,
+                           uint32_t      y_offset_in_framebuffer,
+                           uint32_t      uv_offset_in_framebuffer,
+                           int           src_stride,
+                           int           src_height,
+                           int           src_x,
+                           int           src_y,
+                           int           src_w,
+                           int           src_h,
+                           int           dst_x,
+                           int           dst_y,
+                           int           dst_w,
+                           int           dst_h);
+
 /*
  * The following constants are used sunxi_disp.c and represent
  * the area threshold below which the sunxi_g2d_blit function will
@@ -149,6 +238,26 @@ int sunxi_g2d_blit_a8r8g8b8(sunxi_disp_t *disp,
 #define G2D_BLT_SIZE_THRESHOLD 1000
 #define G2D_BLT_SIZE_THRESHOLD_16BPP 2500
 
+/*
+ * The same as sunxi_g2d_blt, but for the images specified by their physical
+ * addresses, which may be outside of the framebuffer (such as physically
+ * contiguous UMP buffers). Overlapped copies are not supported. Returns 1
+ * on success and 0 if the operation can't be done.
+ */
+int sunxi_g2d_blt_phys(sunxi_disp_t       *disp,
+                       uintptr_t           src_paddr,
+                       uintptr_t           dst_paddr,
+                       int                 src_stride,
+                       int                 dst_stride,
+                       int                 src_bpp,
+                       int                 dst_bpp,
+                       int                 src_x,
+                       int                 src_y,
+                       int                 dst_x,
+                       int                 dst_y,
+                       int                 w,
+                       int                 h);
+
 /* G2D counterpart for pixman_blt with the support for 16bpp and 32bpp */
 int sunxi_g2d_blt(void               *disp,
                   uint32_t           *src_bits,
@@ -29,6 +29,8 @@
 #include "xf86Cursor.h"
 #include "cursorstr.h"
 
+#include <string.h>
+
 #include "sunxi_disp_hwcursor.h"
 #include "sunxi_disp.h"
 #include "fbdev_priv.h"
@@ -37,7 +39,10 @@
 
 static void ShowCursor(ScrnInfoPtr pScrn)
 {
+    SunxiDispHardwareCursor *private = SUNXI_DISP_HWC(pScrn);
     sunxi_disp_t *disp = SUNXI_DISP(pScrn);
+    if (private->pos)
+        fb_cursor_pos_flush(private->pos);
     sunxi_hw_cursor_show(disp);
 }
 
@@ -47,10 +52,19 @@ static void HideCursor(ScrnInfoPtr pScrn)
     sunxi_hw_cursor_hide(disp);
 }
 
+static int ApplyCursorPosition(void *data, int x, int y)
+{
+    return sunxi_hw_cursor_set_position((sunxi_disp_t *)data, x, y);
+}
+
 static void SetCursorPosition(ScrnInfoPtr pScrn, int x, int y)
 {
+    SunxiDispHardwareCursor *private = SUNXI_DISP_HWC(pScrn);
     sunxi_disp_t *disp = SUNXI_DISP(pScrn);
-    sunxi_hw_cursor_set_position(disp, x, y);
+    if (private->pos)
+        fb_cursor_pos_set(private->pos, x, y);
+    else
+        sunxi_hw_cursor_set_position(disp, x, y);
 }
 
 static void SetCursorColors(ScrnInfoPtr pScrn, int bg, int fg)
@@ -99,20 +113,23 @@ static inline uint32_t quantize_color(uint32_t color, int keepbits)
     return color;
 }
 
-static void LoadCursorARGB(ScrnInfoPtr pScrn, CursorPtr pCurs)
+/* Convert the ARGB image into 8-bit palette (with the cache entry as storage) */
+static void QuantizeCursorARGB(SunxiDispCursorCacheEntry *entry,
+                               uint32_t                  *argb_image)
 {
-    sunxi_disp_t *disp = SUNXI_DISP(pScrn);
-    int           width  = pCurs->bits->width;
-    int           height = pCurs->bits->height;
+    int           width  = entry->width;
+    int           height = entry->height;
     int           keepbits, colors_count;
-    uint8_t      *cursor_image = calloc(32 * 32, 1);
-    uint32_t     *palette = malloc(256 * sizeof(uint32_t));
+    uint8_t      *cursor_image = entry->image;
+    uint32_t     *palette = entry->palette;
     hashed_color *colors_array = malloc(width * height * sizeof(hashed_color));
 
+    memset(cursor_image, 0, sizeof(entry->image));
+
     /* Reduce the number of bits per color until we can fit into 8-bit palette */
     for (keepbits = 8; keepbits > 0; keepbits--) {
         int           x, y;
-        uint32_t     *argb = (uint32_t *)pCurs->bits->argb;
+        uint32_t     *argb = argb_image;
         hashed_color *hash = NULL;
         hashed_color *hc;
 
@@ -145,12 +162,70 @@ static void LoadCursorARGB(ScrnInfoPtr pScrn, CursorPtr pCurs)
             break;
     }
 
-    sunxi_hw_cursor_load_palette(disp, palette, colors_count);
-    sunxi_hw_cursor_load_32x32x8bpp(disp, cursor_image);
-
+    entry->colors_count = colors_count;
     free(colors_array);
-    free(cursor_image);
-    free(palette);
+}
+
+/* FNV-1a hash of the cursor image, just to avoid most of the memcmp calls */
+static uint32_t HashCursorARGB(uint32_t *argb, int count)
+{
+    uint32_t hash = 2166136261u;
+    while (count-- > 0) {
+        hash ^= *argb++;
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+/*
+ * Look up the converted image in the cache (the cursor images are compared
+ * by content, because CursorBits may be freed and reallocated at the same
+ * address). On a miss, the least recently used entry gets replaced.
+ */
+static SunxiDispCursorCacheEntry *GetCursorCacheEntry(SunxiDispHardwareCursor *private,
+                                                      CursorPtr                pCurs)
+{
+    SunxiDispCursorCacheEntry *entry, *lru = &private->cache[0];
+    uint32_t *argb = (uint32_t *)pCurs->bits->argb;
+    int       width  = pCurs->bits->width;
+    int       height = pCurs->bits->height;
+    size_t    size   = width * height * sizeof(uint32_t);
+    uint32_t  hash   = HashCursorARGB(argb, width * height);
+    int       i;
+
+    private->cache_clock++;
+
+    for (i = 0; i < SUNXI_DISP_CURSOR_CACHE_SIZE; i++) {
+        entry = &private->cache[i];
+        if (entry->width == width && entry->height == height &&
+            entry->hash == hash && memcmp(entry->argb, argb, size) == 0) {
+            entry->last_used = private->cache_clock;
+            private->cache_hits++;
+            return entry;
+        }
+        if (entry->last_used < lru->last_used)
+            lru = entry;
+    }
+
+    entry = lru;
+    entry->width = width;
+    entry->height = height;
+    entry->hash = hash;
+    entry->last_used = private->cache_clock;
+    memcpy(entry->argb, argb, size);
+    QuantizeCursorARGB(entry, argb);
+    private->cache_misses++;
+    return entry;
+}
+
+static void LoadCursorARGB(ScrnInfoPtr pScrn, CursorPtr pCurs)
+{
+    SunxiDispHardwareCursor *private = SUNXI_DISP_HWC(pScrn);
+    sunxi_disp_t *disp = SUNXI_DISP(pScrn);
+    SunxiDispCursorCacheEntry *entry = GetCursorCacheEntry(private, pCurs);
+
+    sunxi_hw_cursor_load_palette(disp, entry->palette, entry->colors_count);
+    sunxi_hw_cursor_load_32x32x8bpp(disp, entry->image);
 }
 
 SunxiDispHardwareCursor *SunxiDispHardwareCursor_Init(ScreenPtr pScreen)
@@ -188,13 +263,18 @@ SunxiDispHardwareCursor *SunxiDispHardwareCursor_Init(ScreenPtr pScreen)
     }
 
     private = calloc(1, sizeof(SunxiDispHardwareCursor));
-    if (!private) {
+    if (private)
+        private->cache = calloc(SUNXI_DISP_CURSOR_CACHE_SIZE,
+                                sizeof(SunxiDispCursorCacheEntry));
+    if (!private || !private->cache) {
         ErrorF("SunxiDispHardwareCursor_Init: calloc failed\n");
+        free(private);
         xf86DestroyCursorInfoRec(InfoPtr);
         return NULL;
     }
 
     private->hwcursor = InfoPtr;
+    private->pos = fb_cursor_pos_init(FB_VBLANK(pScrn), ApplyCursorPosition, disp);
     return private;
 }
 
@@ -203,6 +283,16 @@ void SunxiDispHardwareCursor_Close(ScreenPtr pScreen)
     ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
     SunxiDispHardwareCursor *private = SUNXI_DISP_HWC(pScrn);
     if (private) {
+        xf86DrvMsgVerb(pScreen->myNum, X_INFO, 3,
+                       "ARGB cursor cache: %lu hits, %lu misses\n",
+                       private->cache_hits, private->cache_misses);
+        if (private->pos) {
+            xf86DrvMsgVerb(pScreen->myNum, X_INFO, 3,
+                           "hardware cursor: %lu moves, %lu position ioctls\n",
+                           private->pos->moves, private->pos->ioctls);
+            fb_cursor_pos_close(private->pos);
+        }
         xf86DestroyCursorInfoRec(private->hwcursor);
+        free(private->cache);
     }
 }
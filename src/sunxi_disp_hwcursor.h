@@ -26,13 +26,36 @@
 
 #include "xf86Cursor.h"
 
+#include "fb_cursor_pos.h"
+
 typedef void (*EnableHWCursorProcPtr)(ScrnInfoPtr pScrn);
 typedef void (*DisableHWCursorProcPtr)(ScrnInfoPtr pScrn);
 
+/* The number of recently used ARGB cursor images kept in 8-bit form */
+#define SUNXI_DISP_CURSOR_CACHE_SIZE 32
+
+typedef struct {
+    int                 width, height; /* 0 for an empty entry */
+    uint32_t            hash;
+    unsigned int        last_used;
+    uint32_t            argb[32 * 32];
+    /* Ready for uploading to the hardware */
+    uint32_t            palette[256];
+    int                 colors_count;
+    uint8_t             image[32 * 32];
+} SunxiDispCursorCacheEntry;
+
 typedef struct {
     xf86CursorInfoPtr hwcursor;
     EnableHWCursorProcPtr EnableHWCursor;
     DisableHWCursorProcPtr DisableHWCursor;
+
+    fb_cursor_pos_t *pos; /* coalesces the cursor moves */
+
+    SunxiDispCursorCacheEntry *cache;
+    unsigned int               cache_clock;
+    unsigned long              cache_hits;
+    unsigned long              cache_misses;
 } SunxiDispHardwareCursor;
 
 SunxiDispHardwareCursor *SunxiDispHardwareCursor_Init(ScreenPtr pScreen);
@@ -32,6 +32,9 @@
 #include <ump/ump.h>
 #include <ump/ump_ref_drv.h>
 
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <sys/ioctl.h>
 
 #include "xorgVersion.h"
@@ -41,95 +44,33 @@
 #include "dri2.h"
 #include "damage.h"
 #include "fb.h"
+#include "property.h"
 
 #include "fbdev_priv.h"
+#include "cpu_backend.h"
 #include "sunxi_disp.h"
 #include "sunxi_disp_hwcursor.h"
 #include "sunxi_disp_ioctl.h"
 #include "sunxi_mali_ump_dri2.h"
 
-static const uint32_t crc32_table[256] = {
-    0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
-    0xE963A535, 0x9E6495A3, 0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
-    0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91, 0x1DB71064, 0x6AB020F2,
-    0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
-    0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9,
-    0xFA0F3D63, 0x8D080DF5, 0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
-    0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B, 0x35B5A8FA, 0x42B2986C,
-    0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
-    0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423,
-    0xCFBA9599, 0xB8BDA50F, 0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
-    0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D, 0x76DC4190, 0x01DB7106,
-    0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
-    0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D,
-    0x91646C97, 0xE6635C01, 0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
-    0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457, 0x65B0D9C6, 0x12B7E950,
-    0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
-    0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7,
-    0xA4D1C46D, 0xD3D6F4FB, 0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
-    0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9, 0x5005713C, 0x270241AA,
-    0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
-    0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81,
-    0xB7BD5C3B, 0xC0BA6CAD, 0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
-    0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683, 0xE3630B12, 0x94643B84,
-    0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
-    0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB,
-    0x196C3671, 0x6E6B06E7, 0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
-    0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5, 0xD6D6A3E8, 0xA1D1937E,
-    0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
-    0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55,
-    0x316E8EEF, 0x4669BE79, 0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
-    0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F, 0xC5BA3BBE, 0xB2BD0B28,
-    0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
-    0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F,
-    0x72076785, 0x05005713, 0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
-    0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21, 0x86D3D2D4, 0xF1D4E242,
-    0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
-    0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69,
-    0x616BFFD3, 0x166CCF45, 0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
-    0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB, 0xAED16A4A, 0xD9D65ADC,
-    0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
-    0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693,
-    0x54DE5729, 0x23D967BF, 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
-    0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
-};
+/* DRI2WindowStatePtr for windows, UMPBufferInfoPtr for migrated pixmaps */
+static DevPrivateKeyRec MaliDRI2WindowStateKeyRec;
+static DevPrivateKeyRec MaliDRI2PixmapUMPKeyRec;
 
-static inline uint32_t
-crc32_byte(uint32_t crc32, uint8_t data)
-{
-    crc32 ^= 0xFFFFFFFF;
-    crc32 = (crc32 >> 8) ^ crc32_table[(crc32 ^ data) & 0xFF];
-    return crc32 ^ 0xFFFFFFFF;
-}
+#define MALI_DRI2_WINDOW_STATE(mali, pDraw)                                  \
+    ((mali)->nWindowStates ? (DRI2WindowStatePtr)dixLookupPrivate(          \
+        &((WindowPtr)(pDraw))->devPrivates, &MaliDRI2WindowStateKeyRec) : NULL)
 
-static uint32_t calc_ump_checksum(UMPBufferInfoPtr umpbuf, uint32_t seed)
-{
-    int i;
-    uint8_t *buf = umpbuf->addr + umpbuf->offs;
-    uint32_t result = 0;
-    uint32_t hi, lo;
-    for (i = 0; i < RANDOM_SAMPLES_COUNT; i++) {
-        /* LCG pseudorandom number generation */
-        seed = seed * 1103515245 + 12345;
-        hi = seed & 0xFFFF0000;
-        seed = seed * 1103515245 + 12345;
-        lo = seed >> 16;
-        result = crc32_byte(result, buf[(hi | lo) % umpbuf->size]);
-    }
-    return result;
-}
+#define MALI_DRI2_PIXMAP_UMP(mali, pPixmap)                                  \
+    ((mali)->nMigratedPixmaps ? (UMPBufferInfoPtr)dixLookupPrivate(         \
+        &(pPixmap)->devPrivates, &MaliDRI2PixmapUMPKeyRec) : NULL)
 
-static void save_ump_checksum(UMPBufferInfoPtr umpbuf, uint32_t seed)
-{
-    umpbuf->has_checksum = TRUE;
-    umpbuf->checksum_seed = seed;
-    umpbuf->checksum = calc_ump_checksum(umpbuf, seed);
-}
-
-static Bool test_ump_checksum(UMPBufferInfoPtr umpbuf)
-{
-    return calc_ump_checksum(umpbuf, umpbuf->checksum_seed) == umpbuf->checksum;
-}
+/*
+ * More windows than spare layers may be double buffered in physically
+ * contiguous memory, so that the layers can move between them when they
+ * get obscured and unobscured.
+ */
+#define MALI_DRI2_MAX_SPARE_LAYER_WINDOWS (2 * SUNXI_DISP_MAX_SPARE_LAYERS)
 
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(a)  (sizeof((a)) / sizeof((a)[0]))
@@ -157,56 +98,157 @@ WindowExtents(WindowPtr pWin, BoxPtr pBox)
     return pBox;
 }
 
-static int
-FancyTraverseTree(WindowPtr pWin, VisitWindowProcPtr func, pointer data)
+static Bool
+WindowOverlapsBox(WindowPtr pWin, BoxPtr pOverlayBox)
 {
-    int result;
-    WindowPtr pChild;
-
-    if (!(pChild = pWin))
-        return WT_NOMATCH;
-    while (1) {
-        result = (*func) (pChild, data);
-        if (result == WT_STOPWALKING)
-            return WT_STOPWALKING;
-        if ((result == WT_WALKCHILDREN) && pChild->lastChild) {
-            pChild = pChild->lastChild;
-            continue;
+    BoxRec box;
+    if (!pWin->mapped || !pWin->realized || pWin->drawable.class == InputOnly)
+        return FALSE;
+    if (!BOXES_OVERLAP(WindowExtents(pWin, &box), pOverlayBox))
+        return FALSE;
+    DebugMsg("overlapped by %p, x=%d, y=%d, w=%d, h=%d\n", pWin,
+             pWin->drawable.x, pWin->drawable.y,
+             pWin->drawable.width, pWin->drawable.height);
+    return TRUE;
+}
+
+/*
+ * Check whether the overlay window is overlapped by anything stacked above
+ * it. These are its own children and the siblings above the window itself
+ * and above each of its ancestors (the children of those are clipped by
+ * their parents). The window geometry is used instead of the clip lists,
+ * because we can't rely on them for redirected windows.
+ */
+static Bool
+OverlayBoxIsOverlapped(WindowPtr pOverlayWin, BoxPtr pOverlayBox)
+{
+    WindowPtr pWin, pAncestor;
+
+    for (pWin = pOverlayWin->firstChild; pWin; pWin = pWin->nextSib) {
+        if (WindowOverlapsBox(pWin, pOverlayBox))
+            return TRUE;
+    }
+
+    for (pAncestor = pOverlayWin; pAncestor->parent; pAncestor = pAncestor->parent) {
+        for (pWin = pAncestor->prevSib; pWin; pWin = pWin->prevSib) {
+            if (WindowOverlapsBox(pWin, pOverlayBox))
+                return TRUE;
         }
-        while (!pChild->prevSib && (pChild != pWin))
-            pChild = pChild->parent;
-        if (pChild == pWin)
-            break;
-        pChild = pChild->prevSib;
     }
-    return WT_NOMATCH;
+
+    return FALSE;
 }
 
-static int
-WindowWalker(WindowPtr pWin, pointer value)
+static Bool
+OverlayWinIsOverlapped(WindowPtr pOverlayWin)
 {
-    SunxiMaliDRI2 *mali = (SunxiMaliDRI2 *)value;
-
-    if (mali->bWalkingAboveOverlayWin) {
-        if (pWin->mapped && pWin->realized && pWin->drawable.class != InputOnly) {
-            BoxRec sboxrec1;
-            BoxPtr sbox1 = WindowExtents(pWin, &sboxrec1);
-            BoxRec sboxrec2;
-            BoxPtr sbox2 = WindowExtents(mali->pOverlayWin, &sboxrec2);
-            if (BOXES_OVERLAP(sbox1, sbox2)) {
-                mali->bOverlayWinOverlapped = TRUE;
-                DebugMsg("overlapped by %p, x=%d, y=%d, w=%d, h=%d\n", pWin,
-                         pWin->drawable.x, pWin->drawable.y,
-                         pWin->drawable.width, pWin->drawable.height);
-                return WT_STOPWALKING;
-            }
-        }
+    BoxRec overlay_box;
+    return OverlayBoxIsOverlapped(pOverlayWin, WindowExtents(pOverlayWin, &overlay_box));
+}
+
+/*
+ * With the DRI2OverlayUpscale option, the windows having _FBTURBO_UPSCALE
+ * property are shown by the overlay scaled up to the whole screen. This way
+ * the fill rate bound applications can render at a lower resolution.
+ */
+static Bool
+OverlayWinWantsUpscale(SunxiMaliDRI2 *mali, WindowPtr pWin)
+{
+    PropertyPtr pProp;
+
+    if (!mali->bOverlayUpscale)
+        return FALSE;
+
+    return dixLookupProperty(&pProp, pWin, mali->upscale_atom,
+                             serverClient, DixReadAccess) == Success;
+}
+
+/* The overlay either covers the window or the whole screen if upscaled */
+static void
+OverlayOutputBox(SunxiMaliDRI2 *mali, WindowPtr pWin, BoxPtr pBox)
+{
+    if (mali->bOverlayWinUpscaled) {
+        pBox->x1 = 0;
+        pBox->y1 = 0;
+        pBox->x2 = pWin->drawable.pScreen->width;
+        pBox->y2 = pWin->drawable.pScreen->height;
     }
-    else if (pWin == mali->pOverlayWin) {
-        mali->bWalkingAboveOverlayWin = TRUE;
+    else {
+        pBox->x1 = pWin->drawable.x;
+        pBox->y1 = pWin->drawable.y;
+        pBox->x2 = pWin->drawable.x + pWin->drawable.width;
+        pBox->y2 = pWin->drawable.y + pWin->drawable.height;
     }
+}
+
+/*
+ * UMP has no userspace API for getting the physical address of a buffer.
+ * But the buffers allocated with UMP_REF_DRV_CONSTRAINT_PHYSICALLY_LINEAR
+ * are contiguous, so the address can be looked up in the page tables via
+ * /proc/self/pagemap (the X server normally has CAP_SYS_ADMIN, which is
+ * needed to see the page frame numbers). Returns 0 on failure.
+ */
+static uintptr_t ump_get_phys_addr(uint8_t *addr, size_t size)
+{
+    const uint64_t pm_present = 1ULL << 63;
+    const uint64_t pm_pfn_mask = (1ULL << 55) - 1;
+    long page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t first_page, last_page;
+    uint64_t first, last;
+    int fd;
+
+    if (!addr || size == 0 || page_size <= 0 || (uintptr_t)addr % page_size)
+        return 0;
+
+    first_page = (uintptr_t)addr / page_size;
+    last_page = ((uintptr_t)addr + size - 1) / page_size;
+
+    /* Make sure that the page table entries are populated */
+    (void)*(volatile uint8_t *)addr;
+    (void)*(volatile uint8_t *)(addr + size - 1);
+
+    if ((fd = open("/proc/self/pagemap", O_RDONLY)) < 0)
+        return 0;
+    if (pread(fd, &first, 8, (off_t)first_page * 8) != 8 ||
+        pread(fd, &last, 8, (off_t)last_page * 8) != 8) {
+        close(fd);
+        return 0;
+    }
+    close(fd);
+
+    if (!(first & pm_present) || !(last & pm_present) ||
+        (first & pm_pfn_mask) == 0 ||
+        (last & pm_pfn_mask) - (first & pm_pfn_mask) != last_page - first_page)
+        return 0;
+
+    return (uintptr_t)((first & pm_pfn_mask) * page_size);
+}
+
+/*
+ * Allocate a physically contiguous UMP buffer and map it, preferably
+ * reusing one of the recently released buffers from the pool.
+ */
+static Bool alloc_ump_buffer(SunxiMaliDRI2   *mali,
+                             UMPBufferInfoPtr umpbuf,
+                             size_t           size,
+                             int              constraints)
+{
+    umpbuf->pool             = mali->ump_pool;
+    umpbuf->pool_size        = size;
+    umpbuf->pool_constraints = constraints;
+    umpbuf->addr             = NULL;
+    umpbuf->handle = ump_pool_alloc(mali->ump_pool, &umpbuf->pool_size,
+                                    constraints, &umpbuf->addr);
+    if (umpbuf->handle == UMP_INVALID_MEMORY_HANDLE)
+        return FALSE;
+    if (constraints & UMP_REF_DRV_CONSTRAINT_PHYSICALLY_LINEAR)
+        umpbuf->paddr = ump_get_phys_addr(umpbuf->addr, umpbuf->pool_size);
+    return TRUE;
+}
 
-    return WT_WALKCHILDREN;
+static void memcpy_to_uncached_generic(void *dst, const void *src, size_t size)
+{
+    memcpy(dst, src, size);
 }
 
 /* Migrate pixmap to UMP buffer */
@@ -220,7 +262,7 @@ MigratePixmapToUMP(PixmapPtr pPixmap)
     size_t pitch = ((pPixmap->devKind + 7) / 8) * 8;
     size_t size = pitch * pPixmap->drawable.height;
 
-    HASH_FIND_PTR(mali->HashPixmapToUMP, &pPixmap, umpbuf);
+    umpbuf = MALI_DRI2_PIXMAP_UMP(mali, pPixmap);
 
     if (umpbuf) {
         DebugMsg("MigratePixmapToUMP %p, already exists = %p\n", pPixmap, umpbuf);
@@ -235,27 +277,26 @@ MigratePixmapToUMP(PixmapPtr pPixmap)
     }
     umpbuf->refcount = 1;
     umpbuf->pPixmap = pPixmap;
-    umpbuf->handle = ump_ref_drv_allocate(size, UMP_REF_DRV_CONSTRAINT_PHYSICALLY_LINEAR);
-    if (umpbuf->handle == UMP_INVALID_MEMORY_HANDLE) {
+    if (!alloc_ump_buffer(mali, umpbuf, size, UMP_REF_DRV_CONSTRAINT_PHYSICALLY_LINEAR)) {
         ErrorF("MigratePixmapToUMP: ump_ref_drv_allocate failed\n");
         free(umpbuf);
         return NULL;
     }
     umpbuf->size = size;
-    umpbuf->addr = ump_mapped_pointer_get(umpbuf->handle);
+    umpbuf->pitch = pitch;
     umpbuf->depth = pPixmap->drawable.depth;
     umpbuf->width = pPixmap->drawable.width;
     umpbuf->height = pPixmap->drawable.height;
 
-    /* copy the pixel data to the new location */
+    /* copy the pixel data to the new location (UMP buffers are uncached) */
     if (pitch == pPixmap->devKind) {
-        memcpy(umpbuf->addr, pPixmap->devPrivate.ptr, size);
+        mali->memcpy_to_uncached(umpbuf->addr, pPixmap->devPrivate.ptr, size);
     } else {
         int y;
         for (y = 0; y < umpbuf->height; y++) {
-            memcpy(umpbuf->addr + y * pitch, 
-                   pPixmap->devPrivate.ptr + y * pPixmap->devKind,
-                   pPixmap->devKind);
+            mali->memcpy_to_uncached(umpbuf->addr + y * pitch,
+                                     pPixmap->devPrivate.ptr + y * pPixmap->devKind,
+                                     pPixmap->devKind);
         }
     }
 
@@ -265,13 +306,17 @@ MigratePixmapToUMP(PixmapPtr pPixmap)
     pPixmap->devKind = pitch;
     pPixmap->devPrivate.ptr = umpbuf->addr;
 
-    HASH_ADD_PTR(mali->HashPixmapToUMP, pPixmap, umpbuf);
+    dixSetPrivate(&pPixmap->devPrivates, &MaliDRI2PixmapUMPKeyRec, umpbuf);
+    mali->nMigratedPixmaps++;
 
     DebugMsg("MigratePixmapToUMP %p, new buf = %p\n", pPixmap, umpbuf);
     return umpbuf;
 }
 
 static void UpdateOverlay(ScreenPtr pScreen);
+static void SpareLayerWindowAdd(SunxiMaliDRI2 *mali, DRI2WindowStatePtr window_state);
+static void SpareLayerWindowRemove(ScrnInfoPtr pScrn, DRI2WindowStatePtr window_state,
+                                   Bool flush);
 
 static void unref_ump_buffer_info(UMPBufferInfoPtr umpbuf)
 {
@@ -279,8 +324,8 @@ static void unref_ump_buffer_info(UMPBufferInfoPtr umpbuf)
         DebugMsg("unref_ump_buffer_info(%p) [refcount=%d, handle=%p]\n",
                  umpbuf, umpbuf->refcount, umpbuf->handle);
         if (umpbuf->handle != UMP_INVALID_MEMORY_HANDLE) {
-            ump_mapped_pointer_release(umpbuf->handle);
-            ump_reference_release(umpbuf->handle);
+            ump_pool_release(umpbuf->pool, umpbuf->handle, umpbuf->addr,
+                             umpbuf->pool_size, umpbuf->pool_constraints);
         }
         free(umpbuf);
     }
@@ -290,32 +335,37 @@ static void unref_ump_buffer_info(UMPBufferInfoPtr umpbuf)
     }
 }
 
-static void umpbuf_add_to_queue(DRI2WindowStatePtr window_state,
+/* Returns FALSE if the buffer could not be queued */
+static Bool umpbuf_add_to_queue(DRI2WindowStatePtr window_state,
                                 UMPBufferInfoPtr umpbuf)
 {
-    if (window_state->ump_queue[window_state->ump_queue_head]) {
+    if (dri2_buf_queue_add(&window_state->ump_queue, umpbuf,
+                           window_state->buf_request_cnt) != 0) {
         ErrorF("Fatal error, UMP buffers queue overflow!\n");
-        return;
+        return FALSE;
     }
-
-    window_state->ump_queue[window_state->ump_queue_head] = umpbuf;
-    window_state->ump_queue_head = (window_state->ump_queue_head + 1) %
-                                   ARRAY_SIZE(window_state->ump_queue);
+    return TRUE;
 }
 
-static UMPBufferInfoPtr umpbuf_fetch_from_queue(DRI2WindowStatePtr window_state)
+static UMPBufferInfoPtr umpbuf_fetch_from_queue(ScrnInfoPtr        pScrn,
+                                                DRI2WindowStatePtr window_state)
 {
     UMPBufferInfoPtr umpbuf;
-
-    /* Check if the queue is empty */
-    if (window_state->ump_queue_tail == window_state->ump_queue_head)
-        return NULL;
-
-    umpbuf = window_state->ump_queue[window_state->ump_queue_tail];
-    window_state->ump_queue[window_state->ump_queue_tail] = NULL;
-
-    window_state->ump_queue_tail = (window_state->ump_queue_tail + 1) %
-                                   ARRAY_SIZE(window_state->ump_queue);
+    unsigned int seq;
+    int in_order;
+
+    umpbuf = dri2_buf_queue_fetch(&window_state->ump_queue, &seq, &in_order);
+    if (umpbuf && !in_order) {
+        /*
+         * Some buffer requests got lost, so the swap counter can't be
+         * trusted to match the odd/even buffers anymore. Make sure that
+         * this buffer gets swapped in, the client is rendering to it.
+         */
+        xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+                   "DRI2 buffer request %u is out of sequence, resynchronizing\n",
+                   seq);
+        window_state->buf_swap_cnt = seq - 1;
+    }
     return umpbuf;
 }
 
@@ -342,6 +392,7 @@ static DRI2Buffer2Ptr MaliDRI2CreateBuffer(DrawablePtr  pDraw,
     SunxiMaliDRI2           *mali = SUNXI_MALI_UMP_DRI2(pScrn);
     sunxi_disp_t            *disp = SUNXI_DISP(pScrn);
     Bool                     can_use_overlay = TRUE;
+    Bool                     can_use_spare_layer = FALSE;
     PixmapPtr                pWindowPixmap;
     DRI2WindowStatePtr       window_state = NULL;
     Bool                     need_window_resize_bug_workaround = FALSE;
@@ -374,7 +425,7 @@ static DRI2Buffer2Ptr MaliDRI2CreateBuffer(DrawablePtr  pDraw,
         buffer->format        = format;
         buffer->flags         = 0;
         buffer->cpp           = pDraw->bitsPerPixel / 8;
-        buffer->pitch         = ((PixmapPtr)pDraw)->devKind;
+        buffer->pitch         = privates->pitch;
         buffer->name = ump_secure_id_get(privates->handle);
 
         DebugMsg("DRI2CreateBuffer pix=%p, buf=%p:%p, att=%d, ump=%d:%d, w=%d, h=%d, cpp=%d, depth=%d\n",
@@ -418,10 +469,6 @@ static DRI2Buffer2Ptr MaliDRI2CreateBuffer(DrawablePtr  pDraw,
     if (!disp || mali->ump_fb_secure_id == UMP_INVALID_SECURE_ID)
         can_use_overlay = FALSE;
 
-    /* Overlay is already used by a different window */
-    if (mali->pOverlayWin && mali->pOverlayWin != (void *)pDraw)
-        can_use_overlay = FALSE;
-
     /* Don't waste overlay on some strange 1x1 window created by gnome-shell */
     if (pDraw->width == 1 && pDraw->height == 1)
         can_use_overlay = FALSE;
@@ -430,23 +477,33 @@ static DRI2Buffer2Ptr MaliDRI2CreateBuffer(DrawablePtr  pDraw,
     if (pDraw->bitsPerPixel != 32 && pDraw->bitsPerPixel != 16)
         can_use_overlay = FALSE;
 
-    if (disp && disp->framebuffer_size - disp->gfx_layer_size < privates->size * 2) {
+    /* Overlay is already used by a different window or by XV, try a spare layer */
+    if ((mali->pOverlayWin && mali->pOverlayWin != (void *)pDraw) ||
+        (disp && disp->layer_owner && disp->layer_owner != mali)) {
+        can_use_spare_layer = can_use_overlay;
+        can_use_overlay = FALSE;
+    }
+
+    if (disp && disp->offscreen_end - disp->gfx_layer_size < privates->size * 2) {
         DebugMsg("Not enough space in the offscreen framebuffer (wanted %d for DRI2)\n",
                  privates->size);
         can_use_overlay = FALSE;
     }
 
     /* Allocate the DRI2-related window bookkeeping information */
-    HASH_FIND_PTR(mali->HashWindowState, &pDraw, window_state);
+    window_state = MALI_DRI2_WINDOW_STATE(mali, pDraw);
     if (!window_state) {
         window_state = calloc(1, sizeof(*window_state));
         window_state->pDraw = pDraw;
-        HASH_ADD_PTR(mali->HashWindowState, pDraw, window_state);
+        window_state->spare_layer_id = -1;
+        dixSetPrivate(&((WindowPtr)pDraw)->devPrivates,
+                      &MaliDRI2WindowStateKeyRec, window_state);
+        mali->nWindowStates++;
         DebugMsg("Allocate DRI2 bookkeeping for window %p\n", pDraw);
         if (disp && can_use_overlay) {
             /* erase the offscreen part of the framebuffer */
             memset(disp->framebuffer_addr + disp->gfx_layer_size, 0,
-                   disp->framebuffer_size - disp->gfx_layer_size);
+                   disp->offscreen_end - disp->gfx_layer_size);
         }
     }
     window_state->buf_request_cnt++;
@@ -465,6 +522,31 @@ static DRI2Buffer2Ptr MaliDRI2CreateBuffer(DrawablePtr  pDraw,
                            pDraw->height != window_state->height) &&
                           mali->ump_null_secure_id <= 2;
 
+    /*
+     * The spare layers need a new physically contiguous buffer for each
+     * request. If we can't get one, the window just falls back to copying.
+     */
+    if (can_use_spare_layer && !need_window_resize_bug_workaround &&
+        (window_state->use_spare_layer ||
+         mali->nSpareLayerWindows < MALI_DRI2_MAX_SPARE_LAYER_WINDOWS)) {
+        if (alloc_ump_buffer(mali, privates, privates->size,
+                             UMP_REF_DRV_CONSTRAINT_PHYSICALLY_LINEAR) &&
+            !privates->paddr) {
+            ump_pool_release(privates->pool, privates->handle, privates->addr,
+                             privates->pool_size, privates->pool_constraints);
+            privates->handle = UMP_INVALID_MEMORY_HANDLE;
+            privates->addr   = NULL;
+        }
+        if (privates->handle == UMP_INVALID_MEMORY_HANDLE)
+            can_use_spare_layer = FALSE;
+    }
+    else {
+        can_use_spare_layer = FALSE;
+    }
+
+    if (window_state->use_spare_layer && !can_use_spare_layer)
+        SpareLayerWindowRemove(pScrn, window_state, TRUE);
+
     if (can_use_overlay) {
         /* Release unneeded buffers */
         if (window_state->ump_mem_buffer_ptr)
@@ -474,6 +556,7 @@ static DRI2Buffer2Ptr MaliDRI2CreateBuffer(DrawablePtr  pDraw,
         /* Use offscreen part of the framebuffer as an overlay */
         privates->handle = UMP_INVALID_MEMORY_HANDLE;
         privates->addr = disp->framebuffer_addr;
+        privates->paddr = disp->framebuffer_paddr;
 
         buffer->name = mali->ump_fb_secure_id;
 
@@ -486,16 +569,50 @@ static DRI2Buffer2Ptr MaliDRI2CreateBuffer(DrawablePtr  pDraw,
             privates->extra_flags |= UMPBUF_MUST_BE_EVEN_FRAME;
         }
 
-        umpbuf_add_to_queue(window_state, privates);
-        privates->refcount++;
+        if (umpbuf_add_to_queue(window_state, privates))
+            privates->refcount++;
 
-        mali->pOverlayWin = (WindowPtr)pDraw;
+        if (mali->pOverlayWin != (WindowPtr)pDraw) {
+            sunxi_layer_claim(disp, mali);
+            mali->pOverlayWin = (WindowPtr)pDraw;
+            mali->bOverlayOcclusionDirty = TRUE;
+        }
+
+        if (disp->layer_has_scaler &&
+            OverlayWinWantsUpscale(mali, (WindowPtr)pDraw) != mali->bOverlayWinUpscaled) {
+            mali->bOverlayWinUpscaled = !mali->bOverlayWinUpscaled;
+            mali->bOverlayOcclusionDirty = TRUE;
+            /* Force the output window update */
+            mali->overlay_x = mali->overlay_y = -1;
+            DebugMsg("Overlay upscaling for window %p is %s\n", pDraw,
+                     mali->bOverlayWinUpscaled ? "on" : "off");
+        }
 
         if (need_window_resize_bug_workaround) {
             DebugMsg("DRI2 buffers size mismatch detected, trying to recover\n");
             buffer->name = mali->ump_alternative_fb_secure_id;
         }
     }
+    else if (can_use_spare_layer) {
+        /* Release unneeded buffers */
+        if (window_state->ump_mem_buffer_ptr)
+            unref_ump_buffer_info(window_state->ump_mem_buffer_ptr);
+        window_state->ump_mem_buffer_ptr = NULL;
+
+        buffer->name = ump_secure_id_get(privates->handle);
+        buffer->flags = 0;
+
+        if (window_state->buf_request_cnt & 1)
+            privates->extra_flags |= UMPBUF_MUST_BE_ODD_FRAME;
+        else
+            privates->extra_flags |= UMPBUF_MUST_BE_EVEN_FRAME;
+
+        if (umpbuf_add_to_queue(window_state, privates))
+            privates->refcount++;
+
+        if (!window_state->use_spare_layer)
+            SpareLayerWindowAdd(mali, window_state);
+    }
     else {
         /* Release unneeded buffers */
         if (window_state->ump_back_buffer_ptr)
@@ -504,6 +621,7 @@ static DRI2Buffer2Ptr MaliDRI2CreateBuffer(DrawablePtr  pDraw,
         if (window_state->ump_front_buffer_ptr)
             unref_ump_buffer_info(window_state->ump_front_buffer_ptr);
         window_state->ump_front_buffer_ptr = NULL;
+        dri2_buf_queue_restart_seq(&window_state->ump_queue);
 
         if (need_window_resize_bug_workaround) {
             DebugMsg("DRI2 buffers size mismatch detected, trying to recover\n");
@@ -539,22 +657,21 @@ static DRI2Buffer2Ptr MaliDRI2CreateBuffer(DrawablePtr  pDraw,
 
         /* Allocate UMP memory buffer */
 #ifdef HAVE_LIBUMP_CACHE_CONTROL
-        privates->handle = ump_ref_drv_allocate(privates->size,
-                                    UMP_REF_DRV_CONSTRAINT_PHYSICALLY_LINEAR |
-                                    UMP_REF_DRV_CONSTRAINT_USE_CACHE);
+        alloc_ump_buffer(mali, privates, privates->size,
+                         UMP_REF_DRV_CONSTRAINT_PHYSICALLY_LINEAR |
+                         UMP_REF_DRV_CONSTRAINT_USE_CACHE);
         ump_cache_operations_control(UMP_CACHE_OP_START);
         ump_switch_hw_usage_secure_id(ump_secure_id_get(privates->handle),
                                       UMP_USED_BY_MALI);
         ump_cache_operations_control(UMP_CACHE_OP_FINISH);
 #else
-        privates->handle = ump_ref_drv_allocate(privates->size,
-                                    UMP_REF_DRV_CONSTRAINT_PHYSICALLY_LINEAR);
+        alloc_ump_buffer(mali, privates, privates->size,
+                         UMP_REF_DRV_CONSTRAINT_PHYSICALLY_LINEAR);
 #endif
         if (privates->handle == UMP_INVALID_MEMORY_HANDLE) {
             ErrorF("Failed to allocate UMP buffer (size=%d)\n",
                    (int)privates->size);
         }
-        privates->addr = ump_mapped_pointer_get(privates->handle);
         buffer->name = ump_secure_id_get(privates->handle);
         buffer->flags = 0;
 
@@ -582,6 +699,11 @@ static void MaliDRI2DestroyBuffer(DrawablePtr pDraw, DRI2Buffer2Ptr buffer)
 
     if (mali->pOverlayDirtyUMP == buffer->driverPrivate)
         mali->pOverlayDirtyUMP = NULL;
+    if (pDraw->type == DRAWABLE_WINDOW) {
+        DRI2WindowStatePtr window_state = MALI_DRI2_WINDOW_STATE(mali, pDraw);
+        if (window_state && window_state->spare_layer_dirty_ump == buffer->driverPrivate)
+            window_state->spare_layer_dirty_ump = NULL;
+    }
 
     DebugMsg("DRI2DestroyBuffer %s=%p, buf=%p:%p, att=%d\n",
              pDraw->type == DRAWABLE_WINDOW ? "win" : "pix",
@@ -594,7 +716,76 @@ static void MaliDRI2DestroyBuffer(DrawablePtr pDraw, DRI2Buffer2Ptr buffer)
     }
 }
 
-/* Do ordinary copy */
+/* Smaller copies are cheaper to do with the CPU than to set up G2D for */
+#define G2D_COPY_SIZE_THRESHOLD (64 * 64)
+
+/*
+ * Copy the region (already clipped to the visible part of the window) from
+ * the physical address of the UMP buffer straight to the framebuffer with
+ * G2D. This is only possible for the windows which are not redirected.
+ */
+static Bool MaliDRI2CopyRegion_g2d(DrawablePtr      pDraw,
+                                   RegionPtr        pRegion,
+                                   UMPBufferInfoPtr umpbuf)
+{
+    ScreenPtr pScreen = pDraw->pScreen;
+    sunxi_disp_t *disp = SUNXI_DISP(xf86Screens[pScreen->myNum]);
+    BoxPtr extents = REGION_EXTENTS(pScreen, pRegion);
+    BoxPtr pbox = REGION_RECTS(pRegion);
+    int nbox = REGION_NUM_RECTS(pRegion);
+    uint8_t *dst_bits;
+    PixmapPtr pPixmap;
+    int dx, dy;
+
+    if (!disp || disp->fd_g2d < 0 || !umpbuf->paddr ||
+        pDraw->type != DRAWABLE_WINDOW)
+        return FALSE;
+
+    if ((umpbuf->cpp != 2 && umpbuf->cpp != 4) || (umpbuf->pitch & 3))
+        return FALSE;
+
+    if ((extents->x2 - extents->x1) * (extents->y2 - extents->y1) <
+                                                    G2D_COPY_SIZE_THRESHOLD)
+        return FALSE;
+
+    pPixmap = pScreen->GetWindowPixmap((WindowPtr)pDraw);
+    dst_bits = pPixmap->devPrivate.ptr;
+    if (dst_bits < disp->framebuffer_addr ||
+        dst_bits >= disp->framebuffer_addr + disp->framebuffer_size)
+        return FALSE;
+
+    dx = pDraw->x;
+    dy = pDraw->y;
+#ifdef COMPOSITE
+    dx -= pPixmap->screen_x;
+    dy -= pPixmap->screen_y;
+#endif
+
+    while (nbox--) {
+        if (!sunxi_g2d_blt_phys(disp,
+                   umpbuf->paddr + umpbuf->offs,
+                   disp->framebuffer_paddr + (dst_bits - disp->framebuffer_addr),
+                   umpbuf->pitch / 4, pPixmap->devKind / 4,
+                   umpbuf->cpp * 8, pPixmap->drawable.bitsPerPixel,
+                   pbox->x1, pbox->y1, pbox->x1 + dx, pbox->y1 + dy,
+                   pbox->x2 - pbox->x1, pbox->y2 - pbox->y1))
+            return FALSE;
+        pbox++;
+    }
+
+    /* We have bypassed the GC, so report the damage explicitly */
+    REGION_TRANSLATE(pScreen, pRegion, pDraw->x, pDraw->y);
+    DamageDamageRegion(pDraw, pRegion);
+    REGION_TRANSLATE(pScreen, pRegion, -pDraw->x, -pDraw->y);
+
+    return TRUE;
+}
+
+/*
+ * Do ordinary copy. Only the part of the buffer, which is both in the
+ * requested region and visible on the screen, gets copied. The CPU cache
+ * maintenance is also limited to the rows covered by this part.
+ */
 static void MaliDRI2CopyRegion_copy(DrawablePtr      pDraw,
                                     RegionPtr        pRegion,
                                     UMPBufferInfoPtr umpbuf)
@@ -602,15 +793,45 @@ static void MaliDRI2CopyRegion_copy(DrawablePtr      pDraw,
     GCPtr pGC;
     RegionPtr copyRegion;
     ScreenPtr pScreen = pDraw->pScreen;
-    UMPBufferInfoPtr privates;
     PixmapPtr pScratchPixmap;
+    RegionRec region;
+    BoxRec box;
+    BoxPtr extents;
+
+    box.x1 = 0;
+    box.y1 = 0;
+    box.x2 = min(umpbuf->width, pDraw->width);
+    box.y2 = min(umpbuf->height, pDraw->height);
+    REGION_INIT(pScreen, &region, &box, 1);
+    REGION_INTERSECT(pScreen, &region, &region, pRegion);
+    if (pDraw->type == DRAWABLE_WINDOW) {
+        REGION_TRANSLATE(pScreen, &region, pDraw->x, pDraw->y);
+        REGION_INTERSECT(pScreen, &region, &region, &((WindowPtr)pDraw)->clipList);
+        REGION_TRANSLATE(pScreen, &region, -pDraw->x, -pDraw->y);
+    }
+
+    if (!REGION_NOTEMPTY(pScreen, &region)) {
+        REGION_UNINIT(pScreen, &region);
+        return;
+    }
+    extents = REGION_EXTENTS(pScreen, &region);
+
+    if (MaliDRI2CopyRegion_g2d(pDraw, &region, umpbuf)) {
+        REGION_UNINIT(pScreen, &region);
+        return;
+    }
 
 #ifdef HAVE_LIBUMP_CACHE_CONTROL
     if (umpbuf->handle != UMP_INVALID_MEMORY_HANDLE) {
-        /* That's a normal UMP allocation, not a wrapped framebuffer */
-        ump_cache_operations_control(UMP_CACHE_OP_START);
-        ump_switch_hw_usage_secure_id(umpbuf->secure_id, UMP_USED_BY_CPU);
-        ump_cache_operations_control(UMP_CACHE_OP_FINISH);
+        /*
+         * That's a normal UMP allocation, not a wrapped framebuffer. The
+         * CPU only reads from it, so it is enough to invalidate the cache
+         * for the affected rows instead of switching the whole buffer to
+         * the CPU and back to Mali.
+         */
+        ump_cpu_msync_now(umpbuf->handle, UMP_MSYNC_CLEAN_AND_INVALIDATE,
+                          umpbuf->addr + umpbuf->offs + extents->y1 * umpbuf->pitch,
+                          (extents->y2 - extents->y1) * umpbuf->pitch);
     }
 #endif
 
@@ -621,22 +842,16 @@ static void MaliDRI2CopyRegion_copy(DrawablePtr      pDraw,
                                             umpbuf->pitch,
                                             umpbuf->addr + umpbuf->offs);
     copyRegion = REGION_CREATE(pScreen, NULL, 0);
-    REGION_COPY(pScreen, copyRegion, pRegion);
+    REGION_COPY(pScreen, copyRegion, &region);
     (*pGC->funcs->ChangeClip)(pGC, CT_REGION, copyRegion, 0);
     ValidateGC(pDraw, pGC);
-    (*pGC->ops->CopyArea)((DrawablePtr)pScratchPixmap, pDraw, pGC, 0, 0,
-                          pDraw->width, pDraw->height, 0, 0);
+    (*pGC->ops->CopyArea)((DrawablePtr)pScratchPixmap, pDraw, pGC,
+                          extents->x1, extents->y1,
+                          extents->x2 - extents->x1, extents->y2 - extents->y1,
+                          extents->x1, extents->y1);
     FreeScratchPixmapHeader(pScratchPixmap);
     FreeScratchGC(pGC);
-
-#ifdef HAVE_LIBUMP_CACHE_CONTROL
-    if (umpbuf->handle != UMP_INVALID_MEMORY_HANDLE) {
-        /* That's a normal UMP allocation, not a wrapped framebuffer */
-        ump_cache_operations_control(UMP_CACHE_OP_START);
-        ump_switch_hw_usage_secure_id(umpbuf->secure_id, UMP_USED_BY_MALI);
-        ump_cache_operations_control(UMP_CACHE_OP_FINISH);
-    }
-#endif
+    REGION_UNINIT(pScreen, &region);
 }
 
 static void FlushOverlay(ScreenPtr pScreen)
@@ -653,6 +868,61 @@ static void FlushOverlay(ScreenPtr pScreen)
     }
 }
 
+/*
+ * Windows using the spare layers. They are only added to the list when they
+ * get suitable buffers, but it's the job of UpdateSpareLayers to hand out
+ * the layers to them.
+ */
+static void SpareLayerWindowAdd(SunxiMaliDRI2 *mali, DRI2WindowStatePtr window_state)
+{
+    window_state->use_spare_layer = TRUE;
+    window_state->spare_layer_id = -1;
+    window_state->next_spare = mali->pSpareLayerWindows;
+    mali->pSpareLayerWindows = window_state;
+    mali->nSpareLayerWindows++;
+    mali->bSpareLayersOcclusionDirty = TRUE;
+    DebugMsg("Window %p may use a spare layer\n", window_state->pDraw);
+}
+
+/* Give the layer back, optionally copying its last frame to the window */
+static void SpareLayerDisable(ScrnInfoPtr pScrn, DRI2WindowStatePtr window_state,
+                              Bool flush)
+{
+    sunxi_disp_t *disp = SUNXI_DISP(pScrn);
+
+    if (flush && window_state->spare_layer_dirty_ump) {
+        MaliDRI2CopyRegion_copy(window_state->pDraw,
+                                &pScrn->pScreen->root->winSize,
+                                window_state->spare_layer_dirty_ump);
+    }
+    window_state->spare_layer_dirty_ump = NULL;
+
+    if (window_state->spare_layer_id >= 0) {
+        DebugMsg("Window %p releases spare layer %d\n", window_state->pDraw,
+                 window_state->spare_layer_id);
+        sunxi_spare_layer_free(disp, window_state->spare_layer_id);
+        window_state->spare_layer_id = -1;
+    }
+}
+
+static void SpareLayerWindowRemove(ScrnInfoPtr pScrn, DRI2WindowStatePtr window_state,
+                                   Bool flush)
+{
+    SunxiMaliDRI2 *mali = SUNXI_MALI_UMP_DRI2(pScrn);
+    DRI2WindowStatePtr *link = &mali->pSpareLayerWindows;
+
+    SpareLayerDisable(pScrn, window_state, flush);
+
+    while (*link && *link != window_state)
+        link = &(*link)->next_spare;
+    if (*link) {
+        *link = window_state->next_spare;
+        mali->nSpareLayerWindows--;
+    }
+    window_state->next_spare = NULL;
+    window_state->use_spare_layer = FALSE;
+}
+
 #ifdef DEBUG_WITH_RGB_PATTERN
 static void check_rgb_pattern(DRI2WindowStatePtr window_state,
                               UMPBufferInfoPtr umpbuf)
@@ -704,60 +974,22 @@ static void MaliDRI2CopyRegion(DrawablePtr   pDraw,
     SunxiMaliDRI2 *mali = SUNXI_MALI_UMP_DRI2(pScrn);
     UMPBufferInfoPtr umpbuf;
     sunxi_disp_t *disp = SUNXI_DISP(xf86Screens[pScreen->myNum]);
-    DRI2WindowStatePtr window_state = NULL;
-    HASH_FIND_PTR(mali->HashWindowState, &pDraw, window_state);
+    DRI2WindowStatePtr window_state;
+    BoxRec box;
 
     if (pDraw->type == DRAWABLE_PIXMAP) {
         DebugMsg("MaliDRI2CopyRegion has been called for pixmap %p\n", pDraw);
         return;
     }
 
+    window_state = MALI_DRI2_WINDOW_STATE(mali, pDraw);
     if (!window_state) {
-        DebugMsg("MaliDRI2CopyRegion: can't find window %p in the hash\n", pDraw);
+        DebugMsg("MaliDRI2CopyRegion: no DRI2 bookkeeping for window %p\n", pDraw);
         return;
     }
 
     /* Try to fetch a new UMP buffer from the queue */
-    umpbuf = umpbuf_fetch_from_queue(window_state);
-
-    /*
-     * In the case if the queue of incoming buffers is already empty and
-     * we are just swapping two allocated DRI2 buffers, we can do an extra
-     * sanity check. The normal behaviour is that the back buffer may change,
-     * and the front buffer may not. But if this is not the case, we need to
-     * take some corrective actions here.
-     */
-    if (!umpbuf && window_state->ump_front_buffer_ptr &&
-                   window_state->ump_front_buffer_ptr->addr &&
-                   window_state->ump_back_buffer_ptr &&
-                   window_state->ump_back_buffer_ptr->addr &&
-                   window_state->ump_front_buffer_ptr != window_state->ump_back_buffer_ptr) {
-
-        UMPBufferInfoPtr ump_front = window_state->ump_front_buffer_ptr;
-        UMPBufferInfoPtr ump_back = window_state->ump_back_buffer_ptr;
-
-        Bool front_modified = ump_front->has_checksum && !test_ump_checksum(ump_front);
-        Bool back_modified = ump_back->has_checksum && !test_ump_checksum(ump_back);
-
-        ump_front->has_checksum = FALSE;
-        ump_back->has_checksum = FALSE;
-
-        if (back_modified && !front_modified) {
-            /* That's normal, we have successfully passed this check */
-            ump_back->extra_flags |= UMPBUF_PASSED_ORDER_CHECK;
-            ump_front->extra_flags |= UMPBUF_PASSED_ORDER_CHECK;
-        }
-        else if (front_modified) {
-            /* That's bad, the order of buffers is messed up, but we can exchange them */
-            UMPBufferInfoPtr tmp               = window_state->ump_back_buffer_ptr;
-            window_state->ump_back_buffer_ptr  = window_state->ump_front_buffer_ptr;
-            window_state->ump_front_buffer_ptr = tmp;
-            DebugMsg("Unexpected modification of the front buffer detected.\n");
-        }
-        else {
-            /* Not enough information to make a decision yet */
-        }
-    }
+    umpbuf = umpbuf_fetch_from_queue(pScrn, window_state);
 
     /*
      * Swap back and front buffers. But also ensure that the buffer
@@ -797,26 +1029,30 @@ static void MaliDRI2CopyRegion(DrawablePtr   pDraw,
     check_rgb_pattern(window_state, umpbuf);
 #endif
 
-    /*
-     * Here we can calculate checksums over randomly sampled bytes from UMP
-     * buffers in order to check later whether they had been modified. This
-     * is skipped if the buffers have UMPBUF_PASSED_ORDER_CHECK flag set.
-     */
-    if (window_state->ump_front_buffer_ptr && window_state->ump_front_buffer_ptr->addr &&
-        window_state->ump_back_buffer_ptr && window_state->ump_back_buffer_ptr->addr &&
-        window_state->ump_front_buffer_ptr != window_state->ump_back_buffer_ptr) {
-
-        UMPBufferInfoPtr ump_front = window_state->ump_front_buffer_ptr;
-        UMPBufferInfoPtr ump_back = window_state->ump_back_buffer_ptr;
+    UpdateOverlay(pScreen);
 
-        if (!(ump_front->extra_flags & UMPBUF_PASSED_ORDER_CHECK))
-            save_ump_checksum(ump_front, window_state->buf_swap_cnt);
-        if (!(ump_back->extra_flags & UMPBUF_PASSED_ORDER_CHECK))
-            save_ump_checksum(ump_back, window_state->buf_swap_cnt);
+    if (window_state->spare_layer_id >= 0) {
+        /* Only the double buffered frames can be shown without tearing */
+        if (umpbuf->paddr && (umpbuf->extra_flags & (UMPBUF_MUST_BE_ODD_FRAME |
+                                                     UMPBUF_MUST_BE_EVEN_FRAME))) {
+            window_state->spare_layer_dirty_ump = umpbuf;
+            window_state->spare_layer_x = pDraw->x;
+            window_state->spare_layer_y = pDraw->y;
+            sunxi_spare_layer_set_output_window(disp, window_state->spare_layer_id,
+                                                pDraw->x, pDraw->y,
+                                                pDraw->width, pDraw->height);
+            sunxi_spare_layer_set_rgb_input_buffer(disp, window_state->spare_layer_id,
+                                                   umpbuf->cpp * 8, umpbuf->paddr,
+                                                   umpbuf->width, umpbuf->height,
+                                                   umpbuf->pitch / 4);
+            sunxi_spare_layer_show(disp, window_state->spare_layer_id);
+            if (mali->bSwapbuffersWait && !mali->vblank)
+                sunxi_wait_for_vsync(disp);
+            return;
+        }
+        SpareLayerDisable(pScrn, window_state, FALSE);
     }
 
-    UpdateOverlay(pScreen);
-
     if (!mali->bOverlayWinEnabled || umpbuf->handle != UMP_INVALID_MEMORY_HANDLE) {
         MaliDRI2CopyRegion_copy(pDraw, pRegion, umpbuf);
         mali->pOverlayDirtyUMP = NULL;
@@ -827,24 +1063,277 @@ static void MaliDRI2CopyRegion(DrawablePtr   pDraw,
     mali->pOverlayDirtyUMP = umpbuf;
 
     /* Activate the overlay */
-    sunxi_layer_set_output_window(disp, pDraw->x, pDraw->y, pDraw->width, pDraw->height);
-    sunxi_layer_set_rgb_input_buffer(disp, umpbuf->cpp * 8, umpbuf->offs,
-                                     umpbuf->width, umpbuf->height, umpbuf->pitch / 4);
+    OverlayOutputBox(mali, (WindowPtr)pDraw, &box);
+    sunxi_layer_set_output_window(disp, box.x1, box.y1,
+                                  box.x2 - box.x1, box.y2 - box.y1);
+    if (mali->bOverlayWinUpscaled)
+        sunxi_layer_set_scaled_rgb_input_buffer(disp, umpbuf->cpp * 8, umpbuf->offs,
+                                                umpbuf->width, umpbuf->height,
+                                                umpbuf->pitch / 4);
+    else
+        sunxi_layer_set_rgb_input_buffer(disp, umpbuf->cpp * 8, umpbuf->offs,
+                                         umpbuf->width, umpbuf->height,
+                                         umpbuf->pitch / 4);
     sunxi_layer_show(disp);
 
-    if (mali->bSwapbuffersWait) {
-        /* FIXME: blocking here for up to 1/60 second is not nice */
+    if (mali->bSwapbuffersWait && !mali->vblank) {
+        /* Blocking here for up to 1/60 second, but we have no vblank thread */
         sunxi_wait_for_vsync(disp);
     }
 }
 
 /************************************************************************/
 
-static void UpdateOverlay(ScreenPtr pScreen)
+/*
+ * Scheduled swaps and MSC waits. They are completed from the notifications
+ * sent by the vblank thread, so the X server never blocks waiting for vsync.
+ * A swap is done at the vblank before its target and gets reported as
+ * complete at the target vblank, the DRI2 code takes care of throttling
+ * the client until then.
+ */
+
+enum {
+    MALI_DRI2_SWAP,          /* do the swap, then report its completion */
+    MALI_DRI2_SWAP_COMPLETE, /* the swap is already done */
+    MALI_DRI2_WAIT_MSC,
+};
+
+typedef struct {
+    int                     type;
+    ScreenPtr               pScreen;
+    XID                     drawable_id;
+    /* The client is set to NULL by the resource code when it goes away */
+    ClientPtr               client;
+    XID                     client_id;
+    uint64_t                target_msc;
+    int                     complete_type;
+    DRI2SwapEventPtr        func;
+    void                   *data;
+} MaliDRI2FrameEventRec, *MaliDRI2FrameEventPtr;
+
+static RESTYPE       frame_event_client_type;
+static unsigned long frame_event_generation;
+
+static int MaliDRI2FrameEventClientGone(void *data, XID id)
+{
+    MaliDRI2FrameEventPtr ev = data;
+    ev->client = NULL;
+    return Success;
+}
+
+static MaliDRI2FrameEventPtr MaliDRI2NewFrameEvent(int              type,
+                                                   ClientPtr        client,
+                                                   DrawablePtr      pDraw,
+                                                   uint64_t         target_msc,
+                                                   DRI2SwapEventPtr func,
+                                                   void            *data)
+{
+    MaliDRI2FrameEventPtr ev = calloc(1, sizeof(MaliDRI2FrameEventRec));
+    if (!ev)
+        return NULL;
+
+    ev->type        = type;
+    ev->pScreen     = pDraw->pScreen;
+    ev->drawable_id = pDraw->id;
+    ev->client      = client;
+    ev->client_id   = FakeClientID(client->index);
+    ev->target_msc  = target_msc;
+    ev->func        = func;
+    ev->data        = data;
+
+    /* AddResource calls MaliDRI2FrameEventClientGone on failure */
+    if (!AddResource(ev->client_id, frame_event_client_type, ev)) {
+        free(ev);
+        return NULL;
+    }
+    return ev;
+}
+
+static void MaliDRI2FreeFrameEvent(MaliDRI2FrameEventPtr ev)
+{
+    if (ev->client)
+        FreeResourceByType(ev->client_id, frame_event_client_type, TRUE);
+    free(ev);
+}
+
+/* Swap the whole drawable right now, returns the DRI2 completion type */
+static int MaliDRI2SwapNow(DrawablePtr pDraw)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pDraw->pScreen->myNum];
+    SunxiMaliDRI2 *mali = SUNXI_MALI_UMP_DRI2(pScrn);
+    DRI2WindowStatePtr window_state;
+    RegionRec region;
+    BoxRec box;
+
+    box.x1 = 0;
+    box.y1 = 0;
+    box.x2 = pDraw->width;
+    box.y2 = pDraw->height;
+    RegionInit(&region, &box, 0);
+    MaliDRI2CopyRegion(pDraw, &region, NULL, NULL);
+    RegionUninit(&region);
+
+    window_state = pDraw->type == DRAWABLE_WINDOW ?
+                   MALI_DRI2_WINDOW_STATE(mali, pDraw) : NULL;
+    if ((mali->pOverlayDirtyUMP && mali->pOverlayWin == (WindowPtr)pDraw) ||
+        (window_state && window_state->spare_layer_dirty_ump))
+        return DRI2_FLIP_COMPLETE;
+    return DRI2_BLIT_COMPLETE;
+}
+
+static void MaliDRI2FrameEventHandler(void *data, uint64_t msc, uint64_t ust)
+{
+    MaliDRI2FrameEventPtr ev = data;
+    ScrnInfoPtr pScrn = xf86Screens[ev->pScreen->myNum];
+    SunxiMaliDRI2 *mali = SUNXI_MALI_UMP_DRI2(pScrn);
+    DrawablePtr pDraw;
+
+    if (!ev->client || dixLookupDrawable(&pDraw, ev->drawable_id, serverClient,
+                                         M_ANY, DixWriteAccess) != Success) {
+        MaliDRI2FreeFrameEvent(ev);
+        return;
+    }
+
+    switch (ev->type) {
+    case MALI_DRI2_SWAP:
+        ev->complete_type = MaliDRI2SwapNow(pDraw);
+        ev->type = MALI_DRI2_SWAP_COMPLETE;
+        if (fb_vblank_queue_event(mali->vblank, ev->target_msc,
+                                  MaliDRI2FrameEventHandler, ev) == 0)
+            return;
+        /* Can't wait for the target vblank, report the swap right away */
+        /* fall through */
+    case MALI_DRI2_SWAP_COMPLETE:
+        DRI2SwapComplete(ev->client, pDraw, msc, ust / 1000000, ust % 1000000,
+                         ev->complete_type, ev->func, ev->data);
+        break;
+    case MALI_DRI2_WAIT_MSC:
+        DRI2WaitMSCComplete(ev->client, pDraw, msc, ust / 1000000, ust % 1000000);
+        break;
+    }
+
+    MaliDRI2FreeFrameEvent(ev);
+}
+
+static int MaliDRI2GetMSC(DrawablePtr pDraw, CARD64 *ust, CARD64 *msc)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pDraw->pScreen->myNum];
+    SunxiMaliDRI2 *mali = SUNXI_MALI_UMP_DRI2(pScrn);
+    uint64_t cur_msc, cur_ust;
+
+    fb_vblank_get_msc(mali->vblank, &cur_msc, &cur_ust);
+    *msc = cur_msc;
+    *ust = cur_ust;
+    return TRUE;
+}
+
+static int MaliDRI2ScheduleSwap(ClientPtr        client,
+                                DrawablePtr      pDraw,
+                                DRI2BufferPtr    pDestBuffer,
+                                DRI2BufferPtr    pSrcBuffer,
+                                CARD64          *target_msc,
+                                CARD64           divisor,
+                                CARD64           remainder,
+                                DRI2SwapEventPtr func,
+                                void            *data)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pDraw->pScreen->myNum];
+    SunxiMaliDRI2 *mali = SUNXI_MALI_UMP_DRI2(pScrn);
+    MaliDRI2FrameEventPtr ev = NULL;
+    Bool swapped = FALSE;
+    int complete_type = DRI2_BLIT_COMPLETE;
+    uint64_t msc, ust;
+
+    fb_vblank_get_msc(mali->vblank, &msc, &ust);
+
+    /* The same rules as for glXSwapBuffersMscOML */
+    if (divisor == 0 || msc < *target_msc) {
+        if (msc >= *target_msc)
+            *target_msc = msc + 1;
+    }
+    else {
+        *target_msc = msc - msc % divisor + remainder;
+        if (*target_msc <= msc)
+            *target_msc += divisor;
+    }
+
+    if (!mali->bSwapbuffersWait || pDraw->type != DRAWABLE_WINDOW) {
+        /* Nothing to wait for */
+    }
+    else if (*target_msc > msc + 1) {
+        ev = MaliDRI2NewFrameEvent(MALI_DRI2_SWAP, client, pDraw, *target_msc,
+                                   func, data);
+        if (ev && fb_vblank_queue_event(mali->vblank, *target_msc - 1,
+                                        MaliDRI2FrameEventHandler, ev) == 0)
+            return TRUE;
+    }
+    else {
+        complete_type = MaliDRI2SwapNow(pDraw);
+        swapped = TRUE;
+        ev = MaliDRI2NewFrameEvent(MALI_DRI2_SWAP_COMPLETE, client, pDraw,
+                                   *target_msc, func, data);
+        if (ev) {
+            ev->complete_type = complete_type;
+            if (fb_vblank_queue_event(mali->vblank, *target_msc,
+                                      MaliDRI2FrameEventHandler, ev) == 0)
+                return TRUE;
+        }
+    }
+
+    /* Could not (or did not need to) schedule, so complete immediately */
+    if (ev)
+        MaliDRI2FreeFrameEvent(ev);
+    if (!swapped)
+        complete_type = MaliDRI2SwapNow(pDraw);
+    DRI2SwapComplete(client, pDraw, msc, ust / 1000000, ust % 1000000,
+                     complete_type, func, data);
+    return TRUE;
+}
+
+static int MaliDRI2ScheduleWaitMSC(ClientPtr   client,
+                                   DrawablePtr pDraw,
+                                   CARD64      target_msc,
+                                   CARD64      divisor,
+                                   CARD64      remainder)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pDraw->pScreen->myNum];
+    SunxiMaliDRI2 *mali = SUNXI_MALI_UMP_DRI2(pScrn);
+    MaliDRI2FrameEventPtr ev;
+    uint64_t msc, ust;
+
+    fb_vblank_get_msc(mali->vblank, &msc, &ust);
+
+    /* The same rules as for glXWaitForMscOML */
+    if (divisor != 0 && msc >= target_msc) {
+        target_msc = msc - msc % divisor + remainder;
+        if (target_msc <= msc)
+            target_msc += divisor;
+    }
+
+    if (target_msc > msc) {
+        ev = MaliDRI2NewFrameEvent(MALI_DRI2_WAIT_MSC, client, pDraw,
+                                   target_msc, NULL, NULL);
+        if (ev && fb_vblank_queue_event(mali->vblank, target_msc,
+                                        MaliDRI2FrameEventHandler, ev) == 0) {
+            DRI2BlockClient(client, pDraw);
+            return TRUE;
+        }
+        if (ev)
+            MaliDRI2FreeFrameEvent(ev);
+    }
+
+    DRI2WaitMSCComplete(client, pDraw, msc, ust / 1000000, ust % 1000000);
+    return TRUE;
+}
+
+/************************************************************************/
+
+static void UpdateMainOverlay(ScreenPtr pScreen)
 {
     ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
     SunxiMaliDRI2 *mali = SUNXI_MALI_UMP_DRI2(pScrn);
     sunxi_disp_t *disp = SUNXI_DISP(pScrn);
+    BoxRec box;
 
     if (!mali->pOverlayWin || !disp)
         return;
@@ -871,14 +1360,15 @@ static void UpdateOverlay(ScreenPtr pScreen)
     }
 
     /*
-     * Walk the windows tree to get the obscured/unobscured status of
-     * the window (because we can't rely on self->pOverlayWin->visibility
-     * for redirected windows).
+     * Update the obscured/unobscured status of the window, but only if the
+     * window tree has been changed since the last check. This way the DRI2
+     * swaps don't need to look at the other windows at all.
      */
-
-    mali->bWalkingAboveOverlayWin = FALSE;
-    mali->bOverlayWinOverlapped = FALSE;
-    FancyTraverseTree(pScreen->root, WindowWalker, mali);
+    if (mali->bOverlayOcclusionDirty) {
+        OverlayOutputBox(mali, mali->pOverlayWin, &box);
+        mali->bOverlayWinOverlapped = OverlayBoxIsOverlapped(mali->pOverlayWin, &box);
+        mali->bOverlayOcclusionDirty = FALSE;
+    }
 
     /* If the window got overlapped -> disable overlay */
     if (mali->bOverlayWinOverlapped && mali->bOverlayWinEnabled) {
@@ -897,10 +1387,9 @@ static void UpdateOverlay(ScreenPtr pScreen)
         mali->overlay_x = mali->pOverlayWin->drawable.x;
         mali->overlay_y = mali->pOverlayWin->drawable.y;
 
-        sunxi_layer_set_output_window(disp, mali->pOverlayWin->drawable.x,
-                                      mali->pOverlayWin->drawable.y,
-                                      mali->pOverlayWin->drawable.width,
-                                      mali->pOverlayWin->drawable.height);
+        OverlayOutputBox(mali, mali->pOverlayWin, &box);
+        sunxi_layer_set_output_window(disp, box.x1, box.y1,
+                                      box.x2 - box.x1, box.y2 - box.y1);
         DebugMsg("Move overlay to (%d, %d)\n", mali->overlay_x, mali->overlay_y);
     }
 
@@ -912,6 +1401,77 @@ static void UpdateOverlay(ScreenPtr pScreen)
     }
 }
 
+/*
+ * Hand out the spare layers to the windows, which are not obscured. Such
+ * windows can't overlap each other, so the order between them does not
+ * matter. Obscured or unmapped windows give their layers back first, so that
+ * the layers can move to the other windows. The windows left without a layer
+ * just get their buffers copied on swaps.
+ */
+static void UpdateSpareLayers(ScreenPtr pScreen)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+    SunxiMaliDRI2 *mali = SUNXI_MALI_UMP_DRI2(pScrn);
+    sunxi_disp_t *disp = SUNXI_DISP(pScrn);
+    DRI2WindowStatePtr window_state;
+
+    if (!mali->pSpareLayerWindows || !disp)
+        return;
+
+    if (mali->bSpareLayersOcclusionDirty) {
+        for (window_state = mali->pSpareLayerWindows; window_state;
+             window_state = window_state->next_spare) {
+            WindowPtr pWin = (WindowPtr)window_state->pDraw;
+            window_state->spare_layer_overlapped = !pWin->mapped ||
+                                                   OverlayWinIsOverlapped(pWin);
+        }
+        mali->bSpareLayersOcclusionDirty = FALSE;
+    }
+
+    /* The layers would hide the software cursor, just like the overlay */
+    for (window_state = mali->pSpareLayerWindows; window_state;
+         window_state = window_state->next_spare) {
+        if (window_state->spare_layer_id >= 0 &&
+            (window_state->spare_layer_overlapped || !mali->bHardwareCursorIsInUse))
+            SpareLayerDisable(pScrn, window_state, TRUE);
+    }
+
+    if (!mali->bHardwareCursorIsInUse)
+        return;
+
+    for (window_state = mali->pSpareLayerWindows; window_state;
+         window_state = window_state->next_spare) {
+        DrawablePtr pDraw = window_state->pDraw;
+
+        if (window_state->spare_layer_overlapped)
+            continue;
+
+        if (window_state->spare_layer_id < 0) {
+            /* The layer gets shown on the next swap */
+            window_state->spare_layer_id = sunxi_spare_layer_alloc(disp);
+            if (window_state->spare_layer_id < 0)
+                break;
+            DebugMsg("Window %p got spare layer %d\n", pDraw,
+                     window_state->spare_layer_id);
+        }
+        else if (window_state->spare_layer_x != pDraw->x ||
+                 window_state->spare_layer_y != pDraw->y) {
+            window_state->spare_layer_x = pDraw->x;
+            window_state->spare_layer_y = pDraw->y;
+            sunxi_spare_layer_set_output_window(disp, window_state->spare_layer_id,
+                                                pDraw->x, pDraw->y,
+                                                pDraw->width, pDraw->height);
+        }
+    }
+}
+
+/* The main overlay window goes first, then the rest of GLES windows */
+static void UpdateOverlay(ScreenPtr pScreen)
+{
+    UpdateMainOverlay(pScreen);
+    UpdateSpareLayers(pScreen);
+}
+
 static Bool
 DestroyWindow(WindowPtr pWin)
 {
@@ -920,11 +1480,13 @@ DestroyWindow(WindowPtr pWin)
     SunxiMaliDRI2 *mali = SUNXI_MALI_UMP_DRI2(pScrn);
     Bool ret;
     DrawablePtr pDraw = &pWin->drawable;
-    DRI2WindowStatePtr window_state = NULL;
-    HASH_FIND_PTR(mali->HashWindowState, &pDraw, window_state);
+    DRI2WindowStatePtr window_state = MALI_DRI2_WINDOW_STATE(mali, pDraw);
     if (window_state) {
         DebugMsg("Free DRI2 bookkeeping for window %p\n", pWin);
-        HASH_DEL(mali->HashWindowState, window_state);
+        dixSetPrivate(&pWin->devPrivates, &MaliDRI2WindowStateKeyRec, NULL);
+        mali->nWindowStates--;
+        if (window_state->use_spare_layer)
+            SpareLayerWindowRemove(pScrn, window_state, FALSE);
         if (window_state->ump_mem_buffer_ptr)
             unref_ump_buffer_info(window_state->ump_mem_buffer_ptr);
         if (window_state->ump_back_buffer_ptr)
@@ -937,7 +1499,9 @@ DestroyWindow(WindowPtr pWin)
     if (pWin == mali->pOverlayWin) {
         sunxi_disp_t *disp = SUNXI_DISP(pScrn);
         sunxi_layer_hide(disp);
+        sunxi_layer_unclaim(disp, mali);
         mali->pOverlayWin = NULL;
+        mali->bOverlayWinUpscaled = FALSE;
         DebugMsg("DestroyWindow %p\n", pWin);
     }
 
@@ -949,6 +1513,47 @@ DestroyWindow(WindowPtr pWin)
     return ret;
 }
 
+/*
+ * Any clip list change or restacking may change whether the overlay window
+ * is overlapped. Just take a note here, the check itself is done at most
+ * once from UpdateOverlay.
+ */
+static void
+ClipNotify(WindowPtr pWin, int dx, int dy)
+{
+    ScreenPtr pScreen = pWin->drawable.pScreen;
+    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+    SunxiMaliDRI2 *mali = SUNXI_MALI_UMP_DRI2(pScrn);
+
+    mali->bOverlayOcclusionDirty = TRUE;
+    mali->bSpareLayersOcclusionDirty = TRUE;
+
+    if (mali->ClipNotify) {
+        pScreen->ClipNotify = mali->ClipNotify;
+        (*pScreen->ClipNotify) (pWin, dx, dy);
+        mali->ClipNotify = pScreen->ClipNotify;
+        pScreen->ClipNotify = ClipNotify;
+    }
+}
+
+static void
+RestackWindow(WindowPtr pWin, WindowPtr pOldNextSib)
+{
+    ScreenPtr pScreen = pWin->drawable.pScreen;
+    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+    SunxiMaliDRI2 *mali = SUNXI_MALI_UMP_DRI2(pScrn);
+
+    mali->bOverlayOcclusionDirty = TRUE;
+    mali->bSpareLayersOcclusionDirty = TRUE;
+
+    if (mali->RestackWindow) {
+        pScreen->RestackWindow = mali->RestackWindow;
+        (*pScreen->RestackWindow) (pWin, pOldNextSib);
+        mali->RestackWindow = pScreen->RestackWindow;
+        pScreen->RestackWindow = RestackWindow;
+    }
+}
+
 static void
 PostValidateTree(WindowPtr pWin, WindowPtr pLayerWin, VTKind kind)
 {
@@ -956,6 +1561,10 @@ PostValidateTree(WindowPtr pWin, WindowPtr pLayerWin, VTKind kind)
     ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
     SunxiMaliDRI2 *mali = SUNXI_MALI_UMP_DRI2(pScrn);
 
+    /* Mapping, unmapping, moving or resizing windows always ends up here */
+    mali->bOverlayOcclusionDirty = TRUE;
+    mali->bSpareLayersOcclusionDirty = TRUE;
+
     if (mali->PostValidateTree) {
         pScreen->PostValidateTree = mali->PostValidateTree;
         (*pScreen->PostValidateTree) (pWin, pLayerWin, kind);
@@ -977,11 +1586,21 @@ GetImage(DrawablePtr pDrawable, int x, int y, int w, int h,
     ScreenPtr pScreen = pDrawable->pScreen;
     ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
     SunxiMaliDRI2 *mali = SUNXI_MALI_UMP_DRI2(pScrn);
+    DRI2WindowStatePtr window_state;
 
     /* FIXME: more precise check */
     if (mali->pOverlayDirtyUMP)
         FlushOverlay(pScreen);
 
+    for (window_state = mali->pSpareLayerWindows; window_state;
+         window_state = window_state->next_spare) {
+        if (window_state->spare_layer_dirty_ump) {
+            MaliDRI2CopyRegion_copy(window_state->pDraw, &pScreen->root->winSize,
+                                    window_state->spare_layer_dirty_ump);
+            window_state->spare_layer_dirty_ump = NULL;
+        }
+    }
+
     if (mali->GetImage) {
         pScreen->GetImage = mali->GetImage;
         (*pScreen->GetImage) (pDrawable, x, y, w, h, format, planeMask, d);
@@ -997,8 +1616,7 @@ DestroyPixmap(PixmapPtr pPixmap)
     ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
     SunxiMaliDRI2 *mali = SUNXI_MALI_UMP_DRI2(pScrn);
     Bool result;
-    UMPBufferInfoPtr umpbuf;
-    HASH_FIND_PTR(mali->HashPixmapToUMP, &pPixmap, umpbuf);
+    UMPBufferInfoPtr umpbuf = MALI_DRI2_PIXMAP_UMP(mali, pPixmap);
 
     if (umpbuf) {
         DebugMsg("DestroyPixmap %p for migrated UMP pixmap (UMP buffer=%p)\n", pPixmap, umpbuf);
@@ -1006,7 +1624,8 @@ DestroyPixmap(PixmapPtr pPixmap)
         pPixmap->devKind = umpbuf->BackupDevKind;
         pPixmap->devPrivate.ptr = umpbuf->BackupDevPrivatePtr;
 
-        HASH_DEL(mali->HashPixmapToUMP, umpbuf);
+        dixSetPrivate(&pPixmap->devPrivates, &MaliDRI2PixmapUMPKeyRec, NULL);
+        mali->nMigratedPixmaps--;
         umpbuf->pPixmap = NULL;
         unref_ump_buffer_info(umpbuf);
     }
@@ -1085,7 +1704,9 @@ static const char *driverNamesWithVDPAU[2] = {
 
 SunxiMaliDRI2 *SunxiMaliDRI2_Init(ScreenPtr pScreen,
                                   Bool      bUseOverlay,
-                                  Bool      bSwapbuffersWait)
+                                  Bool      bSwapbuffersWait,
+                                  Bool      bOverlayUpscale,
+                                  int       PoolSizeMB)
 {
     int drm_fd;
     DRI2InfoRec info = { 0 };
@@ -1093,6 +1714,7 @@ SunxiMaliDRI2 *SunxiMaliDRI2_Init(ScreenPtr pScreen,
     ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
     sunxi_disp_t *disp = SUNXI_DISP(pScrn);
     Bool have_sunxi_cedar = TRUE;
+    size_t pool_size;
 
     if (!xf86LoadKernelModule("mali"))
         xf86DrvMsg(pScreen->myNum, X_INFO, "can't load 'mali' kernel module\n");
@@ -1118,6 +1740,13 @@ SunxiMaliDRI2 *SunxiMaliDRI2_Init(ScreenPtr pScreen,
         return NULL;
     }
 
+    if (!dixRegisterPrivateKey(&MaliDRI2WindowStateKeyRec, PRIVATE_WINDOW, 0) ||
+        !dixRegisterPrivateKey(&MaliDRI2PixmapUMPKeyRec, PRIVATE_PIXMAP, 0)) {
+        drmClose(drm_fd);
+        ErrorF("SunxiMaliDRI2_Init: dixRegisterPrivateKey failed\n");
+        return NULL;
+    }
+
     if (!(mali = calloc(1, sizeof(SunxiMaliDRI2)))) {
         ErrorF("SunxiMaliDRI2_Init: calloc failed\n");
         return NULL;
@@ -1148,7 +1777,7 @@ SunxiMaliDRI2 *SunxiMaliDRI2_Init(ScreenPtr pScreen,
             mali->ump_fb_secure_id = UMP_INVALID_SECURE_ID;
             mali->ump_alternative_fb_secure_id = UMP_INVALID_SECURE_ID;
         }
-        if (disp->framebuffer_size - disp->gfx_layer_size <
+        if (disp->offscreen_end - disp->gfx_layer_size <
                                                  disp->xres * disp->yres * 4 * 2) {
             int needed_fb_num = (disp->xres * disp->yres * 4 * 2 +
                                  disp->gfx_layer_size - 1) / disp->gfx_layer_size + 1;
@@ -1189,6 +1818,16 @@ SunxiMaliDRI2 *SunxiMaliDRI2_Init(ScreenPtr pScreen,
     xf86DrvMsg(pScreen->myNum, X_INFO, "Wait on SwapBuffers? %s\n",
                bSwapbuffersWait ? "enabled" : "disabled");
 
+    /* By default keep up to two fullscreen 32bpp buffers for reuse */
+    if (PoolSizeMB < 0)
+        pool_size = (size_t)pScrn->virtualX * pScrn->virtualY * 4 * 2;
+    else
+        pool_size = (size_t)PoolSizeMB * 1024 * 1024;
+    if (pool_size > 0 && (mali->ump_pool = ump_pool_init(pool_size)))
+        xf86DrvMsg(pScreen->myNum, X_INFO,
+                   "keeping up to %d KiB of released UMP buffers for reuse\n",
+                   (int)(pool_size / 1024));
+
     info.version = 4;
 
     if (have_sunxi_cedar) {
@@ -1208,7 +1847,26 @@ SunxiMaliDRI2 *SunxiMaliDRI2_Init(ScreenPtr pScreen,
     info.DestroyBuffer = MaliDRI2DestroyBuffer;
     info.CopyRegion = MaliDRI2CopyRegion;
 
+    if (frame_event_generation != serverGeneration) {
+        frame_event_client_type = CreateNewResourceType(
+                           MaliDRI2FrameEventClientGone, "MaliDRI2FrameEvent");
+        frame_event_generation = serverGeneration;
+    }
+
+    /* The vblank thread of the screen, shared with the hardware cursor */
+    if (disp && frame_event_client_type)
+        mali->vblank = FB_VBLANK(pScrn);
+
+    if (mali->vblank) {
+        info.ScheduleSwap = MaliDRI2ScheduleSwap;
+        info.GetMSC = MaliDRI2GetMSC;
+        info.ScheduleWaitMSC = MaliDRI2ScheduleWaitMSC;
+        xf86DrvMsg(pScreen->myNum, X_INFO,
+                   "using a vblank thread for scheduling DRI2 swaps\n");
+    }
+
     if (!DRI2ScreenInit(pScreen, &info)) {
+        ump_pool_close(mali->ump_pool);
         drmClose(drm_fd);
         free(mali);
         return NULL;
@@ -1222,6 +1880,12 @@ SunxiMaliDRI2 *SunxiMaliDRI2_Init(ScreenPtr pScreen,
         /* Wrap the current PostValidateTree function */
         mali->PostValidateTree = pScreen->PostValidateTree;
         pScreen->PostValidateTree = PostValidateTree;
+        /* Wrap the current ClipNotify function */
+        mali->ClipNotify = pScreen->ClipNotify;
+        pScreen->ClipNotify = ClipNotify;
+        /* Wrap the current RestackWindow function */
+        mali->RestackWindow = pScreen->RestackWindow;
+        pScreen->RestackWindow = RestackWindow;
         /* Wrap the current GetImage function */
         mali->GetImage = pScreen->GetImage;
         pScreen->GetImage = GetImage;
@@ -1239,6 +1903,19 @@ SunxiMaliDRI2 *SunxiMaliDRI2_Init(ScreenPtr pScreen,
 
         mali->drm_fd = drm_fd;
         mali->bSwapbuffersWait = bSwapbuffersWait;
+        mali->bOverlayUpscale = bOverlayUpscale;
+        if (bOverlayUpscale) {
+            mali->upscale_atom = MakeAtom(FBTURBO_UPSCALE_PROPERTY,
+                                          strlen(FBTURBO_UPSCALE_PROPERTY), TRUE);
+            if (!disp || !disp->layer_has_scaler)
+                xf86DrvMsg(pScreen->myNum, X_WARNING,
+                           "DRI2OverlayUpscale needs a disp layer with a scaler\n");
+        }
+
+        if (CPU_BACKEND(pScrn))
+            mali->memcpy_to_uncached = CPU_BACKEND(pScrn)->memcpy_to_uncached;
+        else
+            mali->memcpy_to_uncached = memcpy_to_uncached_generic;
         return mali;
     }
 }
@@ -1252,6 +1929,8 @@ void SunxiMaliDRI2_Close(ScreenPtr pScreen)
     /* Unwrap functions */
     pScreen->DestroyWindow    = mali->DestroyWindow;
     pScreen->PostValidateTree = mali->PostValidateTree;
+    pScreen->ClipNotify       = mali->ClipNotify;
+    pScreen->RestackWindow    = mali->RestackWindow;
     pScreen->GetImage         = mali->GetImage;
     pScreen->DestroyPixmap    = mali->DestroyPixmap;
 
@@ -1260,6 +1939,17 @@ void SunxiMaliDRI2_Close(ScreenPtr pScreen)
         hwc->DisableHWCursor = mali->DisableHWCursor;
     }
 
+    /* The pending swaps have been flushed by closing the vblank thread */
+    mali->vblank = NULL;
+
+    if (mali->ump_pool) {
+        xf86DrvMsgVerb(pScreen->myNum, X_INFO, 3,
+                       "UMP buffer pool: %lu allocations reused, %lu new\n",
+                       mali->ump_pool->hits, mali->ump_pool->misses);
+        ump_pool_close(mali->ump_pool);
+        mali->ump_pool = NULL;
+    }
+
     if (mali->ump_null_handle1 != UMP_INVALID_MEMORY_HANDLE)
         ump_reference_release(mali->ump_null_handle1);
     if (mali->ump_null_handle2 != UMP_INVALID_MEMORY_HANDLE)
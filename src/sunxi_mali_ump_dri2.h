@@ -27,14 +27,14 @@
 #include <ump/ump.h>
 #include <ump/ump_ref_drv.h>
 
-#include "uthash.h"
+#include "privates.h"
+
+#include "dri2_buf_queue.h"
+#include "fb_vblank.h"
+#include "ump_pool.h"
 
 #define UMPBUF_MUST_BE_ODD_FRAME  1
 #define UMPBUF_MUST_BE_EVEN_FRAME 2
-#define UMPBUF_PASSED_ORDER_CHECK 4
-
-/* The number of bytes randomly sampled from UMP buffer to detect its change */
-#define RANDOM_SAMPLES_COUNT      64
 
 /* Data structure with the information about an UMP buffer */
 typedef struct
@@ -44,11 +44,16 @@ typedef struct
     int                     BackupDevKind;
     void                   *BackupDevPrivatePtr;
     int                     refcount;
-    UT_hash_handle          hh;
 
     ump_handle              handle;
     size_t                  size;
     uint8_t                *addr;
+    /* The pool, which gets the handle back when the buffer is freed */
+    ump_pool_t             *pool;
+    size_t                  pool_size;
+    int                     pool_constraints;
+    /* Physical address of the buffer for G2D (0 if unknown) */
+    uintptr_t               paddr;
     int                     depth;
     size_t                  width;
     size_t                  height;
@@ -58,11 +63,6 @@ typedef struct
     unsigned int            pitch;
     unsigned int            cpp;
     unsigned int            offs;
-
-    /* This allows us to track buffer modifications */
-    Bool                    has_checksum;
-    uint32_t                checksum;
-    uint32_t                checksum_seed;
 } UMPBufferInfoRec, *UMPBufferInfoPtr;
 
 /*
@@ -87,9 +87,8 @@ typedef struct
  * to trigger when the window size changes exactly between steps 1 and 3.
  * See test/gles-yellow-blue-flip.c program which demonstrates this.
  */
-typedef struct
+typedef struct _DRI2WindowStateRec
 {
-    UT_hash_handle          hh;
     DrawablePtr             pDraw;
     /* width and height must be the same for back and front buffers */
     int                     width, height;
@@ -105,13 +104,24 @@ typedef struct
     UMPBufferInfoPtr        ump_back_buffer_ptr;
     UMPBufferInfoPtr        ump_front_buffer_ptr;
 
+    /* The queue for incoming UMP buffers (see dri2_buf_queue.h) */
+    dri2_buf_queue_t        ump_queue;
+
     /*
-     * The queue for incoming UMP buffers. We need to have it because DRI2
-     * buffer requests and buffer swaps sometimes may come out of order.
+     * The GLES windows other than the overlay window may still scan out
+     * from their own buffers via the spare disp layers. Their back buffers
+     * are then allocated physically contiguous for every request and get
+     * swapped just like the overlay buffers in the framebuffer. The layer
+     * itself is only held while the window is not obscured, and it
+     * is -1 otherwise (the buffers are copied to the window then).
      */
-    UMPBufferInfoPtr        ump_queue[16];
-    int                     ump_queue_head;
-    int                     ump_queue_tail;
+    Bool                    use_spare_layer;
+    int                     spare_layer_id;
+    int                     spare_layer_x, spare_layer_y;
+    Bool                    spare_layer_overlapped;
+    /* The buffer shown by the layer and not yet copied to the window */
+    UMPBufferInfoPtr        spare_layer_dirty_ump;
+    struct _DRI2WindowStateRec *next_spare;
 
     /*
      * In the case DEBUG_WITH_RGB_PATTERN is defined, we add extra debugging
@@ -134,7 +144,19 @@ typedef struct {
     UMPBufferInfoPtr        pOverlayDirtyUMP;
     Bool                    bOverlayWinEnabled;
     Bool                    bOverlayWinOverlapped;
-    Bool                    bWalkingAboveOverlayWin;
+    /* The window tree has changed, bOverlayWinOverlapped may be stale */
+    Bool                    bOverlayOcclusionDirty;
+
+    /* The windows using the spare disp layers, linked by next_spare */
+    DRI2WindowStatePtr      pSpareLayerWindows;
+    int                     nSpareLayerWindows;
+    /* The same as bOverlayOcclusionDirty, but for these windows */
+    Bool                    bSpareLayersOcclusionDirty;
+
+    /* Show the windows with FBTURBO_UPSCALE_PROPERTY scaled to fullscreen */
+    Bool                    bOverlayUpscale;
+    Atom                    upscale_atom;
+    Bool                    bOverlayWinUpscaled;
 
     Bool                    bHardwareCursorIsInUse;
     EnableHWCursorProcPtr   EnableHWCursor;
@@ -142,6 +164,8 @@ typedef struct {
 
     DestroyWindowProcPtr    DestroyWindow;
     PostValidateTreeProcPtr PostValidateTree;
+    ClipNotifyProcPtr       ClipNotify;
+    RestackWindowProcPtr    RestackWindow;
     GetImageProcPtr         GetImage;
     DestroyPixmapProcPtr    DestroyPixmap;
 
@@ -154,18 +178,45 @@ typedef struct {
     ump_handle              ump_null_handle1;
     ump_handle              ump_null_handle2;
 
-    UMPBufferInfoPtr        HashPixmapToUMP;
-    DRI2WindowStatePtr      HashWindowState;
+    /*
+     * The number of windows with DRI2 bookkeeping attached and pixmaps
+     * migrated to UMP buffers. The wrappers don't even need to look at
+     * the drawable privates while these are zero.
+     */
+    int                     nWindowStates;
+    int                     nMigratedPixmaps;
+
+    /* Used for copying the migrated pixmaps to the UMP buffers */
+    void                  (*memcpy_to_uncached)(void *dst, const void *src,
+                                                size_t size);
 
     int                     drm_fd;
 
+    /* Released UMP buffers, kept for reuse (may be NULL) */
+    ump_pool_t             *ump_pool;
+
     /* Wait for vsync when swapping DRI2 buffers */
     Bool                    bSwapbuffersWait;
+    /* Vblank events for the scheduled swaps and MSC waits (may be NULL) */
+    fb_vblank_t            *vblank;
 } SunxiMaliDRI2;
 
+/*
+ * The window property, which lets the GLES applications render at a lower
+ * resolution. Their windows get shown by the overlay scaled to the whole
+ * screen if the DRI2OverlayUpscale option is enabled.
+ */
+#define FBTURBO_UPSCALE_PROPERTY "_FBTURBO_UPSCALE"
+
+/*
+ * PoolSizeMB limits the size of the released UMP buffers kept for reuse,
+ * -1 selects the default and 0 disables the pool.
+ */
 SunxiMaliDRI2 *SunxiMaliDRI2_Init(ScreenPtr pScreen,
                                   Bool      bUseOverlay,
-                                  Bool      bSwapbuffersWait);
+                                  Bool      bSwapbuffersWait,
+                                  Bool      bOverlayUpscale,
+                                  int       PoolSizeMB);
 void SunxiMaliDRI2_Close(ScreenPtr pScreen);
 
 #endif
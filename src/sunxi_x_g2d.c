@@ -35,10 +35,39 @@
 #include "damage.h"
 #include "fb.h"
 #include "gcstruct.h"
+#include "picturestr.h"
+#include "mipict.h"
 
 #include "fbdev_priv.h"
 #include "sunxi_x_g2d.h"
 
+static int
+TraceDrawableKind(DrawablePtr pDrawable)
+{
+    return pDrawable->type == DRAWABLE_WINDOW ? BLT_TRACE_WINDOW :
+                                                BLT_TRACE_PIXMAP;
+}
+
+/* Record the boxes in the coordinates of the underlying pixmaps */
+static void
+TraceCopy(blt_trace_t *trace, int op,
+          DrawablePtr pSrcDrawable, DrawablePtr pDstDrawable,
+          BoxPtr pbox, int nbox, int dx, int dy,
+          int srcBpp, int srcXoff, int srcYoff,
+          int dstBpp, int dstXoff, int dstYoff)
+{
+    blt_trace_begin(trace, op, TraceDrawableKind(pSrcDrawable),
+                    TraceDrawableKind(pDstDrawable), srcBpp, dstBpp,
+                    dx + srcXoff - dstXoff, dy + srcYoff - dstYoff,
+                    pSrcDrawable->width, pSrcDrawable->height);
+    while (nbox--) {
+        blt_trace_add_box(trace, pbox->x1 + dstXoff, pbox->y1 + dstYoff,
+                          pbox->x2 + dstXoff, pbox->y2 + dstYoff);
+        pbox++;
+    }
+    blt_trace_end(trace);
+}
+
 /*
  * The code below is borrowed from "xserver/fb/fbwindow.c"
  */
@@ -68,6 +97,11 @@ xCopyWindowProc(DrawablePtr pSrcDrawable,
     fbGetDrawable(pSrcDrawable, src, srcStride, srcBpp, srcXoff, srcYoff);
     fbGetDrawable(pDstDrawable, dst, dstStride, dstBpp, dstXoff, dstYoff);
 
+    if (private->trace)
+        TraceCopy(private->trace, BLT_TRACE_COPY_WINDOW,
+                  pSrcDrawable, pDstDrawable, pbox, nbox, dx, dy,
+                  srcBpp, srcXoff, srcYoff, dstBpp, dstXoff, dstYoff);
+
     while (nbox--) {
         if (!private->blt2d_overlapped_blt(private->blt2d_self,
                                            (uint32_t *)src, (uint32_t *)dst,
@@ -126,14 +160,15 @@ xCopyWindow(WindowPtr pWin, DDXPointRec ptOldOrg, RegionPtr prgnSrc)
 /*****************************************************************************/
 
 static void
-xCopyNtoN(DrawablePtr pSrcDrawable,
+CopyBoxes(int trace_op,
+          DrawablePtr pSrcDrawable,
           DrawablePtr pDstDrawable,
           GCPtr pGC,
           BoxPtr pbox,
           int nbox,
           int dx,
           int dy,
-          Bool reverse, Bool upsidedown, Pixel bitplane, void *closure)
+          Bool reverse, Bool upsidedown)
 {
     CARD8 alu = pGC ? pGC->alu : GXcopy;
     FbBits pm = pGC ? fbGetGCPrivate(pGC)->pm : FB_ALLONES;
@@ -152,6 +187,11 @@ xCopyNtoN(DrawablePtr pSrcDrawable,
     fbGetDrawable(pSrcDrawable, src, srcStride, srcBpp, srcXoff, srcYoff);
     fbGetDrawable(pDstDrawable, dst, dstStride, dstBpp, dstXoff, dstYoff);
 
+    if (private->trace)
+        TraceCopy(private->trace, trace_op,
+                  pSrcDrawable, pDstDrawable, pbox, nbox, dx, dy,
+                  srcBpp, srcXoff, srcYoff, dstBpp, dstXoff, dstYoff);
+
     while (nbox--) {
         /* first try G2D */
         Bool done = private->blt2d_overlapped_blt(
@@ -190,6 +230,20 @@ xCopyNtoN(DrawablePtr pSrcDrawable,
     fbFinishAccess(pSrcDrawable);
 }
 
+static void
+xCopyNtoN(DrawablePtr pSrcDrawable,
+          DrawablePtr pDstDrawable,
+          GCPtr pGC,
+          BoxPtr pbox,
+          int nbox,
+          int dx,
+          int dy,
+          Bool reverse, Bool upsidedown, Pixel bitplane, void *closure)
+{
+    CopyBoxes(BLT_TRACE_COPY_AREA, pSrcDrawable, pDstDrawable, pGC,
+              pbox, nbox, dx, dy, reverse, upsidedown);
+}
+
 static RegionPtr
 xCopyArea(DrawablePtr pSrcDrawable,
          DrawablePtr pDstDrawable,
@@ -260,6 +314,11 @@ static void xPutImage(DrawablePtr pDrawable,
 
     fbGetStipDrawable(pDrawable, dst, dstStride, dstBpp, dstXoff, dstYoff);
 
+    if (private->trace)
+        blt_trace_begin(private->trace, BLT_TRACE_PUT_IMAGE, BLT_TRACE_IMAGE,
+                        TraceDrawableKind(pDrawable), dstBpp, dstBpp,
+                        -(x + dstXoff), -(y + dstYoff), w, h);
+
     for (nbox = RegionNumRects(pClip),
         pbox = RegionRects(pClip); nbox--; pbox++) {
         x1 = x;
@@ -276,6 +335,9 @@ static void xPutImage(DrawablePtr pDrawable,
             y2 = pbox->y2;
         if (x1 >= x2 || y1 >= y2)
             continue;
+        if (private->trace)
+            blt_trace_add_box(private->trace, x1 + dstXoff, y1 + dstYoff,
+                              x2 + dstXoff, y2 + dstYoff);
         Bool done = FALSE;
         int w = x2 - x1;
         int h = y2 - y1;
@@ -298,9 +360,69 @@ static void xPutImage(DrawablePtr pDrawable,
                   w * dstBpp,
                   h, GXcopy, FB_ALLONES, dstBpp, FALSE, FALSE);
     }
+    if (private->trace)
+        blt_trace_end(private->trace);
     fbFinishAccess(pDrawable);
 }
 
+/*
+ * Composite's automatic redirection puts the contents of the backing
+ * pixmaps on the screen with PictOpSrc (compWindowUpdateAutomatic), not
+ * with CopyArea. Such plain copies from a pixmap go to the blit backends
+ * too, everything else is left to fbComposite.
+ */
+static void
+xComposite(CARD8 op, PicturePtr pSrc, PicturePtr pMask, PicturePtr pDst,
+           INT16 xSrc, INT16 ySrc, INT16 xMask, INT16 yMask,
+           INT16 xDst, INT16 yDst, CARD16 width, CARD16 height)
+{
+    ScreenPtr pScreen = pDst->pDrawable->pScreen;
+    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+    SunxiG2D *private = SUNXI_G2D(pScrn);
+    PictureScreenPtr ps = GetPictureScreen(pScreen);
+    DrawablePtr pSrcDrawable = pSrc->pDrawable;
+    DrawablePtr pDstDrawable = pDst->pDrawable;
+    PixmapPtr pDstPixmap;
+    RegionRec region;
+
+    if (op == PictOpSrc && !pMask && pSrcDrawable &&
+        pSrcDrawable->type == DRAWABLE_PIXMAP &&
+        !pSrc->transform && !pSrc->repeat && !pSrc->alphaMap &&
+        !pDst->alphaMap && pSrc->format == pDst->format &&
+        (pDstDrawable->bitsPerPixel == 32 ||
+         pDstDrawable->bitsPerPixel == 16) &&
+        /* nothing outside of the source, which would have to be cleared */
+        xSrc >= 0 && ySrc >= 0 && xSrc + width <= pSrcDrawable->width &&
+        ySrc + height <= pSrcDrawable->height) {
+
+        if (pDstDrawable->type == DRAWABLE_WINDOW)
+            pDstPixmap = (*pScreen->GetWindowPixmap) ((WindowPtr)pDstDrawable);
+        else
+            pDstPixmap = (PixmapPtr)pDstDrawable;
+
+        /* the overlapped copies would need the boxes in the right order */
+        if (pDstPixmap != (PixmapPtr)pSrcDrawable) {
+            if (miComputeCompositeRegion(&region, pSrc, NULL, pDst,
+                                         xSrc, ySrc, 0, 0, xDst, yDst,
+                                         width, height)) {
+                CopyBoxes(BLT_TRACE_COMPOSITE, pSrcDrawable, pDstDrawable,
+                          NULL, RegionRects(&region), RegionNumRects(&region),
+                          xSrc + pSrcDrawable->x - xDst - pDstDrawable->x,
+                          ySrc + pSrcDrawable->y - yDst - pDstDrawable->y,
+                          FALSE, FALSE);
+                RegionUninit(&region);
+            }
+            return;
+        }
+    }
+
+    ps->Composite = private->Composite;
+    (*ps->Composite) (op, pSrc, pMask, pDst, xSrc, ySrc, xMask, yMask,
+                      xDst, yDst, width, height);
+    private->Composite = ps->Composite;
+    ps->Composite = xComposite;
+}
+
 static Bool
 xCreateGC(GCPtr pGC)
 {
@@ -330,6 +452,7 @@ xCreateGC(GCPtr pGC)
 
 SunxiG2D *SunxiG2D_Init(ScreenPtr pScreen, blt2d_i *blt2d)
 {
+    PictureScreenPtr ps = GetPictureScreenIfSet(pScreen);
     SunxiG2D *private = calloc(1, sizeof(SunxiG2D));
     if (!private) {
         xf86DrvMsg(pScreen->myNum, X_INFO,
@@ -349,6 +472,12 @@ SunxiG2D *SunxiG2D_Init(ScreenPtr pScreen, blt2d_i *blt2d)
     private->CreateGC = pScreen->CreateGC;
     pScreen->CreateGC = xCreateGC;
 
+    /* Wrap the current Composite function, if there is Render */
+    if (ps) {
+        private->Composite = ps->Composite;
+        ps->Composite = xComposite;
+    }
+
     return private;
 }
 
@@ -356,9 +485,20 @@ void SunxiG2D_Close(ScreenPtr pScreen)
 {
     ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
     SunxiG2D *private = SUNXI_G2D(pScrn);
+    PictureScreenPtr ps = GetPictureScreenIfSet(pScreen);
 
     pScreen->CopyWindow = private->CopyWindow;
     pScreen->CreateGC   = private->CreateGC;
+    if (ps && private->Composite)
+        ps->Composite = private->Composite;
+
+    if (private->trace) {
+        xf86DrvMsg(pScreen->myNum, X_INFO,
+                   "SunxiG2D: recorded %lu blit trace records\n",
+                   private->trace->records);
+        blt_trace_close(private->trace);
+        private->trace = NULL;
+    }
 
     if (private->pGCOps) {
         free(private->pGCOps);
@@ -24,13 +24,17 @@
 #ifndef SUNXI_X_G2D_H
 #define SUNXI_X_G2D_H
 
+#include "picturestr.h"
+
 #include "interfaces.h"
+#include "blt_trace.h"
 
 typedef struct {
     GCOps                  *pGCOps;
 
     CopyWindowProcPtr       CopyWindow;
     CreateGCProcPtr         CreateGC;
+    CompositeProcPtr        Composite;
 
     /* SunxiG2D_Init copies these pointers here from blt2d_i struct */
     void *blt2d_self;
@@ -47,6 +51,9 @@ typedef struct {
                                 int       dst_y,
                                 int       w,
                                 int       h);
+
+    /* Optional recording of all the blits, see blt_trace.h */
+    blt_trace_t *trace;
 } SunxiG2D;
 
 SunxiG2D *SunxiG2D_Init(ScreenPtr pScreen, blt2d_i *blt2d);
@@ -0,0 +1,225 @@
+/*
+ * Copyright © 2016 fbturbo developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+
+#include "xf86.h"
+
+#include "sunxi_xvideo.h"
+
+static int sunxi_xv_set_input_buf(void     *data,
+                                  uint32_t  y_offs,
+                                  uint32_t  u_offs,
+                                  uint32_t  v_offs)
+{
+    sunxi_xvideo *self = (sunxi_xvideo *)data;
+    self->y_offs = y_offs;
+    self->u_offs = u_offs;
+    self->v_offs = v_offs;
+    self->dirty |= SUNXI_XV_DIRTY_BUF;
+    return 0;
+}
+
+static int sunxi_xv_set_input_par(void *data, int w, int h, int stride,
+                                  int x, int y)
+{
+    sunxi_xvideo *self = (sunxi_xvideo *)data;
+    self->src_w = w;
+    self->src_h = h;
+    self->src_stride = stride;
+    self->src_x = x;
+    self->src_y = y;
+    self->dirty |= SUNXI_XV_DIRTY_PAR;
+    return 0;
+}
+
+static int sunxi_xv_set_output_window(void *data, int x, int y, int w, int h)
+{
+    sunxi_xvideo *self = (sunxi_xvideo *)data;
+    self->drw_x = x;
+    self->drw_y = y;
+    self->drw_w = w;
+    self->drw_h = h;
+    self->dirty |= SUNXI_XV_DIRTY_WIN;
+    return 0;
+}
+
+static int sunxi_xv_show_window(void *data)
+{
+    sunxi_xvideo *self = (sunxi_xvideo *)data;
+    self->dirty |= SUNXI_XV_DIRTY_SHOW;
+    return 0;
+}
+
+/*
+ * Apply the pending changes. A new buffer address alone is just one
+ * ioctl, anything more than that goes through the disp command cache,
+ * so that the hardware gets the whole new configuration at once.
+ */
+static int sunxi_xv_commit(void *data)
+{
+    sunxi_xvideo *self = (sunxi_xvideo *)data;
+    sunxi_disp_t *disp = self->disp;
+    uint32_t dirty = self->dirty;
+    Bool batch;
+    int err = 0;
+
+    if (!dirty)
+        return 0;
+
+    /* A new source window invalidates the negative Y workaround */
+    if ((dirty & SUNXI_XV_DIRTY_PAR) && disp->layer_win_y < 0)
+        dirty |= SUNXI_XV_DIRTY_WIN;
+
+    batch = (dirty != SUNXI_XV_DIRTY_BUF);
+    if (batch)
+        sunxi_disp_start_cmd_cache(disp);
+
+    if (dirty & (SUNXI_XV_DIRTY_BUF | SUNXI_XV_DIRTY_PAR)) {
+        if (sunxi_layer_set_yuv420_input_buffer(disp, self->y_offs,
+                        self->u_offs, self->v_offs, self->src_w, self->src_h,
+                        self->src_stride, self->src_x, self->src_y) != 0)
+            err = -1;
+    }
+    if (dirty & SUNXI_XV_DIRTY_WIN) {
+        if (sunxi_layer_set_output_window(disp, self->drw_x, self->drw_y,
+                                          self->drw_w, self->drw_h) != 0)
+            err = -1;
+    }
+    if (dirty & SUNXI_XV_DIRTY_SHOW) {
+        if (sunxi_layer_show(disp) != 0)
+            err = -1;
+    }
+
+    if (batch)
+        sunxi_disp_execute_cmd_cache(disp);
+
+    self->dirty = 0;
+    return err;
+}
+
+static int sunxi_xv_hide_window(void *data)
+{
+    sunxi_xvideo *self = (sunxi_xvideo *)data;
+    self->dirty &= ~SUNXI_XV_DIRTY_SHOW;
+    /* The layer may be showing a DRI2 window now, leave it alone */
+    if (self->disp->layer_owner != self)
+        return 0;
+    sunxi_layer_unclaim(self->disp, self);
+    return sunxi_layer_hide(self->disp);
+}
+
+static int sunxi_xv_claim(void *data)
+{
+    sunxi_xvideo *self = (sunxi_xvideo *)data;
+    return sunxi_layer_claim(self->disp, self);
+}
+
+static int sunxi_xv_set_colorkey(void *data, uint32_t color)
+{
+    sunxi_xvideo *self = (sunxi_xvideo *)data;
+    return sunxi_layer_set_colorkey(self->disp, color);
+}
+
+static int sunxi_xv_disable_colorkey(void *data)
+{
+    sunxi_xvideo *self = (sunxi_xvideo *)data;
+    if (self->disp->layer_owner && self->disp->layer_owner != self)
+        return 0;
+    return sunxi_layer_disable_colorkey(self->disp);
+}
+
+static int sunxi_xv_get_screen_width(void *data)
+{
+    sunxi_xvideo *self = (sunxi_xvideo *)data;
+    return self->disp->xres;
+}
+
+static int sunxi_xv_get_screen_height(void *data)
+{
+    sunxi_xvideo *self = (sunxi_xvideo *)data;
+    return self->disp->yres;
+}
+
+static char *sunxi_xv_get_fb_mem(void *data)
+{
+    sunxi_xvideo *self = (sunxi_xvideo *)data;
+    return (char *)self->disp->framebuffer_addr;
+}
+
+static ssize_t sunxi_xv_get_visible_fb_size(void *data)
+{
+    sunxi_xvideo *self = (sunxi_xvideo *)data;
+    return self->disp->gfx_layer_size;
+}
+
+static ssize_t sunxi_xv_get_total_fb_size(void *data)
+{
+    sunxi_xvideo *self = (sunxi_xvideo *)data;
+    return self->disp->offscreen_end;
+}
+
+static void sunxi_xv_close(void *data)
+{
+    sunxi_xvideo *self = (sunxi_xvideo *)data;
+    sunxi_xv_hide_window(self);
+    free(self);
+}
+
+sunxi_xvideo *sunxi_xvideo_init(sunxi_disp_t *disp)
+{
+    sunxi_xvideo *self;
+
+    /* YUV layers can only be shown with a scaler */
+    if (!disp || disp->layer_id < 0 || !disp->layer_has_scaler)
+        return NULL;
+
+    if (!(self = calloc(1, sizeof(sunxi_xvideo))))
+        return NULL;
+
+    self->disp = disp;
+
+    self->intf.self = self;
+    self->intf.flags = XV_DOUBLEBUFFERING;
+    self->intf.set_yuv420_input_buffer = sunxi_xv_set_input_buf;
+    self->intf.set_input_par = sunxi_xv_set_input_par;
+    self->intf.set_output_window = sunxi_xv_set_output_window;
+    self->intf.show_window = sunxi_xv_show_window;
+    self->intf.hide_window = sunxi_xv_hide_window;
+    self->intf.set_colorkey = sunxi_xv_set_colorkey;
+    self->intf.disable_colorkey = sunxi_xv_disable_colorkey;
+    self->intf.claim = sunxi_xv_claim;
+    self->intf.commit = sunxi_xv_commit;
+    self->intf.get_screen_width = sunxi_xv_get_screen_width;
+    self->intf.get_screen_height = sunxi_xv_get_screen_height;
+    self->intf.get_fb_mem = sunxi_xv_get_fb_mem;
+    self->intf.get_visible_fb_size = sunxi_xv_get_visible_fb_size;
+    self->intf.get_total_fb_size = sunxi_xv_get_total_fb_size;
+    self->intf.close = sunxi_xv_close;
+
+    return self;
+}
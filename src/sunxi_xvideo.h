@@ -0,0 +1,54 @@
+/*
+ * Copyright © 2016 fbturbo developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SUNXI_XVIDEO_H
+#define SUNXI_XVIDEO_H
+
+#include "interfaces.h"
+#include "sunxi_disp.h"
+
+/* The parts of the layer configuration waiting for commit */
+#define SUNXI_XV_DIRTY_BUF    (1 << 0)
+#define SUNXI_XV_DIRTY_PAR    (1 << 1)
+#define SUNXI_XV_DIRTY_WIN    (1 << 2)
+#define SUNXI_XV_DIRTY_SHOW   (1 << 3)
+
+/* XVideo backend using a scaled sunxi disp layer as the overlay */
+typedef struct {
+    uint32_t      y_offs;
+    uint32_t      u_offs;
+    uint32_t      v_offs;
+
+    int           src_w, src_h, src_stride, src_x, src_y;
+    int           drw_x, drw_y, drw_w, drw_h;
+
+    uint32_t      dirty;
+
+    xvideo_i      intf;
+
+    sunxi_disp_t *disp;
+} sunxi_xvideo;
+
+sunxi_xvideo *sunxi_xvideo_init(sunxi_disp_t *disp);
+
+#endif
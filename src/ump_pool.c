@@ -0,0 +1,220 @@
+/*
+ * Copyright © 2016 fbturbo developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <time.h>
+
+#include <ump/ump.h>
+#include <ump/ump_ref_drv.h>
+
+#include "ump_pool.h"
+
+/* The cached buffers, which are not reused for this long, get released */
+#define UMP_POOL_MAX_AGE_MS     10000
+
+#define UMP_POOL_PAGE_SIZE      4096
+
+static uint64_t get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Round the size up to its size class and return the class index, or -1
+ * if the size is too large to be pooled. Up to 8 pages the classes are
+ * one page apart, above that there are 8 classes per power of two.
+ */
+static int size_class(size_t *size)
+{
+    size_t s = (*size + UMP_POOL_PAGE_SIZE - 1) & ~(size_t)(UMP_POOL_PAGE_SIZE - 1);
+    int e, idx;
+
+    if (s == 0)
+        s = UMP_POOL_PAGE_SIZE;
+
+    if (s <= UMP_POOL_PAGE_SIZE * 8) {
+        *size = s;
+        return s / UMP_POOL_PAGE_SIZE - 1;
+    }
+
+    /* s is in (2^e, 2^(e+1)], and is rounded up to a multiple of 2^(e-3) */
+    e = 63 - __builtin_clzll((unsigned long long)(s - 1));
+    s = (s + ((size_t)1 << (e - 3)) - 1) & ~(((size_t)1 << (e - 3)) - 1);
+    idx = 8 + (e - 15) * 8 + (int)(s >> (e - 3)) - 9;
+    if (idx >= UMP_POOL_SIZE_CLASSES)
+        return -1;
+
+    *size = s;
+    return idx;
+}
+
+static void evict(ump_pool_t *pool, ump_pool_entry_t *e)
+{
+    size_t class_size = e->size;
+    ump_pool_entry_t **pe = &pool->size_class[size_class(&class_size)];
+
+    while (*pe != e)
+        pe = &(*pe)->class_next;
+    *pe = e->class_next;
+
+    if (e->lru_prev)
+        e->lru_prev->lru_next = e->lru_next;
+    else
+        pool->lru_head = e->lru_next;
+    if (e->lru_next)
+        e->lru_next->lru_prev = e->lru_prev;
+    else
+        pool->lru_tail = e->lru_prev;
+
+    pool->cached_size -= e->size;
+}
+
+static void free_entry(ump_pool_entry_t *e)
+{
+    ump_mapped_pointer_release(e->handle);
+    ump_reference_release(e->handle);
+    free(e);
+}
+
+static void expire(ump_pool_t *pool)
+{
+    uint64_t now = get_time_ms();
+    ump_pool_entry_t *e;
+
+    while ((e = pool->lru_head) &&
+           now - e->release_time_ms > UMP_POOL_MAX_AGE_MS) {
+        evict(pool, e);
+        free_entry(e);
+    }
+}
+
+ump_pool_t *ump_pool_init(size_t max_cached_size)
+{
+    ump_pool_t *pool = calloc(1, sizeof(ump_pool_t));
+    if (!pool)
+        return NULL;
+    pool->max_cached_size = max_cached_size;
+    return pool;
+}
+
+void ump_pool_close(ump_pool_t *pool)
+{
+    if (!pool)
+        return;
+    ump_pool_trim(pool, 0);
+    free(pool);
+}
+
+void ump_pool_trim(ump_pool_t *pool, size_t max_size)
+{
+    ump_pool_entry_t *e;
+
+    if (!pool)
+        return;
+
+    while ((e = pool->lru_head) && pool->cached_size > max_size) {
+        evict(pool, e);
+        free_entry(e);
+    }
+}
+
+ump_handle ump_pool_alloc(ump_pool_t *pool, size_t *size, int constraints,
+                          uint8_t **addr)
+{
+    ump_handle handle;
+    int idx;
+
+    if (pool) {
+        expire(pool);
+
+        if ((idx = size_class(size)) >= 0) {
+            ump_pool_entry_t *e;
+            for (e = pool->size_class[idx]; e; e = e->class_next) {
+                if (e->constraints == constraints) {
+                    evict(pool, e);
+                    handle = e->handle;
+                    *addr = e->addr;
+                    free(e);
+                    pool->hits++;
+                    return handle;
+                }
+            }
+        }
+        pool->misses++;
+    }
+
+    handle = ump_ref_drv_allocate(*size, constraints);
+
+    /* Maybe the contiguous memory is just held by our own cache */
+    if (handle == UMP_INVALID_MEMORY_HANDLE && pool && pool->lru_head) {
+        ump_pool_trim(pool, 0);
+        handle = ump_ref_drv_allocate(*size, constraints);
+    }
+
+    if (handle != UMP_INVALID_MEMORY_HANDLE)
+        *addr = ump_mapped_pointer_get(handle);
+    return handle;
+}
+
+void ump_pool_release(ump_pool_t *pool, ump_handle handle, uint8_t *addr,
+                      size_t size, int constraints)
+{
+    ump_pool_entry_t *e = NULL;
+    size_t class_size = size;
+    int idx = size_class(&class_size);
+
+    if (!pool || idx < 0 || class_size != size ||
+        size > pool->max_cached_size || !(e = calloc(1, sizeof(*e)))) {
+        ump_mapped_pointer_release(handle);
+        ump_reference_release(handle);
+        return;
+    }
+
+    e->handle          = handle;
+    e->addr            = addr;
+    e->size            = size;
+    e->constraints     = constraints;
+    e->release_time_ms = get_time_ms();
+
+    /* The most recently released buffers are reused first */
+    e->class_next = pool->size_class[idx];
+    pool->size_class[idx] = e;
+
+    e->lru_prev = pool->lru_tail;
+    if (pool->lru_tail)
+        pool->lru_tail->lru_next = e;
+    else
+        pool->lru_head = e;
+    pool->lru_tail = e;
+
+    pool->cached_size += size;
+
+    ump_pool_trim(pool, pool->max_cached_size);
+    expire(pool);
+}
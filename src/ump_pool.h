@@ -0,0 +1,80 @@
+/*
+ * Copyright © 2016 fbturbo developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef UMP_POOL_H
+#define UMP_POOL_H
+
+#include <stdint.h>
+#include <ump/ump.h>
+
+/*
+ * A cache of released physically contiguous UMP buffers. Allocating them
+ * makes the kernel search for contiguous memory, which is slow and
+ * fragments CMA, so the DRI2 code recycles the buffers of destroyed or
+ * resized windows instead. The requested sizes are rounded up to size
+ * classes (at most 1/8 apart), so that a released buffer can serve any
+ * later request from the same class. The least recently used buffers are
+ * released when the total size of the cached buffers exceeds the cap or
+ * when they stay unused for too long.
+ */
+
+#define UMP_POOL_SIZE_CLASSES   160
+
+typedef struct ump_pool_entry {
+    struct ump_pool_entry  *lru_prev, *lru_next;    /* all cached buffers */
+    struct ump_pool_entry  *class_next;             /* the same size class */
+    ump_handle              handle;
+    uint8_t                *addr;
+    size_t                  size;
+    int                     constraints;
+    uint64_t                release_time_ms;
+} ump_pool_entry_t;
+
+typedef struct {
+    size_t                  max_cached_size;
+    size_t                  cached_size;
+    /* the oldest entry is at the head, the newest at the tail */
+    ump_pool_entry_t       *lru_head, *lru_tail;
+    ump_pool_entry_t       *size_class[UMP_POOL_SIZE_CLASSES];
+
+    unsigned long           hits, misses;
+} ump_pool_t;
+
+ump_pool_t *ump_pool_init(size_t max_cached_size);
+void ump_pool_close(ump_pool_t *pool);
+
+/*
+ * Get a mapped UMP buffer of at least 'size' bytes, the actual size is
+ * returned in 'size'. Returns UMP_INVALID_MEMORY_HANDLE on failure.
+ */
+ump_handle ump_pool_alloc(ump_pool_t *pool, size_t *size, int constraints,
+                          uint8_t **addr);
+
+/* Give the buffer obtained from ump_pool_alloc back to the pool */
+void ump_pool_release(ump_pool_t *pool, ump_handle handle, uint8_t *addr,
+                      size_t size, int constraints);
+
+/* Free the cached buffers until no more than 'max_size' bytes are left */
+void ump_pool_trim(ump_pool_t *pool, size_t max_size);
+
+#endif
@@ -26,10 +26,13 @@
 #endif
 
 #include <string.h>
+#include <time.h>
 
 #include "xf86.h"
 #include "xf86xv.h"
 #include "fourcc.h"
+#include "pixmapstr.h"
+#include "damage.h"
 #include <X11/extensions/Xv.h>
 
 #include "fbdev_priv.h"
@@ -45,9 +48,120 @@
 #define SIMD_ALIGN(s) (((s) + 15) & ~15)
 #define MAKE_ATOM(a) MakeAtom(a, sizeof(a) - 1, TRUE)
 
+/* How often the statistics get logged during playback */
+#define XV_STATS_LOG_INTERVAL_US (60 * 1000000ULL)
+
 static Atom xvColorKey;
 xvideo_i *xvd = NULL;
 
+/*****************************************************************************/
+
+/* The upper limits of the PutImage interval histogram buckets */
+static const int stats_interval_limit_ms[XV_STATS_INTERVAL_BUCKETS - 1] = {
+    10, 20, 30, 40, 50, 75, 100
+};
+
+enum {
+    STATS_RESET,
+    STATS_FRAMES,
+    STATS_DROPPED,
+    STATS_COPY_US,
+    STATS_IOCTL_US,
+    STATS_COPY_MBPS,
+    STATS_INTERVAL_FIRST,
+    STATS_ATTRIBUTE_COUNT = STATS_INTERVAL_FIRST + XV_STATS_INTERVAL_BUCKETS
+};
+
+static Atom xvStats[STATS_ATTRIBUTE_COUNT];
+static Atom xvZeroCopyBufSize, xvZeroCopyNBuffers, xvZeroCopyIndex;
+static Atom xvZeroCopyOffset, xvZeroCopyFrame;
+
+static uint64_t get_time_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* The duration of one display refresh, used to guess dropped frames */
+static int get_frame_period_us(ScrnInfoPtr pScrn)
+{
+    DisplayModePtr mode = pScrn->currentMode;
+    if (mode && mode->Clock > 0 && mode->HTotal > 0 && mode->VTotal > 0)
+        return (int)((int64_t)mode->HTotal * mode->VTotal * 1000 / mode->Clock);
+    return 16667;
+}
+
+static INT32 stats_value(XVideoStats *st, int index)
+{
+    switch (index) {
+    case STATS_FRAMES:
+        return st->frames;
+    case STATS_DROPPED:
+        return st->dropped;
+    case STATS_COPY_US:
+        return st->frames ? st->copy_us / st->frames : 0;
+    case STATS_IOCTL_US:
+        return st->frames ? st->ioctl_us / st->frames : 0;
+    case STATS_COPY_MBPS:
+        return st->copy_us ? st->copy_bytes / st->copy_us : 0;
+    default:
+        if (index >= STATS_INTERVAL_FIRST && index < STATS_ATTRIBUTE_COUNT)
+            return st->intervals[index - STATS_INTERVAL_FIRST];
+        return 0;
+    }
+}
+
+static void stats_log(ScrnInfoPtr pScrn, XVideoStats *st, int verb)
+{
+    if (!st->frames)
+        return;
+
+    xf86DrvMsgVerb(pScrn->scrnIndex, X_INFO, verb,
+        "XV: %u frames, %u dropped, copy %d us/frame (%d MB/s), "
+        "backend %d us/frame, intervals (ms) <10:%u <20:%u <30:%u "
+        "<40:%u <50:%u <75:%u <100:%u >=100:%u\n",
+        st->frames, st->dropped, (int)stats_value(st, STATS_COPY_US),
+        (int)stats_value(st, STATS_COPY_MBPS),
+        (int)stats_value(st, STATS_IOCTL_US),
+        st->intervals[0], st->intervals[1], st->intervals[2],
+        st->intervals[3], st->intervals[4], st->intervals[5],
+        st->intervals[6], st->intervals[7]);
+}
+
+/*
+ * Account a new PutImage. If the previous frame has been on the overlay
+ * for less than one display refresh, it most likely has never been
+ * scanned out.
+ */
+static void stats_frame_start(ScrnInfoPtr pScrn, XVideo *self, uint64_t now)
+{
+    XVideoStats *st = &self->stats;
+
+    if (st->last_put_us) {
+        uint64_t interval = now - st->last_put_us;
+        int i;
+
+        if (interval < (uint64_t)self->frame_period_us)
+            st->dropped++;
+
+        for (i = 0; i < XV_STATS_INTERVAL_BUCKETS - 1; i++) {
+            if (interval < (uint64_t)stats_interval_limit_ms[i] * 1000)
+                break;
+        }
+        st->intervals[i]++;
+    }
+    st->last_put_us = now;
+
+    if (!st->last_log_us) {
+        st->last_log_us = now;
+    }
+    else if (now - st->last_log_us >= XV_STATS_LOG_INTERVAL_US) {
+        stats_log(pScrn, st, 4);
+        st->last_log_us = now;
+    }
+}
+
 /* Convert color key from 32bpp to the native format */
 static uint32_t convert_color(ScrnInfoPtr pScrn, uint32_t color)
 {
@@ -105,6 +219,132 @@ Bool clip(short *src_x, short *src_y, short *drw_x, short *drw_y,
     return TRUE;
 }
 
+/*
+ * Let the backend without a hardware overlay convert and scale the current
+ * frame straight into the pixels of the window
+ */
+static void
+render_to_drawable(DrawablePtr pDraw, RegionPtr clipBoxes)
+{
+    PixmapPtr pPixmap;
+    int xoff = 0, yoff = 0;
+
+    if (pDraw->type == DRAWABLE_WINDOW) {
+        pPixmap = pDraw->pScreen->GetWindowPixmap((WindowPtr)pDraw);
+#ifdef COMPOSITE
+        /* The window may be redirected to an offscreen pixmap */
+        xoff = -pPixmap->screen_x;
+        yoff = -pPixmap->screen_y;
+#endif
+    }
+    else {
+        pPixmap = (PixmapPtr)pDraw;
+    }
+
+    if (!pPixmap->devPrivate.ptr || !REGION_NUM_RECTS(clipBoxes))
+        return;
+
+    xvd->render_frame(xvd->self, (uint32_t *)pPixmap->devPrivate.ptr,
+                      pPixmap->devKind / 4, pPixmap->drawable.bitsPerPixel,
+                      xoff, yoff, REGION_RECTS(clipBoxes),
+                      REGION_NUM_RECTS(clipBoxes));
+
+    DamageDamageRegion(pDraw, clipBoxes);
+}
+
+/*
+ * Only pass the changed overlay parameters to the backend, so that the
+ * steady state playback just needs to update the buffer address
+ */
+static void
+update_overlay(XVideo *self, uint32_t y_offset, uint32_t u_offset,
+               uint32_t v_offset, short src_x, short src_y, short src_w,
+               short src_h, int stride, short drw_x, short drw_y,
+               short drw_w, short drw_h)
+{
+    XVideoOverlayState *st = &self->overlay;
+
+    if (!st->valid || st->y_offset != y_offset ||
+        st->u_offset != u_offset || st->v_offset != v_offset) {
+        xvd->set_yuv420_input_buffer(xvd->self, y_offset, u_offset, v_offset);
+        st->y_offset = y_offset;
+        st->u_offset = u_offset;
+        st->v_offset = v_offset;
+    }
+
+    if (!st->valid || st->src_x != src_x || st->src_y != src_y ||
+        st->src_w != src_w || st->src_h != src_h || st->stride != stride) {
+        xvd->set_input_par(xvd->self, src_w, src_h, stride, src_x, src_y);
+        st->src_x = src_x;
+        st->src_y = src_y;
+        st->src_w = src_w;
+        st->src_h = src_h;
+        st->stride = stride;
+    }
+
+    if (!st->valid || st->drw_x != drw_x || st->drw_y != drw_y ||
+        st->drw_w != drw_w || st->drw_h != drw_h) {
+        xvd->set_output_window(xvd->self, drw_x, drw_y, drw_w, drw_h);
+        st->drw_x = drw_x;
+        st->drw_y = drw_y;
+        st->drw_w = drw_w;
+        st->drw_h = drw_h;
+    }
+
+    if (!st->shown) {
+        xvd->show_window(xvd->self);
+        st->shown = TRUE;
+    }
+
+    st->valid = TRUE;
+
+    if (xvd->commit)
+        xvd->commit(xvd->self);
+}
+
+/*
+ * Reserve the client-visible ring buffers of 'size' bytes each at the end
+ * of the offscreen framebuffer memory (or release them if size is 0).
+ * The client writes the images in the same layout as the PutImage data,
+ * so this needs an overlay which can show it directly.
+ */
+static int
+zerocopy_setup(XVideo *self, INT32 size)
+{
+    XVideoZeroCopy *zc = &self->zerocopy;
+    ssize_t visible, total;
+    int n;
+
+    memset(zc, 0, sizeof(*zc));
+    zc->next_frame = -1;
+    zc->shown = -1;
+    self->overlay.valid = FALSE;
+
+    if (size <= 0)
+        return Success;
+
+    if (!xvd || xvd->copy_buffer || xvd->render_frame ||
+        !(xvd->flags & XV_DOUBLEBUFFERING))
+        return BadMatch;
+
+    visible = xvd->get_visible_fb_size(xvd->self);
+    total = xvd->get_total_fb_size(xvd->self);
+
+    /* Keep every buffer page aligned, so that it can be mmapped alone */
+    size = (size + 4095) & ~4095;
+    for (n = XV_ZEROCOPY_MAX_BUFFERS; n >= 2; n--) {
+        ssize_t base = (total - (ssize_t)n * size) & ~4095;
+        if (base >= visible) {
+            zc->buf_size = size;
+            zc->nbuffers = n;
+            zc->base = base;
+            return Success;
+        }
+    }
+
+    return BadAlloc;
+}
+
 /*****************************************************************************/
 
 static void
@@ -113,9 +353,15 @@ xStopVideo(ScrnInfoPtr pScrn, pointer data, Bool cleanup)
     XVideo *self = XVIDEO(pScrn);
 
     if (xvd && cleanup) {
+        stats_log(pScrn, &self->stats, 1);
+        self->stats.last_put_us = 0;
         xvd->hide_window(xvd->self);
         xvd->disable_colorkey(xvd->self);
         self->colorKeyEnabled = FALSE;
+        self->overlay.valid = FALSE;
+        self->overlay.shown = FALSE;
+        self->zerocopy.shown = -1;
+        self->zerocopy.next_frame = -1;
     }
 
     REGION_EMPTY(pScrn->pScreen, &self->clip);
@@ -137,6 +383,30 @@ xSetPortAttributeOverlay(ScrnInfoPtr pScrn,
         return Success;
     }
 
+    if (attribute == xvStats[STATS_RESET]) {
+        if (value)
+            memset(&self->stats, 0, sizeof(self->stats));
+        return Success;
+    }
+
+    if (attribute == xvZeroCopyBufSize) {
+        return zerocopy_setup(self, value);
+    }
+
+    if (attribute == xvZeroCopyIndex) {
+        if (value < 0 || value >= self->zerocopy.nbuffers)
+            return BadValue;
+        self->zerocopy.index = value;
+        return Success;
+    }
+
+    if (attribute == xvZeroCopyFrame) {
+        if (value < -1 || value >= self->zerocopy.nbuffers)
+            return BadValue;
+        self->zerocopy.next_frame = value;
+        return Success;
+    }
+
     return BadMatch;
 }
 
@@ -148,12 +418,47 @@ xGetPortAttributeOverlay(ScrnInfoPtr pScrn,
                          pointer     data)
 {
     XVideo *self = XVIDEO(pScrn);
+    int i;
 
     if (attribute == xvColorKey) {
         *value = self->colorKey;
         return Success;
     }
 
+    for (i = 0; i < STATS_ATTRIBUTE_COUNT; i++) {
+        if (attribute == xvStats[i]) {
+            *value = stats_value(&self->stats, i);
+            return Success;
+        }
+    }
+
+    if (attribute == xvZeroCopyBufSize) {
+        *value = self->zerocopy.buf_size;
+        return Success;
+    }
+
+    if (attribute == xvZeroCopyNBuffers) {
+        *value = self->zerocopy.nbuffers;
+        return Success;
+    }
+
+    if (attribute == xvZeroCopyIndex) {
+        *value = self->zerocopy.index;
+        return Success;
+    }
+
+    if (attribute == xvZeroCopyOffset) {
+        *value = self->zerocopy.nbuffers ? self->zerocopy.base +
+                 self->zerocopy.index * self->zerocopy.buf_size : 0;
+        return Success;
+    }
+
+    /* The buffer on screen, which the client must not decode into */
+    if (attribute == xvZeroCopyFrame) {
+        *value = self->zerocopy.shown;
+        return Success;
+    }
+
     return BadMatch;
 }
 
@@ -177,6 +482,9 @@ xPutImage(ScrnInfoPtr pScrn, short src_x, short src_y, short drw_x, short drw_y,
     int y_offset, u_offset, v_offset;
     int y_stride, uv_stride, yuv_size;
     BoxRec dstBox;
+    uint64_t t_start, t_copied;
+    XVideoZeroCopy *zc = &self->zerocopy;
+    int data_offs, zc_slot = -1;
 
     /* There used to be some clipping functionality here, but as far as I can tell the
        results were thrown away. Replaced below with a call to our own clipping function,
@@ -200,32 +508,70 @@ xPutImage(ScrnInfoPtr pScrn, short src_x, short src_y, short drw_x, short drw_y,
     }
 
     if (xvd) {
-        if (xvd->flags & XV_DOUBLEBUFFERING) {
-            /* Try to fixup overlay offset */
-            if (self->overlay_data_offs < xvd->get_visible_fb_size(xvd->self) ||
-                self->overlay_data_offs + yuv_size > xvd->get_total_fb_size(xvd->self)) {
-                self->overlay_data_offs = xvd->get_visible_fb_size(xvd->self);
+        /* The overlay (and its memory) may be in use by a GLES window */
+        if (!xvd->render_frame && xvd->claim && xvd->claim(xvd->self) != 0)
+            return BadAlloc;
+
+        if (zc->nbuffers) {
+            /* Either the frame the client has decoded into the buffer, or
+               a copy into the next buffer after the one on screen */
+            if (yuv_size > zc->buf_size)
+                return BadMatch;
+            zc_slot = zc->next_frame >= 0 ? zc->next_frame :
+                                            (zc->shown + 1) % zc->nbuffers;
+            data_offs = zc->base + zc_slot * zc->buf_size;
+        }
+        else {
+            if (xvd->flags & XV_DOUBLEBUFFERING) {
+                /* Try to fixup overlay offset */
+                if (self->overlay_data_offs < xvd->get_visible_fb_size(xvd->self) ||
+                    self->overlay_data_offs + yuv_size > xvd->get_total_fb_size(xvd->self)) {
+                    self->overlay_data_offs = xvd->get_visible_fb_size(xvd->self);
+                }
             }
+            /* If it is still wrong (not enough offscreen memory), then fail */
+            if (self->overlay_data_offs + yuv_size > xvd->get_total_fb_size(xvd->self))
+                return BadImplementation;
+            data_offs = self->overlay_data_offs;
         }
-        /* If it is still wrong (not enough offscreen memory), then fail */
-        if (self->overlay_data_offs + yuv_size > xvd->get_total_fb_size(xvd->self))
-            return BadImplementation;
 
-        y_offset += self->overlay_data_offs;
-        u_offset += self->overlay_data_offs;
-        v_offset += self->overlay_data_offs;
+        y_offset += data_offs;
+        u_offset += data_offs;
+        v_offset += data_offs;
 
 
-        if (!clip(&src_x, &src_y, &drw_x, &drw_y, &src_w, &src_h, &drw_w, &drw_h,
+        /* Rendering is clipped to clipBoxes instead, offscreen is fine */
+        if (!xvd->render_frame &&
+            !clip(&src_x, &src_y, &drw_x, &drw_y, &src_w, &src_h, &drw_w, &drw_h,
                   xvd->get_screen_width(xvd->self), xvd->get_screen_height(xvd->self))) {
             return Success;
         }
 
-        if (xvd->copy_buffer) {
+        t_start = get_time_us();
+        stats_frame_start(pScrn, self, t_start);
+
+        if (zc_slot >= 0 && zc->next_frame >= 0) {
+            /* Zero-copy, the image is already there */
+        } else if (xvd->copy_buffer) {
             xvd->copy_buffer(xvd->self, xvd->get_fb_mem(xvd->self)
-                             + self->overlay_data_offs, buf, yuv_size, image);
+                             + data_offs, buf, yuv_size, image);
+            self->stats.copy_bytes += yuv_size;
         } else {
-            memcpy(xvd->get_fb_mem(xvd->self) + self->overlay_data_offs, buf, yuv_size);
+            memcpy(xvd->get_fb_mem(xvd->self) + data_offs, buf, yuv_size);
+            self->stats.copy_bytes += yuv_size;
+        }
+
+        t_copied = get_time_us();
+        self->stats.frames++;
+        self->stats.copy_us += t_copied - t_start;
+
+        if (xvd->render_frame) {
+            xvd->set_yuv420_input_buffer(xvd->self, y_offset, u_offset, v_offset);
+            xvd->set_input_par(xvd->self, src_w, src_h, y_stride, src_x, src_y);
+            xvd->set_output_window(xvd->self, drw_x, drw_y, drw_w, drw_h);
+            render_to_drawable(pDraw, clipBoxes);
+            self->stats.ioctl_us += get_time_us() - t_copied;
+            return Success;
         }
 
         /* Enable colorkey if it has not been already enabled */
@@ -233,12 +579,15 @@ xPutImage(ScrnInfoPtr pScrn, short src_x, short src_y, short drw_x, short drw_y,
             xvd->set_colorkey(xvd->self, self->colorKey);
             self->colorKeyEnabled = TRUE;
         }
-        xvd->set_yuv420_input_buffer(xvd->self, y_offset, u_offset, v_offset);
-        xvd->set_input_par(xvd->self, src_w, src_h, y_stride, src_x, src_y);
-        xvd->set_output_window(xvd->self, drw_x, drw_y, drw_w, drw_h);
-        xvd->show_window(xvd->self);
+        update_overlay(self, y_offset, u_offset, v_offset, src_x, src_y,
+                       src_w, src_h, y_stride, drw_x, drw_y, drw_w, drw_h);
+        self->stats.ioctl_us += get_time_us() - t_copied;
 
-        if (xvd->flags & XV_DOUBLEBUFFERING) {
+        if (zc_slot >= 0) {
+            zc->shown = zc_slot;
+            zc->next_frame = -1;
+        }
+        else if (xvd->flags & XV_DOUBLEBUFFERING) {
             /* Cycle through different overlay offsets (to prevent tearing) */
             self->overlay_data_offs += yuv_size;
         }
@@ -258,15 +607,27 @@ xReputImage(ScrnInfoPtr pScrn, short src_x, short src_y, short drw_x, short drw_
           short src_w, short src_h, short drw_w, short drw_h,
           RegionPtr clipBoxes, pointer data, DrawablePtr pDraw)
 {
-    int stride = SIMD_ALIGN(src_w >> 1) * 2;
-	
+    XVideo *self = XVIDEO(pScrn);
+
+    if (xvd->render_frame) {
+        xvd->set_output_window(xvd->self, drw_x, drw_y, drw_w, drw_h);
+        render_to_drawable(pDraw, clipBoxes);
+        return Success;
+    }
+
     if (!clip(&src_x, &src_y, &drw_x, &drw_y, &src_w, &src_h, &drw_w, &drw_h,
               xvd->get_screen_width(xvd->self), xvd->get_screen_height(xvd->self))) {
         return Success;
     }
 
-    xvd->set_input_par(xvd->self, src_w, src_h, stride, src_x, src_y);
-    xvd->set_output_window(xvd->self, drw_x, drw_y, drw_w, drw_h);
+    /* Nothing has been put on the overlay yet (or it has been stopped) */
+    if (!self->overlay.valid)
+        return Success;
+
+    /* The image itself is the same, so are the buffer offsets and stride */
+    update_overlay(self, self->overlay.y_offset, self->overlay.u_offset,
+                   self->overlay.v_offset, src_x, src_y, src_w, src_h,
+                   self->overlay.stride, drw_x, drw_y, drw_w, drw_h);
 
     return Success;
 }
@@ -321,6 +682,27 @@ static XF86ImageRec Images[] =
 static XF86AttributeRec Attributes[] =
 {
    {XvSettable | XvGettable, 0, (1 << 24) - 1, "XV_COLORKEY"},
+   /* Statistics, in the same order as the STATS_* constants */
+   {XvSettable, 0, 1, "XV_STATS_RESET"},
+   {XvGettable, 0, 0x7FFFFFFF, "XV_STATS_FRAMES"},
+   {XvGettable, 0, 0x7FFFFFFF, "XV_STATS_DROPPED"},
+   {XvGettable, 0, 0x7FFFFFFF, "XV_STATS_COPY_US"},
+   {XvGettable, 0, 0x7FFFFFFF, "XV_STATS_IOCTL_US"},
+   {XvGettable, 0, 0x7FFFFFFF, "XV_STATS_COPY_MBPS"},
+   {XvGettable, 0, 0x7FFFFFFF, "XV_STATS_INTERVAL_10MS"},
+   {XvGettable, 0, 0x7FFFFFFF, "XV_STATS_INTERVAL_20MS"},
+   {XvGettable, 0, 0x7FFFFFFF, "XV_STATS_INTERVAL_30MS"},
+   {XvGettable, 0, 0x7FFFFFFF, "XV_STATS_INTERVAL_40MS"},
+   {XvGettable, 0, 0x7FFFFFFF, "XV_STATS_INTERVAL_50MS"},
+   {XvGettable, 0, 0x7FFFFFFF, "XV_STATS_INTERVAL_75MS"},
+   {XvGettable, 0, 0x7FFFFFFF, "XV_STATS_INTERVAL_100MS"},
+   {XvGettable, 0, 0x7FFFFFFF, "XV_STATS_INTERVAL_MORE"},
+   /* Zero-copy buffers handshake */
+   {XvSettable | XvGettable, 0, 0x7FFFFFFF, "XV_ZEROCOPY_BUFSIZE"},
+   {XvGettable, 0, XV_ZEROCOPY_MAX_BUFFERS, "XV_ZEROCOPY_NBUFFERS"},
+   {XvSettable | XvGettable, 0, XV_ZEROCOPY_MAX_BUFFERS - 1, "XV_ZEROCOPY_INDEX"},
+   {XvGettable, 0, 0x7FFFFFFF, "XV_ZEROCOPY_OFFSET"},
+   {XvSettable | XvGettable, -1, XV_ZEROCOPY_MAX_BUFFERS - 1, "XV_ZEROCOPY_FRAME"},
 };
 
 XVideo *XVideo_Init(ScreenPtr pScreen, xvideo_i *xv_i)
@@ -328,12 +710,7 @@ XVideo *XVideo_Init(ScreenPtr pScreen, xvideo_i *xv_i)
     ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
     XVideo *self;
     XF86VideoAdaptorPtr adapt;
-
-    /*if (!disp || !disp->layer_has_scaler) {
-        xf86DrvMsg(pScreen->myNum, X_INFO,
-                   "SunxiVideo_Init: no scalable layer available for XV\n");
-        return NULL;
-    }*/
+    int i;
 
     if (!(self = calloc(1, sizeof(XVideo)))) {
         xf86DrvMsg(pScreen->myNum, X_INFO, "XVideo_Init: calloc failed\n");
@@ -376,7 +753,19 @@ XVideo *XVideo_Init(ScreenPtr pScreen, xvideo_i *xv_i)
     xf86XVScreenInit(pScreen, &self->adapt[0], 1);
 
     xvColorKey = MAKE_ATOM("XV_COLORKEY");
+    xvZeroCopyBufSize = MAKE_ATOM("XV_ZEROCOPY_BUFSIZE");
+    xvZeroCopyNBuffers = MAKE_ATOM("XV_ZEROCOPY_NBUFFERS");
+    xvZeroCopyIndex = MAKE_ATOM("XV_ZEROCOPY_INDEX");
+    xvZeroCopyOffset = MAKE_ATOM("XV_ZEROCOPY_OFFSET");
+    xvZeroCopyFrame = MAKE_ATOM("XV_ZEROCOPY_FRAME");
+    for (i = 0; i < STATS_ATTRIBUTE_COUNT; i++) {
+        xvStats[i] = MakeAtom(Attributes[1 + i].name,
+                              strlen(Attributes[1 + i].name), TRUE);
+    }
     self->colorKey = 0x081018;
+    self->zerocopy.next_frame = -1;
+    self->zerocopy.shown = -1;
+    self->frame_period_us = get_frame_period_us(pScrn);
     REGION_NULL(pScreen, &self->clip);
 
     xvd = xv_i;
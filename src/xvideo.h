@@ -30,11 +30,59 @@
 #define XV_IMAGE_MAX_WIDTH  2048
 #define XV_IMAGE_MAX_HEIGHT 2048
 
+/* The overlay parameters, which have been last passed to the backend */
+typedef struct {
+    Bool                valid;
+    uint32_t            y_offset, u_offset, v_offset;
+    int                 src_x, src_y, src_w, src_h, stride;
+    int                 drw_x, drw_y, drw_w, drw_h;
+    Bool                shown;
+} XVideoOverlayState;
+
+/*
+ * Playback statistics, available as XV_STATS_* port attributes and
+ * periodically written to the log
+ */
+#define XV_STATS_INTERVAL_BUCKETS 8
+
+typedef struct {
+    uint32_t            frames;       /* frames given to the backend */
+    uint32_t            dropped;      /* (likely) replaced before scanout */
+    uint64_t            copy_us;      /* total time spent copying images */
+    uint64_t            copy_bytes;
+    uint64_t            ioctl_us;     /* total time spent in the backend */
+    uint64_t            last_put_us;
+    uint64_t            last_log_us;
+    /* histogram of the intervals between PutImage calls */
+    uint32_t            intervals[XV_STATS_INTERVAL_BUCKETS];
+} XVideoStats;
+
+/*
+ * Zero-copy mode: the overlay ring buffers in the offscreen part of the
+ * framebuffer are handed out to the client (see the XV_ZEROCOPY_* port
+ * attributes), which decodes straight into them and then only asks
+ * PutImage to flip the overlay to the right buffer.
+ */
+#define XV_ZEROCOPY_MAX_BUFFERS 4
+
+typedef struct {
+    int                 buf_size;     /* 0 if zero-copy is not set up */
+    int                 nbuffers;
+    int                 base;         /* offset of the first buffer */
+    int                 index;        /* selected by XV_ZEROCOPY_INDEX */
+    int                 next_frame;   /* buffer for the next PutImage or -1 */
+    int                 shown;        /* buffer on the overlay or -1 */
+} XVideoZeroCopy;
+
 typedef struct {
     RegionRec           clip;
     uint32_t            colorKey;
     Bool                colorKeyEnabled;
     int                 overlay_data_offs;
+    XVideoOverlayState  overlay;
+    XVideoStats         stats;
+    XVideoZeroCopy      zerocopy;
+    int                 frame_period_us;
     XF86VideoAdaptorPtr adapt[1];
     void               *port_privates[1];
 } XVideo;
@@ -0,0 +1,466 @@
+/*
+ * Copyright © 2016 fbturbo developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Benchmarks all the available blt2d_i backends (memcpy, pixman, the CPU
+ * backend variants, G2D, FBIOCOPYAREA) on different kinds of memory
+ * (framebuffer, normal cached RAM and UMP buffers if libUMP is available)
+ * for a range of rectangle sizes and both 16bpp and 32bpp. The results
+ * are written as CSV or JSON, so that they can be compared across boards
+ * and commits:
+ *
+ *   blt_bench [-q] [-f csv|json] [-o file] [-b backends] [-m memories]
+ *
+ *   -q    quick run with fewer iterations
+ *   -b    comma separated list of the backends to run (default: all)
+ *   -m    comma separated list of the memory types (fb, ram, ump)
+ *
+ * Rockchip RGA is not covered, because it can't be initialized outside
+ * of the X server.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/fb.h>
+
+#include <pixman.h>
+
+#ifdef HAVE_LIBUMP
+#include <ump/ump.h>
+#include <ump/ump_ref_drv.h>
+#endif
+
+#include "../src/cpuinfo.h"
+#include "../src/cpu_backend.h"
+#include "../src/sunxi_disp.h"
+#include "../src/fb_copyarea.h"
+
+/* The rectangles are randomly shifted by up to PADDING pixels on X axis */
+#define PADDING        16
+#define MAX_MEMORIES   3
+#define MAX_BACKENDS   8
+
+/* Run each test for about this number of pixels */
+#define TARGET_PIXELS  (20 * 1000 * 1000)
+#define MIN_CALLS      20
+#define MAX_CALLS      1000
+
+typedef struct {
+    const char *name;
+    uint8_t    *bits;
+    size_t      size;
+    int         width;      /* in pixels, the same for all bpp */
+} memory_t;
+
+typedef struct {
+    char        name[32];
+    blt2d_i    *blt2d;
+} backend_t;
+
+typedef struct {
+    const char *backend;
+    const char *memory;
+    int         bpp, width, height;
+    int         calls, declined;
+    double      mpix_per_s;
+    double      p50_us, p90_us, p99_us, max_us;
+} result_t;
+
+static const int sizes[][2] = {
+    { 8, 8 }, { 32, 32 }, { 64, 64 }, { 128, 128 }, { 256, 256 },
+    { 512, 512 }, { -1, -1 } /* the whole screen */
+};
+
+static const char *cpu_variants[] = { "neon", "vfp", "arm" };
+
+static double get_time_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000. + ts.tv_nsec / 1000.;
+}
+
+/* Checks if 'name' is in the comma separated 'list' (NULL means all) */
+static int in_list(const char *list, const char *name)
+{
+    size_t len = strlen(name);
+    while (list) {
+        if (strncmp(list, name, len) == 0 &&
+            (list[len] == ',' || list[len] == '\0'))
+            return 1;
+        list = strchr(list, ',');
+        if (list)
+            list++;
+    }
+    return 0;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/*****************************************************************************/
+
+/* Non-overlapping copy, row by row */
+static int memcpy_blt(void *self, uint32_t *src_bits, uint32_t *dst_bits,
+                      int src_stride, int dst_stride, int src_bpp,
+                      int dst_bpp, int src_x, int src_y, int dst_x,
+                      int dst_y, int w, int h)
+{
+    uint8_t *src, *dst;
+
+    if (src_bpp != dst_bpp)
+        return 0;
+
+    src = (uint8_t *)(src_bits + src_y * src_stride) + src_x * src_bpp / 8;
+    dst = (uint8_t *)(dst_bits + dst_y * dst_stride) + dst_x * dst_bpp / 8;
+    while (h--) {
+        memcpy(dst, src, w * src_bpp / 8);
+        src += src_stride * 4;
+        dst += dst_stride * 4;
+    }
+    return 1;
+}
+
+static int pixman_blt2d(void *self, uint32_t *src_bits, uint32_t *dst_bits,
+                        int src_stride, int dst_stride, int src_bpp,
+                        int dst_bpp, int src_x, int src_y, int dst_x,
+                        int dst_y, int w, int h)
+{
+    return pixman_blt(src_bits, dst_bits, src_stride, dst_stride, src_bpp,
+                      dst_bpp, src_x, src_y, dst_x, dst_y, w, h);
+}
+
+/*****************************************************************************/
+
+/*
+ * Copy a w x h rectangle from the top of the buffer to the area right
+ * below it, so that the source and destination never overlap.
+ */
+static int run_test(result_t *result, blt2d_i *blt2d, memory_t *mem,
+                    int bpp, int w, int h, int quick)
+{
+    int stride = mem->width * bpp / 32;
+    int max_calls, i, n = 0;
+    double *latency, total_us = 0;
+
+    /* check that the backend supports this case at all */
+    if (!blt2d->overlapped_blt(blt2d->self, (uint32_t *)mem->bits,
+                               (uint32_t *)mem->bits, stride, stride, bpp, bpp,
+                               0, 0, 0, h, w, h))
+        return 0;
+
+    max_calls = (quick ? TARGET_PIXELS / 10 : TARGET_PIXELS) / (w * h);
+    if (max_calls < MIN_CALLS)
+        max_calls = MIN_CALLS;
+    if (max_calls > MAX_CALLS)
+        max_calls = MAX_CALLS;
+    latency = malloc(max_calls * sizeof(double));
+
+    memset(result, 0, sizeof(*result));
+    srand(0);
+    for (i = 0; i < max_calls; i++) {
+        int src_x = rand() % PADDING;
+        int dst_x = rand() % PADDING;
+        double t1 = get_time_us(), t2;
+        int done = blt2d->overlapped_blt(blt2d->self, (uint32_t *)mem->bits,
+                                         (uint32_t *)mem->bits, stride, stride,
+                                         bpp, bpp, src_x, 0, dst_x, h, w, h);
+        t2 = get_time_us();
+        if (!done) {
+            result->declined++;
+            continue;
+        }
+        latency[n++] = t2 - t1;
+        total_us += t2 - t1;
+    }
+
+    qsort(latency, n, sizeof(double), compare_doubles);
+    result->bpp        = bpp;
+    result->width      = w;
+    result->height     = h;
+    result->calls      = n;
+    result->mpix_per_s = total_us > 0 ? (double)w * h * n / total_us : 0;
+    if (n > 0) {
+        result->p50_us = latency[(int)(0.50 * (n - 1) + 0.5)];
+        result->p90_us = latency[(int)(0.90 * (n - 1) + 0.5)];
+        result->p99_us = latency[(int)(0.99 * (n - 1) + 0.5)];
+        result->max_us = latency[n - 1];
+    }
+    free(latency);
+    return n > 0;
+}
+
+static void print_result(FILE *out, const char *format, result_t *r,
+                         int first)
+{
+    if (strcmp(format, "json") == 0) {
+        fprintf(out, "%s    { \"backend\": \"%s\", \"memory\": \"%s\", "
+                "\"bpp\": %d, \"width\": %d, \"height\": %d, "
+                "\"calls\": %d, \"declined\": %d, \"mpix_per_s\": %.2f, "
+                "\"mb_per_s\": %.2f, \"p50_us\": %.2f, \"p90_us\": %.2f, "
+                "\"p99_us\": %.2f, \"max_us\": %.2f }",
+                first ? "" : ",\n", r->backend, r->memory, r->bpp, r->width,
+                r->height, r->calls, r->declined, r->mpix_per_s,
+                r->mpix_per_s * r->bpp / 8, r->p50_us, r->p90_us, r->p99_us,
+                r->max_us);
+    }
+    else {
+        fprintf(out, "%s,%s,%d,%d,%d,%d,%d,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f\n",
+                r->backend, r->memory, r->bpp, r->width, r->height, r->calls,
+                r->declined, r->mpix_per_s, r->mpix_per_s * r->bpp / 8,
+                r->p50_us, r->p90_us, r->p99_us, r->max_us);
+    }
+    fflush(out);
+}
+
+/*****************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    const char *format = "csv", *backend_list = NULL, *memory_list = NULL;
+    FILE *out = stdout;
+    int quick = 0, opt, i, j, k, bpp, nmem = 0, first = 1;
+    memory_t memories[MAX_MEMORIES];
+    cpuinfo_t *cpuinfo;
+    struct fb_var_screeninfo fb_var;
+    struct fb_fix_screeninfo fb_fix;
+    uint8_t *fbmem = NULL;
+    int fd_fb, xres = 1024, yres = 768, fb_bpp = 0;
+    sunxi_disp_t *disp = NULL;
+    fb_copyarea_t *fb = NULL;
+    blt2d_i memcpy_blt2d = { NULL, memcpy_blt };
+    blt2d_i pixman_blt2d_i = { NULL, pixman_blt2d };
+#ifdef HAVE_LIBUMP
+    ump_handle ump = UMP_INVALID_MEMORY_HANDLE;
+#endif
+
+    while ((opt = getopt(argc, argv, "qf:o:b:m:")) != -1) {
+        switch (opt) {
+        case 'q':
+            quick = 1;
+            break;
+        case 'f':
+            format = optarg;
+            break;
+        case 'o':
+            out = fopen(optarg, "w");
+            if (!out) {
+                fprintf(stderr, "Failed to open %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'b':
+            backend_list = optarg;
+            break;
+        case 'm':
+            memory_list = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-q] [-f csv|json] [-o file] "
+                            "[-b backends] [-m fb,ram,ump]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (strcmp(format, "csv") != 0 && strcmp(format, "json") != 0) {
+        fprintf(stderr, "Unknown output format '%s'\n", format);
+        return 1;
+    }
+
+    /* The framebuffer, shared by all the backends which need it */
+    fd_fb = open("/dev/fb0", O_RDWR);
+    if (fd_fb >= 0 && ioctl(fd_fb, FBIOGET_VSCREENINFO, &fb_var) == 0 &&
+                      ioctl(fd_fb, FBIOGET_FSCREENINFO, &fb_fix) == 0) {
+        fbmem = mmap(0, fb_fix.smem_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd_fb, 0);
+        if (fbmem == MAP_FAILED) {
+            fbmem = NULL;
+        }
+        else {
+            xres   = fb_var.xres;
+            yres   = fb_var.yres;
+            fb_bpp = fb_var.bits_per_pixel;
+            if (!memory_list || in_list(memory_list, "fb")) {
+                memories[nmem].name  = "fb";
+                memories[nmem].bits  = fbmem;
+                memories[nmem].size  = fb_fix.smem_len;
+                memories[nmem].width = fb_fix.line_length * 8 / fb_bpp;
+                nmem++;
+            }
+            disp = sunxi_disp_init("/dev/fb0", fbmem);
+            fb = fb_copyarea_init("/dev/fb0", fbmem);
+        }
+    }
+
+    if (!memory_list || in_list(memory_list, "ram")) {
+        size_t size = (size_t)xres * yres * 4 * 2 + PADDING * 4;
+        void *ram;
+        if (posix_memalign(&ram, 4096, size) == 0) {
+            memset(ram, 0xCC, size);
+            memories[nmem].name  = "ram";
+            memories[nmem].bits  = ram;
+            memories[nmem].size  = size;
+            memories[nmem].width = xres;
+            nmem++;
+        }
+    }
+
+#ifdef HAVE_LIBUMP
+    if ((!memory_list || in_list(memory_list, "ump")) &&
+        ump_open() == UMP_OK) {
+        size_t size = (size_t)xres * yres * 4 * 2 + PADDING * 4;
+        ump = ump_ref_drv_allocate(size, UMP_REF_DRV_CONSTRAINT_NONE);
+        if (ump != UMP_INVALID_MEMORY_HANDLE) {
+            memories[nmem].name  = "ump";
+            memories[nmem].bits  = ump_mapped_pointer_get(ump);
+            memories[nmem].size  = size;
+            memories[nmem].width = xres;
+            memset(memories[nmem].bits, 0xCC, size);
+            nmem++;
+        }
+    }
+#endif
+
+    cpuinfo = cpuinfo_init();
+    if (strcmp(format, "json") == 0) {
+        fprintf(out, "{\n  \"cpu\": \"%s\",\n",
+                cpuinfo ? cpuinfo->processor_name : "unknown");
+#ifdef PACKAGE_VERSION
+        fprintf(out, "  \"version\": \"%s\",\n", PACKAGE_VERSION);
+#endif
+        fprintf(out, "  \"screen\": { \"xres\": %d, \"yres\": %d, "
+                     "\"bpp\": %d },\n  \"results\": [\n",
+                xres, yres, fb_bpp);
+    }
+    else {
+        fprintf(out, "backend,memory,bpp,width,height,calls,declined,"
+                     "mpix_per_s,mb_per_s,p50_us,p90_us,p99_us,max_us\n");
+    }
+    fprintf(stderr, "CPU: %s, screen: %dx%d\n",
+            cpuinfo ? cpuinfo->processor_name : "unknown", xres, yres);
+
+    for (i = 0; i < nmem; i++) {
+        memory_t *mem = &memories[i];
+        backend_t backends[MAX_BACKENDS];
+        cpu_backend_t *cpu_backend[3];
+        int nbackends = 0;
+
+        /* The backends, each of them declines what it can't do */
+        strcpy(backends[nbackends].name, "memcpy");
+        backends[nbackends++].blt2d = &memcpy_blt2d;
+        strcpy(backends[nbackends].name, "pixman");
+        backends[nbackends++].blt2d = &pixman_blt2d_i;
+        /* one instance per variant, the memory is treated as uncached */
+        for (j = 0; j < 3; j++) {
+            cpu_backend[j] = cpu_backend_init(mem->bits, mem->size);
+            if (cpu_backend[j] &&
+                cpu_backend_select_variant(cpu_backend[j],
+                                           cpu_variants[j]) == 0) {
+                snprintf(backends[nbackends].name,
+                         sizeof(backends[nbackends].name), "cpu-%s",
+                         cpu_variants[j]);
+                backends[nbackends++].blt2d = &cpu_backend[j]->blt2d;
+            }
+        }
+        if (disp && disp->fd_g2d >= 0) {
+            strcpy(backends[nbackends].name, "g2d");
+            backends[nbackends++].blt2d = &disp->blt2d;
+        }
+        if (fb) {
+            strcpy(backends[nbackends].name, "copyarea");
+            backends[nbackends++].blt2d = &fb->blt2d;
+        }
+
+        for (j = 0; j < nbackends; j++) {
+            if (backend_list && !in_list(backend_list, backends[j].name))
+                continue;
+            for (bpp = 16; bpp <= 32; bpp += 16) {
+                int height = mem->size / (mem->width * bpp / 8);
+                for (k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+                    int w = sizes[k][0], h = sizes[k][1];
+                    result_t result;
+                    if (w < 0) {
+                        w = xres - PADDING;
+                        h = yres;
+                    }
+                    if (w + PADDING > mem->width || h * 2 > height)
+                        continue;
+                    fprintf(stderr, "%s on %s, %dbpp, %dx%d\n",
+                            backends[j].name, mem->name, bpp, w, h);
+                    if (!run_test(&result, backends[j].blt2d, mem, bpp, w, h,
+                                  quick))
+                        continue;
+                    result.backend = backends[j].name;
+                    result.memory  = mem->name;
+                    print_result(out, format, &result, first);
+                    first = 0;
+                }
+            }
+        }
+
+        for (j = 0; j < 3; j++) {
+            if (cpu_backend[j])
+                cpu_backend_close(cpu_backend[j]);
+        }
+    }
+
+    if (strcmp(format, "json") == 0)
+        fprintf(out, "\n  ]\n}\n");
+
+    if (cpuinfo)
+        cpuinfo_close(cpuinfo);
+    if (disp)
+        sunxi_disp_close(disp);
+    if (fb)
+        fb_copyarea_close(fb);
+#ifdef HAVE_LIBUMP
+    if (ump != UMP_INVALID_MEMORY_HANDLE) {
+        ump_mapped_pointer_release(ump);
+        ump_reference_release(ump);
+    }
+#endif
+    for (i = 0; i < nmem; i++) {
+        if (strcmp(memories[i].name, "ram") == 0)
+            free(memories[i].bits);
+    }
+    if (fbmem)
+        munmap(fbmem, fb_fix.smem_len);
+    if (fd_fb >= 0)
+        close(fd_fb);
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
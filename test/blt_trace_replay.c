@@ -0,0 +1,398 @@
+/*
+ * Copyright © 2016 fbturbo developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Replays a blit trace recorded by the X server (Option "BltTraceFile")
+ * against one of the blt2d_i backends and reports the throughput and the
+ * latency percentiles per X request:
+ *
+ *   blt_trace_replay [-l loops] <backend> trace.bin
+ *
+ * where the backend is one of c, pixman, cpu-neon, cpu-vfp, cpu-arm, g2d
+ * or copyarea. The cpu-* backends are the variants of the CPU backend and
+ * treat the screen as the uncached framebuffer, just like the X server.
+ *
+ * The windows are mapped to the screen (the real framebuffer for the
+ * hardware backends) and PutImage takes the pixels from a buffer in RAM.
+ * The trace doesn't tell the pixmaps apart, so all the source pixmaps
+ * share one buffer in RAM and all the destination pixmaps another one,
+ * the copies between pixmaps are then never overlapped. The blits,
+ * which are declined by the backend, are done with a plain C fallback and
+ * counted, just like the X server would fall back to the CPU.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <pixman.h>
+
+#include "../src/blt_trace.h"
+#include "../src/sunxi_disp.h"
+#include "../src/fb_copyarea.h"
+#include "../src/cpu_backend.h"
+
+typedef struct {
+    blt_trace_record_t  record;
+    blt_trace_box_t    *boxes;
+} trace_entry_t;
+
+typedef struct {
+    uint8_t *bits;
+    int      stride;    /* in uint32_t units, just like for blt2d_i */
+    int      width, height;
+} buffer_t;
+
+static double get_time_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000. + ts.tv_nsec / 1000.;
+}
+
+/*****************************************************************************/
+
+/* The plain C copy, also used as the fallback for all the other backends */
+static int c_blt(void *self, uint32_t *src_bits, uint32_t *dst_bits,
+                 int src_stride, int dst_stride, int src_bpp, int dst_bpp,
+                 int src_x, int src_y, int dst_x, int dst_y, int w, int h)
+{
+    uint8_t *src, *dst;
+    int bytes = w * src_bpp / 8;
+
+    if (src_bpp != dst_bpp)
+        return 0;
+
+    src = (uint8_t *)(src_bits + src_y * src_stride) + src_x * src_bpp / 8;
+    dst = (uint8_t *)(dst_bits + dst_y * dst_stride) + dst_x * dst_bpp / 8;
+    if (dst > src) {
+        /* bottom up for the overlapped copies */
+        src += (h - 1) * src_stride * 4;
+        dst += (h - 1) * dst_stride * 4;
+        while (h--) {
+            memmove(dst, src, bytes);
+            src -= src_stride * 4;
+            dst -= dst_stride * 4;
+        }
+    }
+    else {
+        while (h--) {
+            memmove(dst, src, bytes);
+            src += src_stride * 4;
+            dst += dst_stride * 4;
+        }
+    }
+    return 1;
+}
+
+/* pixman_blt can't do the overlapped copies, which need to go backwards */
+static int pixman_blt2d(void *self, uint32_t *src_bits, uint32_t *dst_bits,
+                        int src_stride, int dst_stride, int src_bpp,
+                        int dst_bpp, int src_x, int src_y, int dst_x,
+                        int dst_y, int w, int h)
+{
+    if (src_bits == dst_bits &&
+        (dst_y > src_y || (dst_y == src_y && dst_x > src_x)))
+        return 0;
+    return pixman_blt(src_bits, dst_bits, src_stride, dst_stride, src_bpp,
+                      dst_bpp, src_x, src_y, dst_x, dst_y, w, h);
+}
+
+/*****************************************************************************/
+
+static trace_entry_t *load_trace(const char *filename,
+                                 blt_trace_header_t *header, int *count)
+{
+    FILE *file = fopen(filename, "rb");
+    trace_entry_t *entries = NULL;
+    blt_trace_record_t record;
+    blt_trace_box_t *boxes = NULL;
+    int max_boxes = 0, max_entries = 0, result;
+
+    *count = 0;
+    if (!file) {
+        printf("Failed to open %s\n", filename);
+        return NULL;
+    }
+    if (blt_trace_read_header(file, header) < 0) {
+        printf("%s is not a blit trace\n", filename);
+        fclose(file);
+        return NULL;
+    }
+
+    while ((result = blt_trace_read_record(file, &record, &boxes,
+                                           &max_boxes)) > 0) {
+        trace_entry_t *entry;
+        if (*count == max_entries) {
+            max_entries = max_entries ? max_entries * 2 : 1024;
+            entries = realloc(entries, max_entries * sizeof(trace_entry_t));
+        }
+        entry = &entries[(*count)++];
+        entry->record = record;
+        entry->boxes = malloc(record.nbox * sizeof(blt_trace_box_t));
+        memcpy(entry->boxes, boxes, record.nbox * sizeof(blt_trace_box_t));
+    }
+    if (result < 0)
+        printf("Warning: %s is truncated\n", filename);
+    if (*count == 0)
+        printf("%s contains no blits\n", filename);
+
+    free(boxes);
+    fclose(file);
+    return entries;
+}
+
+static buffer_t *select_buffer(int kind, buffer_t *screen, buffer_t *pixmap,
+                               buffer_t *image)
+{
+    switch (kind) {
+    case BLT_TRACE_WINDOW:
+        return screen;
+    case BLT_TRACE_PIXMAP:
+        return pixmap;
+    default:
+        return image;
+    }
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(double *sorted, int n, double p)
+{
+    int i = (int)(p * (n - 1) + 0.5);
+    return n ? sorted[i] : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    blt_trace_header_t header;
+    trace_entry_t *entries;
+    blt2d_i c_blt2d = { NULL, c_blt }, pixman_blt2d_i = { NULL, pixman_blt2d };
+    blt2d_i *blt2d = NULL;
+    sunxi_disp_t *disp = NULL;
+    fb_copyarea_t *fb = NULL;
+    cpu_backend_t *cpu_backend = NULL;
+    buffer_t screen, pixmap, src_pixmap, image;
+    const char *backend;
+    double *latency, total_us = 0, trace_us = 0;
+    uint64_t pixels = 0;
+    unsigned long skipped = 0, fallbacks = 0, nboxes = 0;
+    int count, i, j, loop, loops = 1, opt, screen_bpp, nlatency = 0;
+
+    while ((opt = getopt(argc, argv, "l:")) != -1) {
+        if (opt == 'l')
+            loops = atoi(optarg);
+        else
+            break;
+    }
+    if (argc - optind != 2 || loops <= 0) {
+        printf("Usage: %s [-l loops] <c|pixman|cpu-neon|cpu-vfp|cpu-arm|"
+               "g2d|copyarea> trace.bin\n", argv[0]);
+        return 1;
+    }
+    backend = argv[optind];
+
+    entries = load_trace(argv[optind + 1], &header, &count);
+    if (!entries)
+        return 1;
+
+    /* The screen, either the real framebuffer or a buffer in RAM */
+    screen.width  = header.width;
+    screen.height = header.height;
+    screen_bpp    = header.bpp;
+    if (strcmp(backend, "c") == 0) {
+        blt2d = &c_blt2d;
+    }
+    else if (strcmp(backend, "pixman") == 0) {
+        blt2d = &pixman_blt2d_i;
+    }
+    else if (strncmp(backend, "cpu-", 4) == 0) {
+        /* the screen in RAM is allocated below */
+    }
+    else if (strcmp(backend, "g2d") == 0) {
+        disp = sunxi_disp_init("/dev/fb0", NULL);
+        if (!disp || disp->fd_g2d < 0) {
+            printf("G2D is not available\n");
+            return 1;
+        }
+        blt2d = &disp->blt2d;
+        screen.bits   = disp->framebuffer_addr;
+        screen.width  = disp->xres;
+        screen.height = disp->framebuffer_height;
+        screen_bpp    = disp->bits_per_pixel;
+        screen.stride = disp->xres * screen_bpp / 32;
+    }
+    else if (strcmp(backend, "copyarea") == 0) {
+        fb = fb_copyarea_init("/dev/fb0", NULL);
+        if (!fb) {
+            printf("FBIOCOPYAREA is not available\n");
+            return 1;
+        }
+        blt2d = &fb->blt2d;
+        screen.bits   = fb->framebuffer_addr;
+        screen.width  = fb->xres;
+        screen.height = fb->framebuffer_height;
+        screen_bpp    = fb->bits_per_pixel;
+        screen.stride = fb->framebuffer_stride;
+    }
+    else {
+        printf("Unknown backend '%s'\n", backend);
+        return 1;
+    }
+    if (!disp && !fb) {
+        screen.stride = (screen.width * screen_bpp / 8 + 3) / 4;
+        screen.bits = calloc(screen.stride * 4, screen.height);
+    }
+    if (strncmp(backend, "cpu-", 4) == 0) {
+        cpu_backend = cpu_backend_init(screen.bits,
+                                       screen.stride * 4 * screen.height);
+        if (!cpu_backend ||
+            cpu_backend_select_variant(cpu_backend, backend + 4) != 0) {
+            printf("The '%s' backend is not supported by this CPU\n",
+                   backend);
+            return 1;
+        }
+        blt2d = &cpu_backend->blt2d;
+    }
+
+    /* The buffers are big enough for any of the pixmaps and images */
+    pixmap.width = pixmap.height = image.width = image.height = 0;
+    for (i = 0; i < count; i++) {
+        blt_trace_record_t *r = &entries[i].record;
+        buffer_t *b = r->src_kind == BLT_TRACE_IMAGE ? &image : &pixmap;
+        if (r->src_kind == BLT_TRACE_WINDOW)
+            continue;
+        if (r->src_width > b->width)
+            b->width = r->src_width;
+        if (r->src_height > b->height)
+            b->height = r->src_height;
+    }
+    if (pixmap.width < screen.width)
+        pixmap.width = screen.width;
+    if (pixmap.height < screen.height)
+        pixmap.height = screen.height;
+    pixmap.stride = pixmap.width;
+    pixmap.bits = calloc(pixmap.stride * 4, pixmap.height);
+    src_pixmap = pixmap;
+    src_pixmap.bits = calloc(src_pixmap.stride * 4, src_pixmap.height);
+    image.stride = image.width;
+    image.bits = calloc(image.stride * 4 + 4, image.height + 1);
+
+    latency = malloc(sizeof(double) * count * loops);
+
+    for (loop = 0; loop < loops; loop++) {
+        for (i = 0; i < count; i++) {
+            blt_trace_record_t *r = &entries[i].record;
+            buffer_t *src = select_buffer(r->src_kind, &screen, &src_pixmap,
+                                          &image);
+            buffer_t *dst = select_buffer(r->dst_kind, &screen, &pixmap, &image);
+            int src_bpp = r->src_kind == BLT_TRACE_WINDOW ? screen_bpp : r->src_bpp;
+            int dst_bpp = r->dst_kind == BLT_TRACE_WINDOW ? screen_bpp : r->dst_bpp;
+            int src_stride = src->stride;
+            int src_width = src->width, src_height = src->height;
+            double t1, t2;
+
+            if (loop == 0)
+                trace_us += r->delta_us;
+
+            /* PutImage uses the size and stride of the image itself */
+            if (r->src_kind == BLT_TRACE_IMAGE) {
+                src_width  = r->src_width;
+                src_height = r->src_height;
+                src_stride = (src_width * src_bpp / 8 + 3) / 4;
+            }
+
+            t1 = get_time_us();
+            for (j = 0; j < r->nbox; j++) {
+                blt_trace_box_t *box = &entries[i].boxes[j];
+                int w = box->x2 - box->x1, h = box->y2 - box->y1;
+                int src_x = box->x1 + r->dx, src_y = box->y1 + r->dy;
+
+                if (w <= 0 || h <= 0 || src_bpp != dst_bpp ||
+                    box->x1 < 0 || box->y1 < 0 || src_x < 0 || src_y < 0 ||
+                    box->x2 > dst->width || box->y2 > dst->height ||
+                    src_x + w > src_width || src_y + h > src_height) {
+                    skipped++;
+                    continue;
+                }
+
+                if (!blt2d->overlapped_blt(blt2d->self,
+                                           (uint32_t *)src->bits,
+                                           (uint32_t *)dst->bits,
+                                           src_stride, dst->stride,
+                                           src_bpp, dst_bpp, src_x, src_y,
+                                           box->x1, box->y1, w, h)) {
+                    c_blt(NULL, (uint32_t *)src->bits, (uint32_t *)dst->bits,
+                          src_stride, dst->stride, src_bpp, dst_bpp,
+                          src_x, src_y, box->x1, box->y1, w, h);
+                    fallbacks++;
+                }
+                pixels += (uint64_t)w * h;
+                nboxes++;
+            }
+            t2 = get_time_us();
+            latency[nlatency++] = t2 - t1;
+            total_us += t2 - t1;
+        }
+    }
+
+    qsort(latency, nlatency, sizeof(double), compare_doubles);
+
+    printf("backend: %s, trace: %dx%d %dbpp, %d records, %.2f s recorded\n",
+           backend, header.width, header.height, header.bpp, count,
+           trace_us / 1000000.);
+    printf("replayed %d times: %lu boxes, %.2f MPix, %lu skipped boxes, "
+           "%lu fallbacks\n", loops, nboxes, pixels / 1000000., skipped,
+           fallbacks);
+    printf("throughput: %.2f MPix/s\n",
+           total_us > 0 ? pixels / total_us : 0);
+    printf("latency per record (us): p50 %.1f, p90 %.1f, p99 %.1f, "
+           "max %.1f\n", percentile(latency, nlatency, 0.5),
+           percentile(latency, nlatency, 0.9),
+           percentile(latency, nlatency, 0.99),
+           percentile(latency, nlatency, 1.0));
+
+    free(latency);
+    for (i = 0; i < count; i++)
+        free(entries[i].boxes);
+    free(entries);
+    free(pixmap.bits);
+    free(src_pixmap.bits);
+    free(image.bits);
+    if (cpu_backend)
+        cpu_backend_close(cpu_backend);
+    if (disp)
+        sunxi_disp_close(disp);
+    else if (fb)
+        fb_copyarea_close(fb);
+    else
+        free(screen.bits);
+    return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright © 2016 fbturbo developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Checks the DRI2 buffer queue (see dri2_buf_queue.h), in particular that
+ * the lost buffer requests are noticed when the buffers are fetched.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "../src/dri2_buf_queue.h"
+
+static int failures;
+
+#define CHECK(cond) do {                                                 \
+        if (!(cond)) {                                                   \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                  \
+        }                                                                \
+    } while (0)
+
+/* Fetch one buffer and check what it is and whether it is in order */
+static void check_fetch(dri2_buf_queue_t *q, unsigned int expected_seq,
+                        int expected_in_order)
+{
+    unsigned int seq = 0;
+    int in_order = -1;
+    void *buf = dri2_buf_queue_fetch(q, &seq, &in_order);
+
+    CHECK(buf == (void *)(uintptr_t)expected_seq);
+    CHECK(seq == expected_seq);
+    CHECK(in_order == expected_in_order);
+}
+
+/* The head and tail counters start at 'start', to check the wraparound */
+static void run_checks(unsigned int start)
+{
+    dri2_buf_queue_t q = { .head = start, .tail = start };
+    unsigned int seq, i;
+    int in_order;
+
+    /* Empty queue */
+    CHECK(dri2_buf_queue_fetch(&q, &seq, &in_order) == NULL);
+
+    /* Requests and swaps in lockstep, then two requests ahead */
+    for (i = 1; i <= 3; i++) {
+        CHECK(dri2_buf_queue_add(&q, (void *)(uintptr_t)i, i) == 0);
+        check_fetch(&q, i, 1);
+    }
+    CHECK(dri2_buf_queue_add(&q, (void *)4, 4) == 0);
+    CHECK(dri2_buf_queue_add(&q, (void *)5, 5) == 0);
+    check_fetch(&q, 4, 1);
+    check_fetch(&q, 5, 1);
+
+    /* Fill the queue, the next request is dropped */
+    for (i = 6; i < 6 + DRI2_BUF_QUEUE_SIZE; i++)
+        CHECK(dri2_buf_queue_add(&q, (void *)(uintptr_t)i, i) == 0);
+    CHECK(dri2_buf_queue_add(&q, (void *)(uintptr_t)i, i) == -1);
+    for (i = 6; i < 6 + DRI2_BUF_QUEUE_SIZE; i++)
+        check_fetch(&q, i, 1);
+    CHECK(dri2_buf_queue_fetch(&q, &seq, &in_order) == NULL);
+
+    /* The buffer after the dropped one is out of sequence */
+    i = 6 + DRI2_BUF_QUEUE_SIZE + 1;
+    CHECK(dri2_buf_queue_add(&q, (void *)(uintptr_t)i, i) == 0);
+    check_fetch(&q, i, 0);
+    /* And the one after it is fine again */
+    i++;
+    CHECK(dri2_buf_queue_add(&q, (void *)(uintptr_t)i, i) == 0);
+    check_fetch(&q, i, 1);
+
+    /* Requests served without the queue restart the sequence ... */
+    dri2_buf_queue_restart_seq(&q);
+    CHECK(dri2_buf_queue_add(&q, (void *)100, 100) == 0);
+    check_fetch(&q, 100, 1);
+
+    /* ... but not while some buffers are still waiting for their swaps */
+    CHECK(dri2_buf_queue_add(&q, (void *)101, 101) == 0);
+    dri2_buf_queue_restart_seq(&q);
+    CHECK(dri2_buf_queue_add(&q, (void *)105, 105) == 0);
+    check_fetch(&q, 101, 1);
+    check_fetch(&q, 105, 0);
+}
+
+int main(void)
+{
+    run_checks(0);
+    run_checks(UINT_MAX - 5);
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,869 @@
+/*
+ * Copyright © 2016 fbturbo developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * An LD_PRELOAD shim, which emulates the kernel devices used by fbturbo
+ * (/dev/fb0, /dev/fb1, /dev/disp, /dev/g2d and /dev/rga) in software, so
+ * that sunxi_disp_init, fb_copyarea_init and the benchmarks can run
+ * unmodified on a build host without the real hardware. rk_fb_init needs
+ * a ScreenPtr, so the RGA emulation is only driven by the ioctls issued
+ * directly from fakedev_check:
+ *
+ *   LD_PRELOAD=test/.libs/fakedev.so FAKEDEV_PLATFORM=sunxi \
+ *       test/sunxi_g2d_bench
+ *
+ * The framebuffer lives in a memfd, the accelerated ioctls are done with
+ * plain memory copies. The behaviour can be tuned with environment
+ * variables:
+ *
+ *   FAKEDEV_PLATFORM    - "sunxi" (disp + g2d), "rockchip" (rga + overlay)
+ *                         or "generic" (only FBIOCOPYAREA), the default
+ *   FAKEDEV_MODE        - framebuffer mode as WxHxBPP, "1280x720x32"
+ *   FAKEDEV_FB_MB       - framebuffer size in MiB, three screens by default
+ *   FAKEDEV_COPYAREA    - 1/0 to force FBIOCOPYAREA support on or off
+ *   FAKEDEV_LATENCY_US  - fixed latency added to every accelerated ioctl
+ *   FAKEDEV_MPIXELS     - simulated throughput of the accelerated ioctls
+ *                         in MPix/s, 0 (unlimited) by default
+ *   FAKEDEV_VSYNC_HZ    - refresh rate for FBIO_WAITFORVSYNC, 60 by default
+ *   FAKEDEV_VERBOSE     - print the ioctl statistics at exit
+ */
+
+#define _GNU_SOURCE
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/fb.h>
+
+#include "../src/sunxi_disp_ioctl.h"
+#include "../src/g2d_driver.h"
+#include "../src/rga.h"
+
+/* The same non-standard ioctl as used in fb_copyarea.c */
+#define FBIOCOPYAREA                _IOW('z', 0x21, struct fb_copyarea)
+
+#ifndef FBIO_WAITFORVSYNC
+#define FBIO_WAITFORVSYNC           _IOW('F', 0x20, uint32_t)
+#endif
+
+/* Rockchip specific framebuffer ioctls, see rk_fb.h */
+#define RK_FBIOSET_YUV_ADDR         0x5002
+#define RK_FBIOSET_OVERLAY_STATE    0x5018
+#define RK_FBIOSET_ENABLE           0x5019
+#define RK_FBIOGET_ENABLE           0x5020
+#define FBIOPUT_SET_CURSOR_EN       0x4609
+#define FBIOPUT_SET_CURSOR_IMG      0x460a
+#define FBIOPUT_SET_CURSOR_POS      0x460b
+#define FBIOPUT_SET_CURSOR_CMAP     0x460c
+#define FBIOGET_PHYMEMINFO          0x461d
+#define FBIOPUT_SET_COLOR_KEY       0x461f
+#define RK_FBIOSET_CONFIG_DONE      0x4628
+
+struct rk_fb_mem_inf {
+    uint32_t yrgb;
+    uint32_t cbr;
+    uint32_t len;
+};
+
+#define FAKEDEV_MAX_FDS             1024
+#define FAKEDEV_MAX_MAPPINGS        16
+#define FAKEDEV_FB_PADDR            0x48000000
+#define FAKEDEV_FIRST_LAYER_ID      100
+
+enum {
+    FAKEDEV_NONE = 0,
+    FAKEDEV_FB,
+    FAKEDEV_FB_OVERLAY,
+    FAKEDEV_DISP,
+    FAKEDEV_G2D,
+    FAKEDEV_RGA,
+};
+
+enum {
+    PLATFORM_GENERIC,
+    PLATFORM_SUNXI,
+    PLATFORM_ROCKCHIP,
+};
+
+typedef struct {
+    uint8_t *addr;
+    size_t   len;
+} fakedev_mapping_t;
+
+static struct {
+    int       initialized;
+    int       platform;
+    int       has_copyarea;
+    int       verbose;
+    uint64_t  latency_ns;
+    uint64_t  mpixels;
+    uint64_t  vsync_period_ns;
+
+    struct fb_var_screeninfo var;
+    struct fb_fix_screeninfo fix;
+
+    int       memfd;
+    uint8_t  *fb_mem;       /* our own mapping of the framebuffer */
+    uint32_t  fb_size;
+    int       next_layer_id;
+
+    unsigned char     fd_kind[FAKEDEV_MAX_FDS];
+    fakedev_mapping_t mappings[FAKEDEV_MAX_MAPPINGS];
+
+    unsigned long n_copyarea, n_g2d_blt, n_g2d_fill, n_rga_blt, n_vsync;
+    unsigned long n_failed;
+} fakedev;
+
+static int   (*real_open)(const char *, int, ...);
+static int   (*real_open64)(const char *, int, ...);
+static int   (*real_close)(int);
+static int   (*real_ioctl)(int, unsigned long, ...);
+static void *(*real_mmap)(void *, size_t, int, int, int, off_t);
+static void *(*real_mmap64)(void *, size_t, int, int, int, off64_t);
+static int   (*real_munmap)(void *, size_t);
+
+static void load_real_symbols(void)
+{
+    if (real_open)
+        return;
+    real_open   = dlsym(RTLD_NEXT, "open");
+    real_open64 = dlsym(RTLD_NEXT, "open64");
+    real_close  = dlsym(RTLD_NEXT, "close");
+    real_ioctl  = dlsym(RTLD_NEXT, "ioctl");
+    real_mmap   = dlsym(RTLD_NEXT, "mmap");
+    real_mmap64 = dlsym(RTLD_NEXT, "mmap64");
+    real_munmap = dlsym(RTLD_NEXT, "munmap");
+}
+
+static long getenv_long(const char *name, long default_value)
+{
+    const char *s = getenv(name);
+    return (s && *s) ? strtol(s, NULL, 0) : default_value;
+}
+
+/*****************************************************************************/
+
+static int setup_framebuffer(void)
+{
+    const char *mode = getenv("FAKEDEV_MODE");
+    unsigned xres = 1280, yres = 720, bpp = 32;
+    uint64_t htotal, vtotal, hz;
+    uint32_t line_length;
+
+    if (mode && sscanf(mode, "%ux%ux%u", &xres, &yres, &bpp) != 3) {
+        fprintf(stderr, "fakedev: bad FAKEDEV_MODE '%s'\n", mode);
+        return -1;
+    }
+    if (bpp != 16 && bpp != 24 && bpp != 32) {
+        fprintf(stderr, "fakedev: unsupported bpp %u\n", bpp);
+        return -1;
+    }
+
+    line_length = xres * bpp / 8;
+    fakedev.fb_size = getenv_long("FAKEDEV_FB_MB", 0) * 1024 * 1024;
+    if (fakedev.fb_size == 0)
+        fakedev.fb_size = line_length * yres * 3;
+    fakedev.fb_size = (fakedev.fb_size + 4095) & ~4095;
+    if (fakedev.fb_size < line_length * yres) {
+        fprintf(stderr, "fakedev: FAKEDEV_FB_MB is too small\n");
+        return -1;
+    }
+
+    fakedev.memfd = syscall(SYS_memfd_create, "fakedev-fb", 0);
+    if (fakedev.memfd < 0 || ftruncate(fakedev.memfd, fakedev.fb_size) < 0) {
+        fprintf(stderr, "fakedev: failed to create the memfd\n");
+        return -1;
+    }
+    fakedev.fb_mem = real_mmap(NULL, fakedev.fb_size, PROT_READ | PROT_WRITE,
+                               MAP_SHARED, fakedev.memfd, 0);
+    if (fakedev.fb_mem == MAP_FAILED) {
+        real_close(fakedev.memfd);
+        return -1;
+    }
+
+    memset(&fakedev.var, 0, sizeof(fakedev.var));
+    fakedev.var.xres           = xres;
+    fakedev.var.yres           = yres;
+    fakedev.var.xres_virtual   = xres;
+    fakedev.var.yres_virtual   = fakedev.fb_size / line_length;
+    fakedev.var.bits_per_pixel = bpp;
+    if (bpp == 16) {
+        fakedev.var.red.offset   = 11;
+        fakedev.var.red.length   = 5;
+        fakedev.var.green.offset = 5;
+        fakedev.var.green.length = 6;
+        fakedev.var.blue.length  = 5;
+    }
+    else {
+        fakedev.var.red.offset   = 16;
+        fakedev.var.red.length   = 8;
+        fakedev.var.green.offset = 8;
+        fakedev.var.green.length = 8;
+        fakedev.var.blue.length  = 8;
+    }
+    /* some plausible timings, pixclock matches the requested refresh rate */
+    hz = getenv_long("FAKEDEV_VSYNC_HZ", 60);
+    if (hz <= 0)
+        hz = 60;
+    fakedev.var.left_margin  = 40;
+    fakedev.var.right_margin = 40;
+    fakedev.var.hsync_len    = 40;
+    fakedev.var.upper_margin = 10;
+    fakedev.var.lower_margin = 10;
+    fakedev.var.vsync_len    = 5;
+    htotal = xres + 120;
+    vtotal = yres + 25;
+    fakedev.var.pixclock = 1000000000000ULL / (htotal * vtotal * hz);
+    fakedev.vsync_period_ns = 1000000000ULL / hz;
+
+    memset(&fakedev.fix, 0, sizeof(fakedev.fix));
+    strcpy(fakedev.fix.id, "fakedev");
+    fakedev.fix.smem_start  = FAKEDEV_FB_PADDR;
+    fakedev.fix.smem_len    = fakedev.fb_size;
+    fakedev.fix.type        = FB_TYPE_PACKED_PIXELS;
+    fakedev.fix.visual      = FB_VISUAL_TRUECOLOR;
+    fakedev.fix.line_length = line_length;
+
+    return 0;
+}
+
+__attribute__((constructor))
+static void fakedev_init(void)
+{
+    const char *platform = getenv("FAKEDEV_PLATFORM");
+
+    load_real_symbols();
+
+    fakedev.platform = PLATFORM_GENERIC;
+    if (platform && strcmp(platform, "sunxi") == 0)
+        fakedev.platform = PLATFORM_SUNXI;
+    else if (platform && strcmp(platform, "rockchip") == 0)
+        fakedev.platform = PLATFORM_ROCKCHIP;
+
+    fakedev.has_copyarea = getenv_long("FAKEDEV_COPYAREA",
+                                       fakedev.platform == PLATFORM_GENERIC);
+    fakedev.latency_ns   = getenv_long("FAKEDEV_LATENCY_US", 0) * 1000;
+    fakedev.mpixels      = getenv_long("FAKEDEV_MPIXELS", 0);
+    fakedev.verbose      = getenv_long("FAKEDEV_VERBOSE", 0);
+    fakedev.next_layer_id = FAKEDEV_FIRST_LAYER_ID;
+
+    fakedev.initialized = setup_framebuffer() == 0;
+}
+
+__attribute__((destructor))
+static void fakedev_fini(void)
+{
+    if (!fakedev.verbose)
+        return;
+    fprintf(stderr, "fakedev: %lu copyarea, %lu g2d blt, %lu g2d fill, "
+                    "%lu rga blt, %lu vsync waits, %lu failed ioctls\n",
+            fakedev.n_copyarea, fakedev.n_g2d_blt, fakedev.n_g2d_fill,
+            fakedev.n_rga_blt, fakedev.n_vsync, fakedev.n_failed);
+}
+
+/*****************************************************************************/
+
+static uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t t)
+{
+    struct timespec ts;
+    ts.tv_sec  = t / 1000000000;
+    ts.tv_nsec = t % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+/* Make an operation, which started at 'start', take as long as configured */
+static void simulate_latency(uint64_t start, uint64_t pixels)
+{
+    uint64_t ns = fakedev.latency_ns;
+    if (fakedev.mpixels)
+        ns += pixels * 1000 / fakedev.mpixels;
+    if (ns)
+        sleep_until_ns(start + ns);
+}
+
+static int wait_for_vsync(void)
+{
+    uint64_t now = get_time_ns();
+    fakedev.n_vsync++;
+    sleep_until_ns(now - now % fakedev.vsync_period_ns +
+                   fakedev.vsync_period_ns);
+    return 0;
+}
+
+/* Translate a physical address in the fake framebuffer to a pointer */
+static uint8_t *phys_to_virt(uint32_t paddr, size_t len)
+{
+    uint32_t offs = paddr - FAKEDEV_FB_PADDR;
+    if (paddr < FAKEDEV_FB_PADDR || offs > fakedev.fb_size ||
+        len > fakedev.fb_size - offs)
+        return NULL;
+    return fakedev.fb_mem + offs;
+}
+
+/*
+ * RGA works with user space addresses through its MMU. These are passed to
+ * the kernel in 32-bit fields, so on a 64-bit build host only the lower 32
+ * bits survive and have to be matched against the known mappings.
+ */
+static uint8_t *user_to_virt(uint32_t uaddr, size_t len)
+{
+    int i;
+    for (i = 0; i < FAKEDEV_MAX_MAPPINGS; i++) {
+        fakedev_mapping_t *m = &fakedev.mappings[i];
+        uint32_t offs = uaddr - (uint32_t)(uintptr_t)m->addr;
+        if (m->addr && offs <= m->len && len <= m->len - offs)
+            return m->addr + offs;
+    }
+    return NULL;
+}
+
+/*****************************************************************************/
+
+static uint32_t read_pixel(const uint8_t *p, int bpp)
+{
+    uint32_t v;
+    switch (bpp) {
+    case 16:
+        v = *(const uint16_t *)p;
+        return 0xFF000000 | ((v & 0xF800) << 8) | ((v & 0xE000) << 3) |
+               ((v & 0x07E0) << 5) | ((v & 0x0600) >> 1) |
+               ((v & 0x001F) << 3) | ((v & 0x001C) >> 2);
+    case 24:
+        return 0xFF000000 | p[0] | (p[1] << 8) | (p[2] << 16);
+    default:
+        return *(const uint32_t *)p;
+    }
+}
+
+static void write_pixel(uint8_t *p, int bpp, uint32_t v)
+{
+    switch (bpp) {
+    case 16:
+        *(uint16_t *)p = ((v >> 8) & 0xF800) | ((v >> 5) & 0x07E0) |
+                         ((v >> 3) & 0x001F);
+        break;
+    case 24:
+        p[0] = v;
+        p[1] = v >> 8;
+        p[2] = v >> 16;
+        break;
+    default:
+        *(uint32_t *)p = v;
+        break;
+    }
+}
+
+/*
+ * The software counterpart of all the 2D engines: a possibly overlapping
+ * copy of a w x h rectangle, converting the pixels if the bpp differs.
+ */
+static void copy_rect(uint8_t *src, int src_stride, int src_bpp,
+                      uint8_t *dst, int dst_stride, int dst_bpp,
+                      int w, int h)
+{
+    int y, x;
+    int src_step = src_stride, dst_step = dst_stride;
+
+    /* go bottom up if the destination is below the source */
+    if (dst > src) {
+        src += (h - 1) * src_stride;
+        dst += (h - 1) * dst_stride;
+        src_step = -src_stride;
+        dst_step = -dst_stride;
+    }
+
+    for (y = 0; y < h; y++) {
+        if (src_bpp == dst_bpp) {
+            memmove(dst, src, w * src_bpp / 8);
+        }
+        else {
+            for (x = 0; x < w; x++)
+                write_pixel(dst + x * dst_bpp / 8, dst_bpp,
+                            read_pixel(src + x * src_bpp / 8, src_bpp));
+        }
+        src += src_step;
+        dst += dst_step;
+    }
+}
+
+static void fill_rect(uint8_t *dst, int dst_stride, int dst_bpp,
+                      int w, int h, uint32_t color)
+{
+    int y, x;
+    for (y = 0; y < h; y++, dst += dst_stride)
+        for (x = 0; x < w; x++)
+            write_pixel(dst + x * dst_bpp / 8, dst_bpp, color);
+}
+
+/*****************************************************************************/
+
+static int fb_copyarea(struct fb_copyarea *area)
+{
+    int bpp = fakedev.var.bits_per_pixel;
+    int stride = fakedev.fix.line_length;
+    uint8_t *src, *dst;
+
+    if (area->sx + area->width > fakedev.var.xres_virtual ||
+        area->dx + area->width > fakedev.var.xres_virtual ||
+        area->sy + area->height > fakedev.var.yres_virtual ||
+        area->dy + area->height > fakedev.var.yres_virtual)
+        return -EINVAL;
+
+    src = fakedev.fb_mem + area->sy * stride + area->sx * bpp / 8;
+    dst = fakedev.fb_mem + area->dy * stride + area->dx * bpp / 8;
+    copy_rect(src, stride, bpp, dst, stride, bpp, area->width, area->height);
+    fakedev.n_copyarea++;
+    return 0;
+}
+
+static int fb_ioctl(int kind, unsigned long request, void *arg)
+{
+    switch (request) {
+    case FBIOGET_VSCREENINFO:
+        memcpy(arg, &fakedev.var, sizeof(fakedev.var));
+        return 0;
+    case FBIOPUT_VSCREENINFO:
+    case FBIOPAN_DISPLAY: {
+        struct fb_var_screeninfo *var = arg;
+        /* only panning is supported, no mode changes */
+        if (var->xres != fakedev.var.xres || var->yres != fakedev.var.yres ||
+            var->bits_per_pixel != fakedev.var.bits_per_pixel)
+            return kind == FAKEDEV_FB_OVERLAY ? 0 : -EINVAL;
+        fakedev.var.xoffset = var->xoffset;
+        fakedev.var.yoffset = var->yoffset;
+        return 0;
+    }
+    case FBIOGET_FSCREENINFO:
+        memcpy(arg, &fakedev.fix, sizeof(fakedev.fix));
+        return 0;
+    case FBIOBLANK:
+    case FBIOPUTCMAP:
+    case FBIOGETCMAP:
+        return 0;
+    case FBIO_WAITFORVSYNC:
+        return wait_for_vsync();
+    case FBIOCOPYAREA:
+        if (!fakedev.has_copyarea)
+            break;
+        return fb_copyarea(arg);
+    }
+
+    if (fakedev.platform == PLATFORM_SUNXI) {
+        switch (request) {
+        case FBIOGET_LAYER_HDL_0:
+        case FBIOGET_LAYER_HDL_1:
+            *(uint32_t *)arg = FAKEDEV_FIRST_LAYER_ID - 1;
+            return 0;
+        }
+    }
+
+    if (fakedev.platform == PLATFORM_ROCKCHIP) {
+        switch (request) {
+        case FBIOGET_PHYMEMINFO: {
+            struct rk_fb_mem_inf *mem_info = arg;
+            mem_info->yrgb = FAKEDEV_FB_PADDR;
+            mem_info->cbr  = 0;
+            mem_info->len  = fakedev.fb_size;
+            return 0;
+        }
+        case RK_FBIOGET_ENABLE:
+            *(int *)arg = 1;
+            return 0;
+        /* the overlay and the cursor are not emulated, just accepted */
+        case RK_FBIOSET_YUV_ADDR:
+        case RK_FBIOSET_OVERLAY_STATE:
+        case RK_FBIOSET_ENABLE:
+        case RK_FBIOSET_CONFIG_DONE:
+        case FBIOPUT_SET_CURSOR_EN:
+        case FBIOPUT_SET_CURSOR_IMG:
+        case FBIOPUT_SET_CURSOR_POS:
+        case FBIOPUT_SET_CURSOR_CMAP:
+        case FBIOPUT_SET_COLOR_KEY:
+            return 0;
+        }
+    }
+
+    return -ENOTTY;
+}
+
+/*****************************************************************************/
+
+static int disp_ioctl(unsigned long request, void *arg)
+{
+    switch (request) {
+    case DISP_CMD_VERSION:
+        return SUNXI_DISP_VERSION;
+    case DISP_CMD_LAYER_REQUEST:
+        return fakedev.next_layer_id++;
+    case DISP_CMD_LAYER_GET_PARA:
+        /*
+         * The layer info pointer is passed in a 32-bit field, which is
+         * useless on a 64-bit build host. Nobody looks at the result
+         * apart from passing it back with DISP_CMD_LAYER_SET_PARA.
+         */
+        return 0;
+    }
+    /* everything else only changes the (not emulated) display state */
+    return 0;
+}
+
+/*****************************************************************************/
+
+static int g2d_format_bpp(g2d_data_fmt format)
+{
+    if (format <= G2D_FMT_RGBX8888)
+        return 32;
+    if (format <= G2D_FMT_BGR565)
+        return 16;
+    return 0;
+}
+
+static uint8_t *g2d_image_rect(g2d_image *image, int x, int y, int w, int h,
+                               int *stride, int *bpp)
+{
+    uint8_t *p;
+
+    *bpp = g2d_format_bpp(image->format);
+    *stride = image->w * *bpp / 8;
+    if (*bpp == 0 || x < 0 || y < 0 || w <= 0 || h <= 0 ||
+        x + w > (int)image->w || y + h > (int)image->h)
+        return NULL;
+    p = phys_to_virt(image->addr[0], (size_t)*stride * image->h);
+    return p ? p + y * *stride + x * *bpp / 8 : NULL;
+}
+
+static int g2d_ioctl(unsigned long request, void *arg)
+{
+    int src_stride, dst_stride, src_bpp, dst_bpp;
+    uint8_t *src, *dst;
+    uint64_t start = get_time_ns();
+
+    switch (request) {
+    case G2D_CMD_BITBLT: {
+        g2d_blt *blt = arg;
+        if (blt->flag != G2D_BLT_NONE)
+            return -EINVAL;
+        src = g2d_image_rect(&blt->src_image, blt->src_rect.x, blt->src_rect.y,
+                             blt->src_rect.w, blt->src_rect.h,
+                             &src_stride, &src_bpp);
+        dst = g2d_image_rect(&blt->dst_image, blt->dst_x, blt->dst_y,
+                             blt->src_rect.w, blt->src_rect.h,
+                             &dst_stride, &dst_bpp);
+        if (!src || !dst)
+            return -EINVAL;
+        copy_rect(src, src_stride, src_bpp, dst, dst_stride, dst_bpp,
+                  blt->src_rect.w, blt->src_rect.h);
+        simulate_latency(start, (uint64_t)blt->src_rect.w * blt->src_rect.h);
+        fakedev.n_g2d_blt++;
+        return 0;
+    }
+    case G2D_CMD_FILLRECT: {
+        g2d_fillrect *fill = arg;
+        if (fill->flag != G2D_FIL_NONE)
+            return -EINVAL;
+        dst = g2d_image_rect(&fill->dst_image, fill->dst_rect.x,
+                             fill->dst_rect.y, fill->dst_rect.w,
+                             fill->dst_rect.h, &dst_stride, &dst_bpp);
+        if (!dst)
+            return -EINVAL;
+        fill_rect(dst, dst_stride, dst_bpp, fill->dst_rect.w,
+                  fill->dst_rect.h, fill->color);
+        simulate_latency(start, (uint64_t)fill->dst_rect.w * fill->dst_rect.h);
+        fakedev.n_g2d_fill++;
+        return 0;
+    }
+    }
+    /* scaling and YUV conversion are not emulated */
+    return -EINVAL;
+}
+
+/*****************************************************************************/
+
+static int rga_format_bpp(unsigned int format)
+{
+    switch (format) {
+    case RK_FORMAT_RGBA_8888:
+    case RK_FORMAT_RGBX_8888:
+    case RK_FORMAT_BGRA_8888:
+        return 32;
+    case RK_FORMAT_RGB_888:
+    case RK_FORMAT_BGR_888:
+        return 24;
+    case RK_FORMAT_RGB_565:
+        return 16;
+    }
+    return 0;
+}
+
+static uint8_t *rga_image_rect(rga_img_info_t *image, int mmu_en,
+                               int *stride, int *bpp)
+{
+    uint8_t *p;
+    size_t len;
+
+    *bpp = rga_format_bpp(image->format);
+    *stride = image->vir_w * *bpp / 8;
+    if (*bpp == 0 || image->x_offset + image->act_w > image->vir_w ||
+        image->y_offset + image->act_h > image->vir_h)
+        return NULL;
+    len = (size_t)*stride * image->vir_h;
+    p = mmu_en ? user_to_virt(image->yrgb_addr, len) :
+                 phys_to_virt(image->yrgb_addr, len);
+    return p ? p + image->y_offset * *stride + image->x_offset * *bpp / 8
+             : NULL;
+}
+
+static int rga_ioctl(unsigned long request, void *arg)
+{
+    struct rga_req *req = arg;
+    int src_stride, dst_stride, src_bpp, dst_bpp;
+    uint8_t *src, *dst;
+    uint64_t start = get_time_ns();
+
+    switch (request) {
+    case RGA_BLIT_SYNC:
+    case RGA_BLIT_ASYNC:
+        if (req->render_mode != bitblt_mode ||
+            req->src.act_w != req->dst.act_w ||
+            req->src.act_h != req->dst.act_h)
+            return -EINVAL;
+        src = rga_image_rect(&req->src, req->mmu_info.mmu_en,
+                             &src_stride, &src_bpp);
+        dst = rga_image_rect(&req->dst, req->mmu_info.mmu_en,
+                             &dst_stride, &dst_bpp);
+        if (!src || !dst)
+            return -EINVAL;
+        copy_rect(src, src_stride, src_bpp, dst, dst_stride, dst_bpp,
+                  req->src.act_w, req->src.act_h);
+        simulate_latency(start, (uint64_t)req->src.act_w * req->src.act_h);
+        fakedev.n_rga_blt++;
+        return 0;
+    case RGA_FLUSH:
+    case RGA_GET_RESULT:
+    case RGA_GET_VERSION:
+        return 0;
+    }
+    return -ENOTTY;
+}
+
+/*****************************************************************************/
+
+static int device_kind(const char *path)
+{
+    if (!fakedev.initialized || !path)
+        return FAKEDEV_NONE;
+    if (strcmp(path, "/dev/fb0") == 0)
+        return FAKEDEV_FB;
+    if (fakedev.platform == PLATFORM_SUNXI) {
+        if (strcmp(path, "/dev/fb1") == 0)
+            return FAKEDEV_FB;
+        if (strcmp(path, "/dev/disp") == 0)
+            return FAKEDEV_DISP;
+        if (strcmp(path, "/dev/g2d") == 0)
+            return FAKEDEV_G2D;
+    }
+    if (fakedev.platform == PLATFORM_ROCKCHIP) {
+        if (strcmp(path, "/dev/fb1") == 0)
+            return FAKEDEV_FB_OVERLAY;
+        if (strcmp(path, "/dev/rga") == 0)
+            return FAKEDEV_RGA;
+    }
+    return FAKEDEV_NONE;
+}
+
+static int open_fake_device(int kind)
+{
+    /* every fake device is backed by the framebuffer memfd */
+    int fd = dup(fakedev.memfd);
+    if (fd < 0)
+        return -1;
+    if (fd >= FAKEDEV_MAX_FDS) {
+        real_close(fd);
+        errno = EMFILE;
+        return -1;
+    }
+    fakedev.fd_kind[fd] = kind;
+    return fd;
+}
+
+static int get_fd_kind(int fd)
+{
+    if (fd < 0 || fd >= FAKEDEV_MAX_FDS)
+        return FAKEDEV_NONE;
+    return fakedev.fd_kind[fd];
+}
+
+int open(const char *path, int flags, ...)
+{
+    mode_t mode = 0;
+    int kind = device_kind(path);
+
+    if (kind != FAKEDEV_NONE)
+        return open_fake_device(kind);
+
+    if (flags & O_CREAT) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, int);
+        va_end(ap);
+    }
+    load_real_symbols();
+    return real_open(path, flags, mode);
+}
+
+int open64(const char *path, int flags, ...)
+{
+    mode_t mode = 0;
+    int kind = device_kind(path);
+
+    if (kind != FAKEDEV_NONE)
+        return open_fake_device(kind);
+
+    if (flags & O_CREAT) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, int);
+        va_end(ap);
+    }
+    load_real_symbols();
+    return real_open64(path, flags, mode);
+}
+
+/* used instead of open() when building with _FORTIFY_SOURCE */
+int __open_2(const char *path, int flags)
+{
+    return open(path, flags);
+}
+
+int __open64_2(const char *path, int flags)
+{
+    return open64(path, flags);
+}
+
+int close(int fd)
+{
+    load_real_symbols();
+    if (get_fd_kind(fd) != FAKEDEV_NONE)
+        fakedev.fd_kind[fd] = FAKEDEV_NONE;
+    return real_close(fd);
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+    int kind = get_fd_kind(fd);
+    int result;
+    void *arg;
+    va_list ap;
+
+    va_start(ap, request);
+    arg = va_arg(ap, void *);
+    va_end(ap);
+
+    switch (kind) {
+    case FAKEDEV_FB:
+    case FAKEDEV_FB_OVERLAY:
+        result = fb_ioctl(kind, request, arg);
+        break;
+    case FAKEDEV_DISP:
+        result = disp_ioctl(request, arg);
+        break;
+    case FAKEDEV_G2D:
+        result = g2d_ioctl(request, arg);
+        break;
+    case FAKEDEV_RGA:
+        result = rga_ioctl(request, arg);
+        break;
+    default:
+        load_real_symbols();
+        return real_ioctl(fd, request, arg);
+    }
+
+    if (result < 0) {
+        fakedev.n_failed++;
+        errno = -result;
+        return -1;
+    }
+    return result;
+}
+
+/* remember the framebuffer mappings for resolving RGA addresses */
+static void add_mapping(void *addr, size_t len, int fd)
+{
+    int i;
+    if (addr == MAP_FAILED || get_fd_kind(fd) == FAKEDEV_NONE)
+        return;
+    for (i = 0; i < FAKEDEV_MAX_MAPPINGS; i++) {
+        if (!fakedev.mappings[i].addr) {
+            fakedev.mappings[i].addr = addr;
+            fakedev.mappings[i].len  = len;
+            return;
+        }
+    }
+}
+
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offs)
+{
+    void *result;
+    load_real_symbols();
+    result = real_mmap(addr, len, prot, flags, fd, offs);
+    add_mapping(result, len, fd);
+    return result;
+}
+
+void *mmap64(void *addr, size_t len, int prot, int flags, int fd, off64_t offs)
+{
+    void *result;
+    load_real_symbols();
+    result = real_mmap64(addr, len, prot, flags, fd, offs);
+    add_mapping(result, len, fd);
+    return result;
+}
+
+int munmap(void *addr, size_t len)
+{
+    int i;
+
+    load_real_symbols();
+    for (i = 0; i < FAKEDEV_MAX_MAPPINGS; i++) {
+        if (fakedev.mappings[i].addr == addr)
+            fakedev.mappings[i].addr = NULL;
+    }
+    return real_munmap(addr, len);
+}
@@ -0,0 +1,220 @@
+/*
+ * Copyright © 2016 fbturbo developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Checks the blit backends against a plain C implementation, running on
+ * top of the devices emulated by fakedev.so (see fakedev.c):
+ *
+ *   LD_PRELOAD=.libs/fakedev.so FAKEDEV_PLATFORM=sunxi FAKEDEV_COPYAREA=1 \
+ *       ./fakedev_check
+ *
+ * With FAKEDEV_PLATFORM=rockchip the RGA blits are checked instead.
+ * The backends are allowed to decline a blit, it is then done with the
+ * reference implementation in place (just like the CPU fallback would do).
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/fb.h>
+
+#include "../src/sunxi_disp.h"
+#include "../src/fb_copyarea.h"
+#include "../src/rga.h"
+
+#define NTESTS  2000
+
+/* Overlapping copy within a single 32bpp buffer */
+static void reference_blt(uint32_t *bits, int stride, int src_x, int src_y,
+                          int dst_x, int dst_y, int w, int h)
+{
+    int y;
+    if (dst_y > src_y) {
+        for (y = h - 1; y >= 0; y--)
+            memmove(bits + (dst_y + y) * stride + dst_x,
+                    bits + (src_y + y) * stride + src_x, w * 4);
+    }
+    else {
+        for (y = 0; y < h; y++)
+            memmove(bits + (dst_y + y) * stride + dst_x,
+                    bits + (src_y + y) * stride + src_x, w * 4);
+    }
+}
+
+static int check_blt2d(const char *name, blt2d_i *blt2d, uint32_t *fb,
+                       int xres, int yres, int stride)
+{
+    uint32_t *ref = malloc(stride * yres * 4);
+    int i, accelerated = 0;
+
+    srand(0);
+    for (i = 0; i < stride * yres; i++)
+        fb[i] = ref[i] = rand();
+
+    for (i = 0; i < NTESTS; i++) {
+        int w = rand() % xres + 1;
+        int h = rand() % yres + 1;
+        int src_x = rand() % (xres - w + 1);
+        int src_y = rand() % (yres - h + 1);
+        int dst_x = rand() % (xres - w + 1);
+        int dst_y = rand() % (yres - h + 1);
+
+        if (blt2d->overlapped_blt(blt2d->self, fb, fb, stride, stride, 32, 32,
+                                  src_x, src_y, dst_x, dst_y, w, h))
+            accelerated++;
+        else
+            reference_blt(fb, stride, src_x, src_y, dst_x, dst_y, w, h);
+        reference_blt(ref, stride, src_x, src_y, dst_x, dst_y, w, h);
+
+        if (memcmp(fb, ref, stride * yres * 4) != 0) {
+            printf("%s: mismatch after %dx%d blit from (%d, %d) to (%d, %d)\n",
+                   name, w, h, src_x, src_y, dst_x, dst_y);
+            free(ref);
+            return 0;
+        }
+    }
+
+    printf("%s: ok, %d of %d blits accelerated\n", name, accelerated, NTESTS);
+    free(ref);
+    return accelerated > 0;
+}
+
+/*
+ * The RGA request, as filled in by rk_rga_blt (which needs a ScreenPtr and
+ * can't be used here). RGA can't do the overlapped blits, so these are
+ * declined, and so are all the other formats but 32bpp.
+ */
+static int rga_blt(void *self, uint32_t *src_bits, uint32_t *dst_bits,
+                   int src_stride, int dst_stride, int src_bpp, int dst_bpp,
+                   int src_x, int src_y, int dst_x, int dst_y, int w, int h)
+{
+    struct rga_req req;
+    int fd_rga = *(int *)self;
+
+    if (src_bpp != 32 || dst_bpp != 32)
+        return 0;
+    if (src_bits == dst_bits && src_x < dst_x + w && dst_x < src_x + w &&
+        src_y < dst_y + h && dst_y < src_y + h)
+        return 0;
+
+    memset(&req, 0, sizeof(req));
+    req.render_mode = bitblt_mode;
+    req.mmu_info.mmu_en = 1;
+
+    req.src.format    = RK_FORMAT_RGBA_8888;
+    req.src.yrgb_addr = (uint32_t)(uintptr_t)src_bits;
+    req.src.vir_w     = src_stride;
+    req.src.vir_h     = src_y + h;
+    req.src.x_offset  = src_x;
+    req.src.y_offset  = src_y;
+    req.src.act_w     = w;
+    req.src.act_h     = h;
+
+    req.dst.format    = RK_FORMAT_RGBA_8888;
+    req.dst.yrgb_addr = (uint32_t)(uintptr_t)dst_bits;
+    req.dst.vir_w     = dst_stride;
+    req.dst.vir_h     = dst_y + h;
+    req.dst.x_offset  = dst_x;
+    req.dst.y_offset  = dst_y;
+    req.dst.act_w     = w;
+    req.dst.act_h     = h;
+
+    return ioctl(fd_rga, RGA_BLIT_SYNC, &req) == 0;
+}
+
+/* Returns -1 if there is no RGA, otherwise the result of check_blt2d */
+static int check_rga(void)
+{
+    struct fb_var_screeninfo var;
+    struct fb_fix_screeninfo fix;
+    blt2d_i blt2d = { NULL, rga_blt };
+    int fd_fb, fd_rga, result = -1;
+    void *addr;
+
+    if ((fd_rga = open("/dev/rga", O_RDWR)) < 0)
+        return -1;
+    if ((fd_fb = open("/dev/fb0", O_RDWR)) < 0) {
+        close(fd_rga);
+        return -1;
+    }
+    if (ioctl(fd_fb, FBIOGET_VSCREENINFO, &var) == 0 &&
+        ioctl(fd_fb, FBIOGET_FSCREENINFO, &fix) == 0 &&
+        var.bits_per_pixel == 32) {
+        addr = mmap(NULL, fix.smem_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd_fb, 0);
+        if (addr != MAP_FAILED) {
+            blt2d.self = &fd_rga;
+            result = check_blt2d("RGA", &blt2d, (uint32_t *)addr,
+                                 var.xres, var.yres, fix.line_length / 4);
+            munmap(addr, fix.smem_len);
+        }
+    }
+    close(fd_fb);
+    close(fd_rga);
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    sunxi_disp_t *disp;
+    fb_copyarea_t *fb;
+    int tested = 0, failed = 0, result;
+
+    disp = sunxi_disp_init("/dev/fb0", NULL);
+    if (disp && disp->fd_g2d >= 0 && disp->bits_per_pixel == 32) {
+        tested++;
+        if (!check_blt2d("G2D", &disp->blt2d, (uint32_t *)disp->framebuffer_addr,
+                         disp->xres, disp->yres, disp->xres))
+            failed++;
+    }
+    if (disp)
+        sunxi_disp_close(disp);
+
+    fb = fb_copyarea_init("/dev/fb0", NULL);
+    if (fb && fb->bits_per_pixel == 32) {
+        tested++;
+        if (!check_blt2d("FBIOCOPYAREA", &fb->blt2d,
+                         (uint32_t *)fb->framebuffer_addr,
+                         fb->xres, fb->yres, fb->framebuffer_stride))
+            failed++;
+    }
+    if (fb)
+        fb_copyarea_close(fb);
+
+    if ((result = check_rga()) >= 0) {
+        tested++;
+        if (!result)
+            failed++;
+    }
+
+    if (tested == 0) {
+        printf("no emulated devices found, is fakedev.so preloaded?\n");
+        return 1;
+    }
+    return failed ? 1 : 0;
+}
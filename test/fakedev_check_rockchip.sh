@@ -0,0 +1,6 @@
+#!/bin/sh
+# Runs fakedev_check on the emulated Rockchip devices (RGA), the rest of
+# the environment is set up by AM_TESTS_ENVIRONMENT
+FAKEDEV_PLATFORM=rockchip
+export FAKEDEV_PLATFORM
+exec ./fakedev_check